@@ -0,0 +1,584 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+
+#include "benchmark.h"
+#include "smdarchive.h"
+#include "threadpool.h"
+#include "transformkernels.h"
+
+using benchmark_clock = std::chrono::steady_clock;
+
+static double elapsed_seconds(benchmark_clock::time_point start)
+{
+	return std::chrono::duration<double>(benchmark_clock::now() - start).count();
+}
+
+void BuildBenchmarkAnimation(s_animation_t& anim, int num_bones, int num_frames)
+{
+	anim = {};
+	anim.name = "benchmark.smd";
+	anim.nodes.resize(num_bones);
+
+	for (int i = 0; i < num_bones; ++i)
+	{
+		auto& node = anim.nodes[i];
+		node.index = i;
+		node.name = "Bone" + std::to_string(i);
+		// A few long chains branching off the root, like limbs on a biped.
+		node.parent = i == 0 ? -1 : (i < 5 ? 0 : i - 4);
+		if (node.parent != -1)
+			anim.nodes[node.parent].children.push_back(i);
+	}
+
+	anim.frames.Resize(num_frames, num_bones);
+	for (int t = 0; t < num_frames; ++t)
+	{
+		for (int i = 0; i < num_bones; ++i)
+		{
+			glm::vec3 angles(0.01f * i + 0.001f * t, -0.02f * i, 0.03f * t);
+			glm::vec3 position(1.0f + 0.1f * i, 0.5f * (i % 3), 0.25f * t);
+			auto& local_transform = anim.frames[t].entries[i].local_transform;
+			local_transform = glm::eulerAngleZYX(angles[2], angles[1], angles[0]);
+			local_transform[3] = glm::vec4(position, 1.0f);
+		}
+	}
+
+	SMDHelper::BuildAnimationWorldTransform(anim);
+}
+
+void Benchmark_LoadAnimation::Invoke()
+{
+	constexpr int NUM_BONES = MAXSTUDIOBONES;
+	constexpr int NUM_FRAMES = 2000;
+	constexpr int NUM_RUNS = 5;
+
+	const auto file_path = (std::filesystem::temp_directory_path() / "smd_benchmark_load.smd").string();
+
+	{
+		s_animation_t anim;
+		BuildBenchmarkAnimation(anim, NUM_BONES, NUM_FRAMES);
+		SMDSerializer().WriteAnimation(anim, file_path.c_str());
+	}
+
+	const double megabytes = std::filesystem::file_size(file_path) / (1024.0 * 1024.0);
+
+	struct
+	{
+		const char* name;
+		SMDLoadMode mode;
+	} modes[] = {
+		{ "stream", SMDLoadMode::STREAM },
+		{ "memory mapped", SMDLoadMode::MEMORY_MAPPED },
+	};
+
+	s_animation_t results[2];
+
+	for (int m = 0; m < 2; ++m)
+	{
+		SMDFileLoader loader(modes[m].mode);
+
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; ++run)
+		{
+			s_animation_t anim;
+			auto start = benchmark_clock::now();
+			loader.LoadAnimation(file_path.c_str(), anim);
+			best = std::min(best, elapsed_seconds(start));
+
+			if (run == 0)
+				results[m] = std::move(anim);
+		}
+
+		printf("LoadAnimation (%s): %.3f s, %.1f MB/s, %.0f frames/s\n",
+			modes[m].name, best, megabytes / best, NUM_FRAMES / best);
+	}
+
+	// Both readers must produce the same animation.
+	bool identical = results[0].nodes.size() == results[1].nodes.size() &&
+		results[0].frames.size() == results[1].frames.size();
+
+	for (int t = 0; identical && t < results[0].frames.size(); ++t)
+	{
+		for (int i = 0; i < results[0].nodes.size(); ++i)
+		{
+			if (results[0].frames[t].entries[i].local_transform != results[1].frames[t].entries[i].local_transform)
+			{
+				identical = false;
+				break;
+			}
+		}
+	}
+
+	printf("LoadAnimation: results are %s\n", identical ? "identical" : "DIFFERENT");
+
+	// Cache misses parse and write the entry, hits copy it back.
+	{
+		const auto cache_directory = (std::filesystem::temp_directory_path() / "smd_benchmark_cache").string();
+		std::filesystem::remove_all(cache_directory);
+
+		SMDFileLoader loader;
+		loader.SetCacheDirectory(cache_directory.c_str());
+
+		s_animation_t anim;
+		auto start = benchmark_clock::now();
+		loader.LoadAnimation(file_path.c_str(), anim);
+		const double miss = elapsed_seconds(start);
+
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; ++run)
+		{
+			start = benchmark_clock::now();
+			loader.LoadAnimation(file_path.c_str(), anim);
+			best = std::min(best, elapsed_seconds(start));
+		}
+
+		printf("LoadAnimation (cache miss): %.3f s\n", miss);
+		printf("LoadAnimation (cache hit): %.3f s, %.0f frames/s\n", best, NUM_FRAMES / best);
+
+		bool cached_identical = anim.nodes.size() == results[1].nodes.size() &&
+			anim.frames.size() == results[1].frames.size();
+
+		for (int i = 0; cached_identical && i < anim.nodes.size(); ++i)
+		{
+			cached_identical = anim.nodes[i].name == results[1].nodes[i].name &&
+				anim.nodes[i].parent == results[1].nodes[i].parent &&
+				anim.nodes[i].children == results[1].nodes[i].children;
+		}
+
+		for (int t = 0; cached_identical && t < anim.frames.size(); ++t)
+		{
+			for (int i = 0; i < anim.nodes.size(); ++i)
+			{
+				if (anim.frames[t].entries[i].local_transform != results[1].frames[t].entries[i].local_transform)
+				{
+					cached_identical = false;
+					break;
+				}
+			}
+		}
+
+		printf("LoadAnimation: cached results are %s\n", cached_identical ? "identical" : "DIFFERENT");
+
+		std::filesystem::remove_all(cache_directory);
+	}
+
+	struct
+	{
+		const char* name;
+		SMDFloatFormat float_format;
+	} formats[] = {
+		{ "fixed", SMDFloatFormat::FIXED },
+		{ "shortest", SMDFloatFormat::SHORTEST },
+	};
+
+	for (const auto& format : formats)
+	{
+		SMDSerializer serializer(format.float_format);
+		serializer.SetSkipUnchangedFiles(false);
+
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; ++run)
+		{
+			auto start = benchmark_clock::now();
+			serializer.WriteAnimation(results[0], file_path.c_str());
+			best = std::min(best, elapsed_seconds(start));
+		}
+
+		const double written_megabytes = std::filesystem::file_size(file_path) / (1024.0 * 1024.0);
+
+		printf("WriteAnimation (%s): %.3f s, %.1f MB, %.1f MB/s, %.0f frames/s\n",
+			format.name, best, written_megabytes, written_megabytes / best, NUM_FRAMES / best);
+	}
+
+	{
+		// The file has the content of the last run, it is compared and left untouched.
+		SMDSerializer serializer(formats[1].float_format);
+
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; ++run)
+		{
+			auto start = benchmark_clock::now();
+			serializer.WriteAnimation(results[0], file_path.c_str());
+			best = std::min(best, elapsed_seconds(start));
+		}
+
+		printf("WriteAnimation (%s, unchanged file): %.3f s\n", formats[1].name, best);
+	}
+
+	std::filesystem::remove(file_path);
+}
+
+void Benchmark_FrameLayout::Invoke()
+{
+	constexpr int NUM_BONES = MAXSTUDIOBONES;
+	constexpr int NUM_FRAMES = 2000;
+	constexpr int NUM_RUNS = 5;
+
+	s_animation_t anim;
+	BuildBenchmarkAnimation(anim, NUM_BONES, NUM_FRAMES);
+
+	const glm::vec3 v(0.01f, 0.02f, 0.03f);
+
+	struct
+	{
+		const char* name;
+		std::function<void()> fn;
+	} cases[] = {
+		{ "BuildAnimationWorldTransform", [&]() { SMDHelper::BuildAnimationWorldTransform(anim); } },
+		{ "UpdateBoneHierarchyLocalFromWorld", [&]() { SMDHelper::UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, 0); } },
+		{ "UpdateBoneHierarchyWorldFromLocal", [&]() { SMDHelper::UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, 0); } },
+		{ "TranslateBoneInLocalSpace", [&]() { SMDHelper::TranslateBoneInLocalSpace(anim, 1, v); } },
+		{ "TranslateBoneInWorldSpace", [&]() { SMDHelper::TranslateBoneInWorldSpace(anim, 1, v); } },
+		{ "TranslateBoneInLocalSpaceRelative", [&]() { SMDHelper::TranslateBoneInLocalSpaceRelative(anim, 1, v); } },
+		{ "TranslateBoneInWorldSpaceRelative", [&]() { SMDHelper::TranslateBoneInWorldSpaceRelative(anim, 1, v); } },
+		{ "RotateBoneInLocalSpaceRelative", [&]() { SMDHelper::RotateBoneInLocalSpaceRelative(anim, 1, v); } },
+		{ "RotateBoneInWorldSpaceRelative", [&]() { SMDHelper::RotateBoneInWorldSpaceRelative(anim, 1, v); } },
+		{ "Copy animation", [&]() { s_animation_t copy = anim; } },
+		{ "AddBone + RemoveBone", [&]() {
+			SMDHelper::AddBone(anim, "Benchmark", v, v, 1);
+			SMDHelper::RemoveBone(anim, SMDHelper::FindNodeByName(anim.nodes, "Benchmark"));
+		} },
+		{ "8 x (AddBone + RemoveBone)", [&]() {
+			for (int i = 0; i < 8; ++i)
+				SMDHelper::AddBone(anim, ("Benchmark" + std::to_string(i)).c_str(), v, v, 1);
+			for (int i = 0; i < 8; ++i)
+				SMDHelper::RemoveBone(anim, SMDHelper::FindNodeByName(anim, ("Benchmark" + std::to_string(i)).c_str()));
+		} },
+		{ "ApplySkeletonEdit, same edits", [&]() {
+			s_skeleton_edit_t edit;
+			for (int i = 0; i < 8; ++i)
+				edit.AddBone(("Benchmark" + std::to_string(i)).c_str(), v, v, "Bone1");
+			for (int i = 0; i < 8; ++i)
+				edit.RemoveBone(("Benchmark" + std::to_string(i)).c_str());
+			SMDHelper::ApplySkeletonEdit(anim, edit);
+		} },
+	};
+
+	printf("Frame layout: %s, %d bones, %d frames\n",
+		SMD_FLAT_FRAME_STORAGE ? "flat" : "vector per frame", NUM_BONES, NUM_FRAMES);
+
+	for (auto& c : cases)
+	{
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; ++run)
+		{
+			auto start = benchmark_clock::now();
+			c.fn();
+			best = std::min(best, elapsed_seconds(start));
+		}
+
+		printf("%-36s %8.2f ms\n", c.name, best * 1000.0);
+	}
+}
+
+void Benchmark_CompactPose::Invoke()
+{
+	constexpr int NUM_BONES = MAXSTUDIOBONES;
+	constexpr int NUM_FRAMES = 2000;
+	constexpr int NUM_RUNS = 5;
+
+	s_animation_t anim;
+	BuildBenchmarkAnimation(anim, NUM_BONES, NUM_FRAMES);
+
+	s_compact_animation_t compact;
+	SMDHelper::CompactAnimation(anim, compact);
+
+	const double frame_megabytes = anim.frames.size() * anim.frames.GetBoneCount() * sizeof(s_animation_frame_entry_t) / (1024.0 * 1024.0);
+	const double compact_megabytes = compact.local_poses.size() * sizeof(s_bonepose_t) / (1024.0 * 1024.0);
+
+	printf("Pose memory, %d bones, %d frames: matrices %.1f MB, compact %.1f MB\n",
+		NUM_BONES, NUM_FRAMES, frame_megabytes, compact_megabytes);
+
+	const glm::vec3 v(0.01f, 0.02f, 0.03f);
+
+	struct
+	{
+		const char* name;
+		std::function<void()> fn;
+	} cases[] = {
+		{ "RotateBoneInLocalSpaceRelative", [&]() { SMDHelper::RotateBoneInLocalSpaceRelative(anim, 1, v); } },
+		{ "RotateBoneInLocalSpaceRelative (compact)", [&]() { SMDHelper::RotateBoneInLocalSpaceRelative(compact, 1, v); } },
+		{ "TranslateBoneInLocalSpaceRelative", [&]() { SMDHelper::TranslateBoneInLocalSpaceRelative(anim, 1, v); } },
+		{ "TranslateBoneInLocalSpaceRelative (compact)", [&]() { SMDHelper::TranslateBoneInLocalSpaceRelative(compact, 1, v); } },
+		{ "Copy animation", [&]() { s_animation_t copy = anim; } },
+		{ "Copy animation (compact)", [&]() { s_compact_animation_t copy = compact; } },
+	};
+
+	for (auto& c : cases)
+	{
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; ++run)
+		{
+			auto start = benchmark_clock::now();
+			c.fn();
+			best = std::min(best, elapsed_seconds(start));
+		}
+
+		printf("%-44s %8.2f ms\n", c.name, best * 1000.0);
+	}
+}
+
+void Benchmark_EditChain::Invoke()
+{
+	constexpr int NUM_BONES = MAXSTUDIOBONES;
+	constexpr int NUM_FRAMES = 2000;
+	constexpr int NUM_RUNS = 5;
+
+	s_animation_t reference;
+	BuildBenchmarkAnimation(reference, NUM_BONES, 1);
+
+	s_animation_t anim;
+	BuildBenchmarkAnimation(anim, NUM_BONES, NUM_FRAMES);
+
+	const glm::vec3 v(0.01f, 0.02f, 0.03f);
+
+	s_bone_transform_edit_t edit;
+	for (int bone = 1; bone <= 5; ++bone)
+	{
+		edit.RotateBoneInLocalSpaceRelative(anim.nodes[bone].name.c_str(), v);
+		edit.TranslateBoneInLocalSpace(anim.nodes[bone].name.c_str(), v);
+	}
+	edit.TranslateBoneInWorldSpaceRelative(anim.nodes[NUM_BONES - 1].name.c_str(), v);
+
+	struct
+	{
+		const char* name;
+		std::function<void()> fn;
+	} cases[] = {
+		{ "one by one", [&]() {
+			for (int bone = 1; bone <= 5; ++bone)
+			{
+				SMDHelper::RotateBoneInLocalSpaceRelative(anim, bone, v);
+				SMDHelper::TranslateBoneInLocalSpace(anim, bone, v);
+			}
+			SMDHelper::TranslateBoneInWorldSpaceRelative(anim, NUM_BONES - 1, v);
+		} },
+		{ "s_bone_transform_edit_t", [&]() { SMDHelper::ApplyBoneTransformEdit(anim, edit); } },
+	};
+
+	printf("Edit chain, %d bones, %d frames: 10 local edits + 1 world edit + FixupBonesLengths + world read\n",
+		NUM_BONES, NUM_FRAMES);
+
+	for (auto& c : cases)
+	{
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; ++run)
+		{
+			auto start = benchmark_clock::now();
+
+			c.fn();
+			SMDHelper::FixupBonesLengths(anim, reference);
+			SMDHelper::GetBonePositionInWorldSpace(anim, NUM_BONES - 1, 0);
+
+			best = std::min(best, elapsed_seconds(start));
+		}
+
+		printf("%-44s %8.2f ms\n", c.name, best * 1000.0);
+	}
+}
+
+void Benchmark_FrameParallel::Invoke()
+{
+	constexpr int NUM_BONES = MAXSTUDIOBONES;
+	constexpr int NUM_FRAMES = 10000;
+	constexpr int NUM_RUNS = 5;
+
+	s_animation_t anim;
+	BuildBenchmarkAnimation(anim, NUM_BONES, NUM_FRAMES);
+
+	const glm::vec3 v(0.01f, 0.02f, 0.03f);
+
+	struct
+	{
+		const char* name;
+		std::function<void()> fn;
+	} cases[] = {
+		{ "BuildAnimationWorldTransform", [&]() { SMDHelper::BuildAnimationWorldTransform(anim); } },
+		{ "UpdateBoneHierarchyLocalFromWorld", [&]() { SMDHelper::UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, 0); } },
+		{ "RotateBoneInWorldSpaceRelative", [&]() { SMDHelper::RotateBoneInWorldSpaceRelative(anim, 1, v); } },
+		{ "TranslateBoneInWorldSpaceRelative", [&]() { SMDHelper::TranslateBoneInWorldSpaceRelative(anim, 1, v); } },
+	};
+
+	ThreadPool pool;
+
+	printf("Frame parallel, %d bones, %d frames, %d workers: serial / parallel\n",
+		NUM_BONES, NUM_FRAMES, pool.GetWorkerCount());
+
+	for (auto& c : cases)
+	{
+		double best[2] = { 1e30, 1e30 };
+		for (int parallel = 0; parallel < 2; ++parallel)
+		{
+			SMDHelper::SetThreadPool(parallel ? &pool : nullptr);
+
+			for (int run = 0; run < NUM_RUNS; ++run)
+			{
+				auto start = benchmark_clock::now();
+				c.fn();
+				best[parallel] = std::min(best[parallel], elapsed_seconds(start));
+			}
+		}
+
+		SMDHelper::SetThreadPool(nullptr);
+
+		printf("%-36s %8.2f ms %8.2f ms\n", c.name, best[0] * 1000.0, best[1] * 1000.0);
+	}
+}
+
+void Benchmark_TransformKernels::Invoke()
+{
+	constexpr int NUM_BONES = MAXSTUDIOBONES;
+	constexpr int NUM_FRAMES = 2000;
+	constexpr int NUM_RUNS = 5;
+
+	s_animation_t anim;
+	BuildBenchmarkAnimation(anim, NUM_BONES, NUM_FRAMES);
+
+	auto get_world_transforms = [&anim]() {
+		std::vector<glm::mat4> transforms;
+		transforms.reserve(anim.frames.size() * anim.nodes.size());
+
+		for (size_t t = 0; t < anim.frames.size(); ++t)
+		{
+			auto&& frame = anim.frames[t];
+			for (size_t i = 0; i < anim.nodes.size(); ++i)
+				transforms.push_back(frame.entries[i].world_transform);
+		}
+
+		return transforms;
+	};
+
+	const TransformKernel previous_kernel = GetTransformKernel();
+	const TransformKernel default_kernel = GetSupportedTransformKernel();
+
+	printf("Transform kernels, %d bones, %d frames, default %s\n",
+		NUM_BONES, NUM_FRAMES, GetTransformKernelName(default_kernel));
+
+	std::vector<glm::mat4> scalar_transforms;
+
+	for (int k = static_cast<int>(TransformKernel::SCALAR); k <= static_cast<int>(TransformKernel::AVX); ++k)
+	{
+		const TransformKernel kernel = static_cast<TransformKernel>(k);
+		SetTransformKernel(kernel);
+
+		// Not supported by the CPU.
+		if (GetTransformKernel() != kernel)
+			continue;
+
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; ++run)
+		{
+			auto start = benchmark_clock::now();
+			SMDHelper::BuildAnimationWorldTransform(anim);
+			best = std::min(best, elapsed_seconds(start));
+		}
+
+		const auto transforms = get_world_transforms();
+		if (kernel == TransformKernel::SCALAR)
+			scalar_transforms = transforms;
+
+		const bool same = memcmp(transforms.data(), scalar_transforms.data(), transforms.size() * sizeof(glm::mat4)) == 0;
+
+		printf("BuildAnimationWorldTransform (%s)%*s %8.2f ms%s\n", GetTransformKernelName(kernel),
+			static_cast<int>(7 - strlen(GetTransformKernelName(kernel))), "", best * 1000.0, same ? "" : " DIFFERS FROM SCALAR");
+	}
+
+	SetTransformKernel(previous_kernel);
+}
+
+void Benchmark_AnimationArchive::Invoke()
+{
+	constexpr int NUM_FILES = 200;
+	constexpr int NUM_BONES = 60;
+	constexpr int NUM_FRAMES = 40;
+	constexpr int NUM_RUNS = 3;
+
+	const auto directory = std::filesystem::temp_directory_path() / "smd_benchmark_archive";
+	const auto archive_path = (std::filesystem::temp_directory_path() / "smd_benchmark_archive.smdpack").string();
+	std::filesystem::remove_all(directory);
+
+	// Two skeletons shared by all the files, in a few sub directories.
+	std::vector<std::string> file_paths;
+	for (int i = 0; i < NUM_FILES; ++i)
+	{
+		s_animation_t anim;
+		BuildBenchmarkAnimation(anim, NUM_BONES + (i % 2), NUM_FRAMES + i % 7);
+
+		const auto sub_directory = directory / ("set" + std::to_string(i % 4));
+		std::filesystem::create_directories(sub_directory);
+
+		const auto file_path = (sub_directory / ("anim" + std::to_string(i) + ".smd")).string();
+		SMDSerializer().WriteAnimation(anim, file_path.c_str());
+		file_paths.push_back(file_path);
+	}
+
+	auto start = benchmark_clock::now();
+	SMDAnimationArchive::Build(directory.string().c_str(), archive_path.c_str());
+	const double build = elapsed_seconds(start);
+
+	SMDAnimationArchive archive;
+	if (!archive.Open(archive_path.c_str(), directory.string().c_str()))
+	{
+		printf("AnimationArchive: cannot open %s\n", archive_path.c_str());
+		return;
+	}
+
+	SMDFileLoader file_loader;
+	SMDFileLoader archive_loader;
+	archive_loader.SetArchive(&archive);
+
+	std::vector<s_animation_t> parsed(NUM_FILES);
+	std::vector<s_animation_t> packed(NUM_FILES);
+
+	double best_parsed = 1e30;
+	double best_packed = 1e30;
+	for (int run = 0; run < NUM_RUNS; ++run)
+	{
+		start = benchmark_clock::now();
+		for (int i = 0; i < NUM_FILES; ++i)
+			file_loader.LoadAnimation(file_paths[i].c_str(), parsed[i]);
+		best_parsed = std::min(best_parsed, elapsed_seconds(start));
+
+		start = benchmark_clock::now();
+		for (int i = 0; i < NUM_FILES; ++i)
+			archive_loader.LoadAnimation(file_paths[i].c_str(), packed[i]);
+		best_packed = std::min(best_packed, elapsed_seconds(start));
+	}
+
+	printf("AnimationArchive: %d files, %.1f MB archive, built in %.3f s\n", NUM_FILES,
+		std::filesystem::file_size(archive_path) / (1024.0 * 1024.0), build);
+	printf("AnimationArchive: files %.3f s, archive %.3f s\n", best_parsed, best_packed);
+
+	// The archive keeps the world transforms, the parsed files build them on demand.
+	bool identical = true;
+	for (int i = 0; identical && i < NUM_FILES; ++i)
+	{
+		auto& a = parsed[i];
+		const auto& b = packed[i];
+		SMDHelper::UpdateWorldTransforms(a);
+
+		identical = a.name == b.name && a.nodes.size() == b.nodes.size() && a.frames.size() == b.frames.size() &&
+			!SMDHelper::HasDirtyBones(b);
+
+		for (int n = 0; identical && n < a.nodes.size(); ++n)
+		{
+			identical = a.nodes[n].name == b.nodes[n].name && a.nodes[n].parent == b.nodes[n].parent &&
+				a.nodes[n].children == b.nodes[n].children;
+		}
+
+		for (int t = 0; identical && t < a.frames.size(); ++t)
+		{
+			identical = memcmp(a.frames[t].entries.data(), b.frames[t].entries.data(),
+				a.nodes.size() * sizeof(s_animation_frame_entry_t)) == 0;
+		}
+	}
+
+	printf("AnimationArchive: results are %s\n", identical ? "identical" : "DIFFERENT");
+
+	archive.Close();
+	std::filesystem::remove(archive_path);
+	std::filesystem::remove_all(directory);
+}
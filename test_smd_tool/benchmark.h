@@ -0,0 +1,62 @@
+#pragma once
+
+#include "smdfile.h"
+
+//========================================================================================
+// Benchmarks
+//
+// Each benchmark builds its own synthetic data set so it can run without the
+// decompiled models. Enable them from main().
+//========================================================================================
+
+// Build a skeleton of num_bones bones, animated over num_frames frames.
+void BuildBenchmarkAnimation(s_animation_t& anim, int num_bones, int num_frames);
+
+class Benchmark_LoadAnimation
+{
+public:
+	void Invoke();
+};
+
+// Times the SMDHelper transform helpers on the frame layout selected by SMD_FLAT_FRAME_STORAGE.
+class Benchmark_FrameLayout
+{
+public:
+	void Invoke();
+};
+
+// Compares memory use and local space edits of s_animation_t and s_compact_animation_t.
+class Benchmark_CompactPose
+{
+public:
+	void Invoke();
+};
+
+// A chain of bone moves followed by a world space read, like an operation list,
+// applied one by one and fused in an s_bone_transform_edit_t.
+class Benchmark_EditChain
+{
+public:
+	void Invoke();
+};
+
+// Serial against frame parallel SMDHelper calls on a long animation.
+class Benchmark_FrameParallel
+{
+public:
+	void Invoke();
+};
+
+// BuildAnimationWorldTransform with each transform kernel the CPU supports.
+class Benchmark_TransformKernels
+{
+public:
+	void Invoke();
+};
+
+// Loading a directory of files one by one against loading them from an SMDAnimationArchive.
+class Benchmark_AnimationArchive
+{
+public:
+	void Invoke();
+};
@@ -0,0 +1,60 @@
+#include <cstdio>
+#include <cstdarg>
+
+#include "log.h"
+
+static thread_local std::string* t_log_capture = nullptr;
+
+void LogPrintf(const char* format, ...)
+{
+	va_list argptr;
+	va_start(argptr, format);
+
+	if (!t_log_capture)
+	{
+		vprintf(format, argptr);
+		va_end(argptr);
+		return;
+	}
+
+	char text[1024];
+	va_list copy;
+	va_copy(copy, argptr);
+	int length = vsnprintf(text, sizeof(text), format, argptr);
+	va_end(argptr);
+
+	if (length < 0)
+	{
+		va_end(copy);
+		return;
+	}
+
+	if (length < sizeof(text))
+	{
+		t_log_capture->append(text, length);
+	}
+	else
+	{
+		size_t start = t_log_capture->size();
+		t_log_capture->resize(start + length + 1);
+		vsnprintf(&(*t_log_capture)[start], length + 1, format, copy);
+		t_log_capture->resize(start + length);
+	}
+
+	va_end(copy);
+}
+
+LogCapture::LogCapture(std::string& buffer) : _previous(t_log_capture)
+{
+	t_log_capture = &buffer;
+}
+
+LogCapture::~LogCapture()
+{
+	t_log_capture = _previous;
+}
+
+std::string* LogCapture::GetBuffer()
+{
+	return t_log_capture;
+}
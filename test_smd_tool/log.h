@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+// printf to stdout, or to the capture buffer of the calling thread if any.
+void LogPrintf(const char* format, ...);
+
+// Redirect the LogPrintf calls made by the current thread to a buffer
+// for as long as the capture exists.
+class LogCapture
+{
+public:
+	LogCapture(std::string& buffer);
+	~LogCapture();
+
+	// Buffer the LogPrintf calls of the calling thread go to, null for stdout.
+	static std::string* GetBuffer();
+
+	LogCapture(const LogCapture&) = delete;
+	LogCapture& operator=(const LogCapture&) = delete;
+
+private:
+	std::string* _previous;
+};
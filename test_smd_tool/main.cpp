@@ -1,6 +1,12 @@
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <map>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <atomic>
 
 #ifdef _DEBUG
 #define _CRTDBG_MAP_ALLOC
@@ -8,6 +14,9 @@
 #endif
 
 #include "smdfile.h"
+#include "benchmark.h"
+#include "log.h"
+#include "threadpool.h"
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_access.hpp"
@@ -45,78 +54,378 @@ struct Variable
     std::string name;
 };
 
-class OperationContext
+// Names compare like _stricmp, the same as bone names.
+template<typename T>
+using NameMap = std::unordered_map<std::string, T, s_bone_name_hash_t, s_bone_name_equal_t>;
+
+//
+// Context variable names, interned for the whole process: each name gets an id
+// the first time it is seen, and names only differing by case share it.
+// Operations turn the names they use into handles once, contexts then find
+// variables by id without comparing strings.
+//
+class VariableNames
 {
 public:
+    static int Intern(std::string_view name)
+    {
+        auto& names = GetInstance();
+        std::lock_guard<std::mutex> lock(names._mutex);
 
-    s_animation_t* GetAnimation(const char* name) {
+        auto it = names._ids.find(name);
+        if (it != names._ids.end())
+            return it->second;
 
-        for (const auto& entry : _animations) {
-            if (!_stricmp(name, entry.first.c_str()))
-                return entry.second;
-        }
+        const int id = static_cast<int>(names._names.size());
+        names._names.emplace_back(name);
+        names._ids.emplace(names._names.back(), id);
+        return id;
+    }
 
-        return nullptr;
+    // Name as it was first interned. Names are never removed, so the reference
+    // stays valid and can be read without the lock.
+    static const std::string& GetName(int id)
+    {
+        auto& names = GetInstance();
+        std::lock_guard<std::mutex> lock(names._mutex);
+        return names._names[id];
     }
 
-    void SetAnimation(const char* name, s_animation_t* animation) {
+private:
+    static VariableNames& GetInstance()
+    {
+        static VariableNames names;
+        return names;
+    }
 
-        for (auto& entry : _animations) {
-            if (!_stricmp(name, entry.first.c_str())) {
-                entry.second = animation;
-                return;
-            }
+    std::mutex _mutex;
+    std::deque<std::string> _names;
+    NameMap<int> _ids;
+};
+
+// Interned name of a context variable of the given type.
+template<VariableType TYPE>
+struct VariableHandle
+{
+    VariableHandle() = default;
+
+    explicit VariableHandle(const char* p_name) : id(VariableNames::Intern(p_name)), name(&VariableNames::GetName(id))
+    {
+    }
+
+    bool IsValid() const { return id != -1; }
+
+    int id = -1;
+    // Interned name, so contexts do not look it up again.
+    const std::string* name = nullptr;
+};
+
+using AnimationHandle = VariableHandle<VariableType::ANIMATION>;
+using ReferenceHandle = VariableHandle<VariableType::REFERENCE>;
+using Vector3DHandle = VariableHandle<VariableType::VECTOR3D>;
+
+// Variables of one type of a context, indexed by name id.
+template<typename T>
+class VariableTable
+{
+public:
+    const T* Find(int id) const
+    {
+        if (id < 0 || id >= static_cast<int>(_slots.size()) || _slots[id] == -1)
+            return nullptr;
+
+        return &_values[_slots[id]].second;
+    }
+
+    void Set(int id, const std::string& name, const T& value)
+    {
+        if (id >= static_cast<int>(_slots.size()))
+            _slots.resize(id + 1, -1);
+
+        if (_slots[id] == -1) {
+            _slots[id] = static_cast<int>(_values.size());
+            _values.push_back(std::make_pair(name, value));
+        }
+        else {
+            _values[_slots[id]].second = value;
         }
-        _animations.push_back(std::make_pair(name, animation));
     }
 
-    s_animation_t* GetReference(const char* name) {
+    // Names and values, in the order the variables were first set.
+    const std::vector<std::pair<std::string, T>>& GetValues() const { return _values; }
 
-        for (const auto& entry : _references) {
-            if (!_stricmp(name, entry.first.c_str()))
-                return entry.second;
+private:
+    // Position in _values of each name id, -1 if not set.
+    std::vector<int> _slots;
+    std::vector<std::pair<std::string, T>> _values;
+};
+
+// Hash of the operations applied to a file and of everything they read,
+// see AnimationPipeline::SetManifestDirectory. FNV-1a over the values.
+class OperationFingerprint
+{
+public:
+    void AddBytes(const void* data, size_t size)
+    {
+        const auto bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            _hash ^= bytes[i];
+            _hash *= 1099511628211ull;
         }
+    }
 
-        return nullptr;
+    void Add(int value) { AddBytes(&value, sizeof(value)); }
+    void Add(float value) { AddBytes(&value, sizeof(value)); }
+    void Add(const glm::vec3& v) { AddBytes(&v, sizeof(v)); }
+
+    // Sized, so that consecutive strings cannot be confused.
+    void Add(const std::string& s)
+    {
+        Add(static_cast<int>(s.size()));
+        AddBytes(s.data(), s.size());
     }
 
-    void SetReference(const char* name, s_animation_t* reference) {
+    void Add(const Variable& variable)
+    {
+        Add(static_cast<int>(variable.type));
+        Add(variable.name);
+    }
 
-        for (auto& entry : _references) {
-            if (!_stricmp(name, entry.first.c_str())) {
-                entry.second = reference;
-                return;
-            }
-        }
-        _references.push_back(std::make_pair(name, reference));
+    template<typename A, typename B>
+    void Add(const std::pair<A, B>& pair)
+    {
+        Add(pair.first);
+        Add(pair.second);
+    }
+
+    template<typename T>
+    void Add(const std::list<T>& values)
+    {
+        Add(static_cast<int>(values.size()));
+        for (const auto& value : values)
+            Add(value);
     }
 
-    glm::vec3 GetVector3D(const char* name) {
+    template<typename T>
+    void Add(const std::vector<T>& values)
+    {
+        Add(static_cast<int>(values.size()));
+        for (const auto& value : values)
+            Add(value);
+    }
+
+    // Bones and local transforms.
+    void Add(const s_animation_t& animation)
+    {
+        Add(static_cast<int>(animation.nodes.size()));
+        for (const auto& node : animation.nodes) {
+            Add(node.name);
+            Add(node.parent);
+        }
 
-        for (const auto& entry : _vec3ds) {
-            if (!_stricmp(name, entry.first.c_str()))
-                return entry.second;
+        Add(static_cast<int>(animation.frames.size()));
+        for (size_t t = 0; t < animation.frames.size(); ++t) {
+            auto&& frame = animation.frames[t];
+            for (const auto& entry : frame.entries)
+                AddBytes(&entry.local_transform, sizeof(entry.local_transform));
         }
+    }
+
+    uint64_t GetValue() const { return _hash; }
+
+private:
+    uint64_t _hash = 14695981039346656037ull;
+};
+
+// Variables not found in a context are looked up in its parent, if any.
+// This lets each file of a pipeline have its own variables on top of shared ones.
+class OperationContext
+{
+public:
+    OperationContext(const OperationContext* parent = nullptr) : _parent(parent)
+    {
+    }
+
+    // Variables read by the operations unless told otherwise. AnimationPipeline
+    // sets the first two for each file.
+    static inline const AnimationHandle ANIMATION{ "animation" };
+    static inline const AnimationHandle ORIGINAL_ANIMATION{ "original_animation" };
+    static inline const ReferenceHandle INPUT_REFERENCE{ "input_reference" };
+
+    // The const char* accessors intern the name under a process-wide lock, they
+    // are for setup code. Operations make their handles once, when they are built.
+
+    s_animation_t* GetAnimation(AnimationHandle variable) const {
+
+        if (const auto value = _animations.Find(variable.id))
+            return *value;
+
+        return _parent ? _parent->GetAnimation(variable) : nullptr;
+    }
+
+    s_animation_t* GetAnimation(const char* name) const {
+        return GetAnimation(AnimationHandle(name));
+    }
+
+    void SetAnimation(AnimationHandle variable, s_animation_t* animation) {
+        _animations.Set(variable.id, *variable.name, animation);
+    }
+
+    void SetAnimation(const char* name, s_animation_t* animation) {
+        SetAnimation(AnimationHandle(name), animation);
+    }
+
+    s_animation_t* GetReference(ReferenceHandle variable) const {
+
+        if (const auto value = _references.Find(variable.id))
+            return *value;
+
+        return _parent ? _parent->GetReference(variable) : nullptr;
+    }
+
+    s_animation_t* GetReference(const char* name) const {
+        return GetReference(ReferenceHandle(name));
+    }
+
+    void SetReference(ReferenceHandle variable, s_animation_t* reference) {
+        _references.Set(variable.id, *variable.name, reference);
+    }
+
+    void SetReference(const char* name, s_animation_t* reference) {
+        SetReference(ReferenceHandle(name), reference);
+    }
+
+    glm::vec3 GetVector3D(Vector3DHandle variable) const {
+
+        if (const auto value = _vec3ds.Find(variable.id))
+            return *value;
+
+        if (_parent)
+            return _parent->GetVector3D(variable);
 
         throw;
     }
 
+    glm::vec3 GetVector3D(const char* name) const {
+        return GetVector3D(Vector3DHandle(name));
+    }
+
+    void SetVector3D(Vector3DHandle variable, const glm::vec3& v) {
+        _vec3ds.Set(variable.id, *variable.name, v);
+    }
+
     void SetVector3D(const char* name, const glm::vec3& v) {
+        SetVector3D(Vector3DHandle(name), v);
+    }
 
-        for (auto& entry : _vec3ds) {
-            if (!_stricmp(name, entry.first.c_str())) {
-                entry.second = v;
-                return;
-            }
+    // Output files written by the operations, or left untouched because they had the same content.
+    void CountOutputFile(SMDWriteResult result) {
+        ++_output_file_counts[static_cast<int>(result)];
+    }
+
+    int GetOutputFileCount(SMDWriteResult result) const {
+        return _output_file_counts[static_cast<int>(result)];
+    }
+
+    // Files written by the operations.
+    void AddOutputFile(const char* path) {
+        _output_files.push_back(path);
+    }
+
+    const std::vector<std::string>& GetOutputFiles() const {
+        return _output_files;
+    }
+
+    // Write an output file of the operations. With deferred writes, the file is
+    // only written by RunDeferredWrites, so a pipeline can write the files of an
+    // entry while it processes the next one.
+    void WriteAnimation(const SMDSerializer& serializer, const s_animation_t& animation, const char* path) {
+
+        if (_defer_writes) {
+            // The next operations may still change the animation.
+            auto copy = std::make_shared<const s_animation_t>(animation);
+            _deferred_writes.push_back([this, &serializer, copy, file_path = std::string(path)]() {
+                CountOutputFile(serializer.WriteAnimation(*copy, file_path.c_str()));
+            });
+        }
+        else {
+            CountOutputFile(serializer.WriteAnimation(animation, path));
+        }
+
+        if (serializer.GetOutputMode() == SMDOutputMode::MEMORY)
+            _memory_only_outputs = true;
+
+        AddOutputFile(path);
+    }
+
+    // True if some output files were only kept in memory, see SMDMemoryFiles.
+    bool HasMemoryOnlyOutputs() const {
+        return _memory_only_outputs;
+    }
+
+    void WriteOBJ(const SMDSerializer& serializer, const s_animation_t& animation, const char* path) {
+
+        if (_defer_writes) {
+            auto copy = std::make_shared<const s_animation_t>(animation);
+            _deferred_writes.push_back([&serializer, copy, file_path = std::string(path)]() {
+                serializer.WriteOBJ(*copy, file_path.c_str());
+            });
+        }
+        else {
+            serializer.WriteOBJ(animation, path);
+        }
+
+        AddOutputFile(path);
+    }
+
+    void SetDeferWrites(bool defer_writes) { _defer_writes = defer_writes; }
+
+    // Run the deferred writes, in the order they were made.
+    void RunDeferredWrites() {
+
+        auto writes = std::move(_deferred_writes);
+        _deferred_writes.clear();
+
+        for (const auto& write : writes)
+            write();
+    }
+
+    // Variables of this context, not the ones of its parent.
+    void AddToFingerprint(OperationFingerprint& fingerprint) const {
+        fingerprint.Add(_vec3ds.GetValues());
+
+        for (const auto& entry : _references.GetValues()) {
+            fingerprint.Add(entry.first);
+            fingerprint.Add(*entry.second);
+        }
+
+        for (const auto& entry : _animations.GetValues()) {
+            fingerprint.Add(entry.first);
+            fingerprint.Add(*entry.second);
         }
+    }
 
-        _vec3ds.push_back(std::make_pair(name, v));
+    // Bring the world transforms of the animations and references up to date,
+    // so they can be read from several threads.
+    void UpdateWorldTransforms() const {
+
+        for (const auto& entry : _animations.GetValues())
+            SMDHelper::UpdateWorldTransforms(*entry.second);
+
+        for (const auto& entry : _references.GetValues())
+            SMDHelper::UpdateWorldTransforms(*entry.second);
     }
 
 private:
-    std::list<std::pair<std::string, glm::vec3>> _vec3ds;
-    std::list<std::pair<std::string, s_animation_t*>> _references;
-    std::list<std::pair<std::string, s_animation_t*>> _animations;
+    const OperationContext* _parent;
+    int _output_file_counts[2]{};
+    std::vector<std::string> _output_files;
+    bool _memory_only_outputs = false;
+    bool _defer_writes = false;
+    std::vector<std::function<void()>> _deferred_writes;
+    VariableTable<glm::vec3> _vec3ds;
+    VariableTable<s_animation_t*> _references;
+    VariableTable<s_animation_t*> _animations;
 };
 
 class OperationList;
@@ -126,8 +435,71 @@ class Operation
 public:
     virtual void Invoke(OperationContext* const context) = 0;
     virtual const char* GetDescription() const = 0;
+    // Add the parameters of the operation, anything that changes what it does.
+    virtual void AddToFingerprint(OperationFingerprint& fingerprint) const = 0;
+    // Operations that only move bones add the moves they would make on the animation
+    // to the edit and return true, runs of them are applied in a single pass over the
+    // frames, see InvokeOperations.
+    virtual bool AddToBoneTransformEdit(s_bone_transform_edit_t& /*edit*/, const s_animation_t& /*animation*/) const { return false; }
 };
 
+//
+// Invoke the operations in order, on the "animation" of the context.
+//
+// Runs of consecutive operations that only move bones are fused in one
+// s_bone_transform_edit_t: the bones of the whole run are bound first and every
+// frame is moved once, with the same result as invoking them one by one. The
+// other operations, like bone removals or feet solving, run on their own and
+// split the runs. An operation whose bones cannot be bound also runs on its
+// own, so that it fails the same way whatever operations are next to it.
+//
+// invoke(step) runs step(), a single operation or a fused run, so both go
+// through the same error handling.
+//
+template<typename Invoke>
+void InvokeOperations(const std::list<Operation*>& operations, OperationContext* const context, const Invoke& invoke)
+{
+    auto it = operations.begin();
+    while (it != operations.end())
+    {
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_bone_transform_edit_t edit;
+        const auto add_to_edit = [&](const Operation* operation) {
+            try
+            {
+                return operation->AddToBoneTransformEdit(edit, animation);
+            }
+            catch (const std::exception&)
+            {
+                return false;
+            }
+        };
+
+        auto run_end = it;
+        while (run_end != operations.end() && add_to_edit(*run_end))
+            ++run_end;
+
+        if (run_end == it)
+        {
+            Operation* const operation = *it++;
+            invoke([&]() {
+                LogPrintf("%s\n", operation->GetDescription());
+                operation->Invoke(context);
+            });
+            continue;
+        }
+
+        invoke([&]() {
+            for (auto o = it; o != run_end; ++o)
+                LogPrintf("%s\n", (*o)->GetDescription());
+
+            SMDHelper::ApplyBoneTransformEdit(animation, edit);
+        });
+        it = run_end;
+    }
+}
+
 class OperationList : public Operation
 {
 public:
@@ -137,6 +509,14 @@ public:
 
     const char* GetDescription() const override { return _desc.c_str(); }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        for (const auto o : _operations) {
+            fingerprint.Add(std::string(o->GetDescription()));
+            o->AddToFingerprint(fingerprint);
+        }
+    }
+
     void AddOperation(Operation* operation)
     {
         _operations.push_back(operation);
@@ -144,19 +524,8 @@ public:
 
     void Invoke(OperationContext* const context) override
     {
-        for (auto& o : _operations)
-        {
-            try
-            {
-                printf("%s\n", o->GetDescription());
-                o->Invoke(context);
-            }
-            catch (...)
-            {
-                int a = 2;
-                a++;
-            }
-        }
+        // Errors, like bones missing from the animation, fail the whole entry.
+        InvokeOperations(_operations, context, [](const auto& step) { step(); });
     }
 
     std::list<Operation*> _operations;
@@ -183,16 +552,20 @@ public:
 
     const char* GetDescription() const override { return "ReplaceBoneParentOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_replacements);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
-        for (const auto& replacement : _replacements) {
-            SMDHelper::ReplaceBoneParent(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, replacement.first.c_str()),
-                SMDHelper::FindNodeByName(animation.nodes, replacement.second.c_str())
-            );
-        }
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_skeleton_edit_t edit;
+        for (const auto& replacement : _replacements)
+            edit.ReplaceBoneParent(replacement.first.c_str(), replacement.second.c_str());
+
+        SMDHelper::ApplySkeletonEdit(animation, edit);
     }
 
 private:
@@ -214,15 +587,20 @@ public:
 
     const char* GetDescription() const override { return "RemoveBoneOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_bones_to_remove);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
-        for (const auto& bone : _bones_to_remove) {
-            SMDHelper::RemoveBone(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, bone.c_str())
-            );
-        }
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_skeleton_edit_t edit;
+        for (const auto& bone : _bones_to_remove)
+            edit.RemoveBone(bone.c_str());
+
+        SMDHelper::ApplySkeletonEdit(animation, edit);
     }
 
 private:
@@ -244,6 +622,8 @@ public:
         _var_angles(""),
         _parent(parent ? parent : "")
     {
+        if (!_parent.empty())
+            _parent_binding.AddName(_parent.c_str());
     }
 
     AddBoneOperation(
@@ -258,36 +638,62 @@ public:
         _var_angles(angles_variable),
         _parent(parent ? parent : "")
     {
+        if (!_var_position.empty())
+            _position_variable = Vector3DHandle(position_variable);
+        if (!_var_angles.empty())
+            _angles_variable = Vector3DHandle(angles_variable);
+        if (!_parent.empty())
+            _parent_binding.AddName(_parent.c_str());
     }
 
     const char* GetDescription() const override { return "AddBoneOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_name);
+        fingerprint.Add(_parent);
+        fingerprint.Add(_local_bone_position);
+        fingerprint.Add(_local_bone_angles);
+        fingerprint.Add(_var_position);
+        fingerprint.Add(_var_angles);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
 
-        if (_var_position != "")
-            _local_bone_position = context->GetVector3D(_var_position.c_str());
-        if (_var_angles != "")
-            _local_bone_angles = context->GetVector3D(_var_angles.c_str());
+        // Operations are shared by all files, variables are read into locals.
+        glm::vec3 local_bone_position = _local_bone_position;
+        glm::vec3 local_bone_angles = _local_bone_angles;
+
+        if (_position_variable.IsValid())
+            local_bone_position = context->GetVector3D(_position_variable);
+        if (_angles_variable.IsValid())
+            local_bone_angles = context->GetVector3D(_angles_variable);
+
+        // Without a parent, the bone is added as a root.
+        const int parent = _parent_binding.IsEmpty() ? -1 : _parent_binding.Bind(animation)[0];
 
         SMDHelper::AddBone(
             animation,
             _name.c_str(),
-            _local_bone_position,
-            _local_bone_angles,
-            SMDHelper::FindNodeByName(animation.nodes, _parent.c_str())
+            local_bone_position,
+            local_bone_angles,
+            parent
         );
     }
 
 private:
     std::string _name;
     std::string _parent;
+    SMDBoneBinding _parent_binding;
     glm::vec3 _local_bone_position;
     glm::vec3 _local_bone_angles;
 
     std::string _var_position;
     std::string _var_angles;
+    Vector3DHandle _position_variable;
+    Vector3DHandle _angles_variable;
 };
 
 class RenameBoneOperation : public Operation
@@ -309,16 +715,20 @@ public:
 
     const char* GetDescription() const override { return "RenameBoneOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_bones_to_rename);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
-        for (const auto& renaming : _bones_to_rename) {
-            SMDHelper::RenameBone(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, renaming.first.c_str()),
-                renaming.second.c_str()
-            );
-        }
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_skeleton_edit_t edit;
+        for (const auto& renaming : _bones_to_rename)
+            edit.RenameBone(renaming.first.c_str(), renaming.second.c_str());
+
+        SMDHelper::ApplySkeletonEdit(animation, edit);
     }
 
 private:
@@ -331,31 +741,45 @@ public:
     RotateBoneInWorldSpaceRelativeOperation(const char* bone, const glm::vec3& angles)
     {
         _rotations.push_back(std::make_pair(bone, angles));
+        _bones.AddName(bone);
     }
 
     RotateBoneInWorldSpaceRelativeOperation(const std::list<std::pair<const char*, glm::vec3>>& rotations)
     {
         for (const auto& bone_and_rotation : rotations)
             _rotations.push_back(std::make_pair(bone_and_rotation.first, bone_and_rotation.second));
+        for (const auto& bone_and_rotation : _rotations)
+            _bones.AddName(bone_and_rotation.first.c_str());
     }
 
     const char* GetDescription() const override { return "RotateBoneInWorldSpaceRelativeOperation"; }
 
-    void Invoke(OperationContext* const context) override
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
     {
-        auto& animation = *context->GetAnimation("animation");
+        fingerprint.Add(_rotations);
+    }
+
+    bool AddToBoneTransformEdit(s_bone_transform_edit_t& edit, const s_animation_t& animation) const override
+    {
+        const auto& bones = _bones.Bind(animation);
+        int i = 0;
         for (const auto& bone_and_rotation : _rotations)
-        {
-            SMDHelper::RotateBoneInWorldSpaceRelative(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, bone_and_rotation.first.c_str()),
-                bone_and_rotation.second
-            );
-        }
+            edit.RotateBoneInWorldSpaceRelative(bones[i++], bone_and_rotation.second);
+        return true;
+    }
+
+    void Invoke(OperationContext* const context) override
+    {
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_bone_transform_edit_t edit;
+        AddToBoneTransformEdit(edit, animation);
+        SMDHelper::ApplyBoneTransformEdit(animation, edit);
     }
 
 private:
     std::list<std::pair<std::string, glm::vec3>> _rotations;
+    SMDBoneBinding _bones;
 };
 
 class RotateBoneInLocalSpaceRelativeOperation : public Operation
@@ -364,31 +788,45 @@ public:
     RotateBoneInLocalSpaceRelativeOperation(const char* bone, const glm::vec3& angles)
     {
         _rotations.push_back(std::make_pair(bone, angles));
+        _bones.AddName(bone);
     }
 
     RotateBoneInLocalSpaceRelativeOperation(const std::list<std::pair<const char*, glm::vec3>>& rotations)
     {
         for (const auto& bone_and_rotation : rotations)
             _rotations.push_back(std::make_pair(bone_and_rotation.first, bone_and_rotation.second));
+        for (const auto& bone_and_rotation : _rotations)
+            _bones.AddName(bone_and_rotation.first.c_str());
     }
 
     const char* GetDescription() const override { return "RotateBoneInLocalSpaceRelativeOperation"; }
 
-    void Invoke(OperationContext* const context) override
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_rotations);
+    }
+
+    bool AddToBoneTransformEdit(s_bone_transform_edit_t& edit, const s_animation_t& animation) const override
     {
-        auto& animation = *context->GetAnimation("animation");
+        const auto& bones = _bones.Bind(animation);
+        int i = 0;
         for (const auto& bone_and_rotation : _rotations)
-        {
-            SMDHelper::RotateBoneInLocalSpaceRelative(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, bone_and_rotation.first.c_str()),
-                bone_and_rotation.second
-            );
-        }
+            edit.RotateBoneInLocalSpaceRelative(bones[i++], bone_and_rotation.second);
+        return true;
+    }
+
+    void Invoke(OperationContext* const context) override
+    {
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_bone_transform_edit_t edit;
+        AddToBoneTransformEdit(edit, animation);
+        SMDHelper::ApplyBoneTransformEdit(animation, edit);
     }
 
 private:
     std::list<std::pair<std::string, glm::vec3>> _rotations;
+    SMDBoneBinding _bones;
 };
 
 class TranslateBoneInWorldSpaceRelativeOperation : public Operation
@@ -397,31 +835,45 @@ public:
     TranslateBoneInWorldSpaceRelativeOperation(const char* bone, const glm::vec3& translation)
     {
         _translations.push_back(std::make_pair(bone, translation));
+        _bones.AddName(bone);
     }
 
     TranslateBoneInWorldSpaceRelativeOperation(const std::list<std::pair<const char*, glm::vec3>>& translations)
     {
         for (const auto& bone_and_translation : translations)
             _translations.push_back(bone_and_translation);
+        for (const auto& bone_and_translation : _translations)
+            _bones.AddName(bone_and_translation.first.c_str());
     }
 
     const char* GetDescription() const override { return "TranslateBoneInWorldSpaceRelativeOperation"; }
 
-    void Invoke(OperationContext* const context) override
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
     {
-        auto& animation = *context->GetAnimation("animation");
+        fingerprint.Add(_translations);
+    }
+
+    bool AddToBoneTransformEdit(s_bone_transform_edit_t& edit, const s_animation_t& animation) const override
+    {
+        const auto& bones = _bones.Bind(animation);
+        int i = 0;
         for (const auto& bone_and_translation : _translations)
-        {
-            SMDHelper::TranslateBoneInWorldSpaceRelative(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, bone_and_translation.first.c_str()),
-                bone_and_translation.second
-            );
-        }
+            edit.TranslateBoneInWorldSpaceRelative(bones[i++], bone_and_translation.second);
+        return true;
+    }
+
+    void Invoke(OperationContext* const context) override
+    {
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_bone_transform_edit_t edit;
+        AddToBoneTransformEdit(edit, animation);
+        SMDHelper::ApplyBoneTransformEdit(animation, edit);
     }
 
 private:
     std::list<std::pair<std::string, glm::vec3>> _translations;
+    SMDBoneBinding _bones;
 };
 
 class TranslateBoneInLocalSpaceRelativeOperation : public Operation
@@ -430,31 +882,45 @@ public:
     TranslateBoneInLocalSpaceRelativeOperation(const char* bone, const glm::vec3& translation)
     {
         _translations.push_back(std::make_pair(bone, translation));
+        _bones.AddName(bone);
     }
 
     TranslateBoneInLocalSpaceRelativeOperation(const std::list<std::pair<const char*, glm::vec3>>& translations)
     {
         for (const auto& bone_and_translation : translations)
             _translations.push_back(bone_and_translation);
+        for (const auto& bone_and_translation : _translations)
+            _bones.AddName(bone_and_translation.first.c_str());
     }
 
     const char* GetDescription() const override { return "TranslateBoneInLocalSpaceRelativeOperation"; }
 
-    void Invoke(OperationContext* const context) override
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_translations);
+    }
+
+    bool AddToBoneTransformEdit(s_bone_transform_edit_t& edit, const s_animation_t& animation) const override
     {
-        auto& animation = *context->GetAnimation("animation");
+        const auto& bones = _bones.Bind(animation);
+        int i = 0;
         for (const auto& bone_and_translation : _translations)
-        {
-            SMDHelper::TranslateBoneInLocalSpaceRelative(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, bone_and_translation.first.c_str()),
-                bone_and_translation.second
-            );
-        }
+            edit.TranslateBoneInLocalSpaceRelative(bones[i++], bone_and_translation.second);
+        return true;
+    }
+
+    void Invoke(OperationContext* const context) override
+    {
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_bone_transform_edit_t edit;
+        AddToBoneTransformEdit(edit, animation);
+        SMDHelper::ApplyBoneTransformEdit(animation, edit);
     }
 
 private:
     std::list<std::pair<std::string, glm::vec3>> _translations;
+    SMDBoneBinding _bones;
 };
 
 class TranslateBoneInWorldSpaceOperation : public Operation
@@ -463,30 +929,44 @@ public:
     TranslateBoneInWorldSpaceOperation(const char* bone, const glm::vec3& translation)
     {
         _translations.push_back(std::make_pair(bone, translation));
+        _bones.AddName(bone);
     }
     TranslateBoneInWorldSpaceOperation(const std::list<std::pair<const char*, glm::vec3>>& translations)
     {
         for (const auto& translation : translations)
             _translations.push_back(translation);
+        for (const auto& bone_and_translation : _translations)
+            _bones.AddName(bone_and_translation.first.c_str());
     }
 
     const char* GetDescription() const override { return "TranslateBoneInWorldSpaceOperation"; }
 
-    void Invoke(OperationContext* const context) override
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
     {
-        auto& animation = *context->GetAnimation("animation");
+        fingerprint.Add(_translations);
+    }
+
+    bool AddToBoneTransformEdit(s_bone_transform_edit_t& edit, const s_animation_t& animation) const override
+    {
+        const auto& bones = _bones.Bind(animation);
+        int i = 0;
         for (const auto& bone_and_translation : _translations)
-        {
-            SMDHelper::TranslateBoneInWorldSpace(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, bone_and_translation.first.c_str()),
-                bone_and_translation.second
-            );
-        }
+            edit.TranslateBoneInWorldSpace(bones[i++], bone_and_translation.second);
+        return true;
+    }
+
+    void Invoke(OperationContext* const context) override
+    {
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_bone_transform_edit_t edit;
+        AddToBoneTransformEdit(edit, animation);
+        SMDHelper::ApplyBoneTransformEdit(animation, edit);
     }
 
 private:
     std::list<std::pair<std::string, glm::vec3>> _translations;
+    SMDBoneBinding _bones;
 };
 
 class TranslateBoneInLocalSpaceOperation : public Operation
@@ -495,30 +975,44 @@ public:
     TranslateBoneInLocalSpaceOperation(const char* bone, const glm::vec3& translation)
     {
         _translations.push_back(std::make_pair(bone, translation));
+        _bones.AddName(bone);
     }
     TranslateBoneInLocalSpaceOperation(const std::list<std::pair<const char*, glm::vec3>>& translations)
     {
         for (const auto& translation : translations)
             _translations.push_back(translation);
+        for (const auto& bone_and_translation : _translations)
+            _bones.AddName(bone_and_translation.first.c_str());
     }
 
     const char* GetDescription() const override { return "TranslateBoneInLocalSpaceOperation"; }
 
-    void Invoke(OperationContext* const context) override
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_translations);
+    }
+
+    bool AddToBoneTransformEdit(s_bone_transform_edit_t& edit, const s_animation_t& animation) const override
     {
-        auto& animation = *context->GetAnimation("animation");
+        const auto& bones = _bones.Bind(animation);
+        int i = 0;
         for (const auto& bone_and_translation : _translations)
-        {
-            SMDHelper::TranslateBoneInLocalSpace(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, bone_and_translation.first.c_str()),
-                bone_and_translation.second
-            );
-        }
+            edit.TranslateBoneInLocalSpace(bones[i++], bone_and_translation.second);
+        return true;
+    }
+
+    void Invoke(OperationContext* const context) override
+    {
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+
+        s_bone_transform_edit_t edit;
+        AddToBoneTransformEdit(edit, animation);
+        SMDHelper::ApplyBoneTransformEdit(animation, edit);
     }
 
 private:
     std::list<std::pair<std::string, glm::vec3>> _translations;
+    SMDBoneBinding _bones;
 };
 
 
@@ -527,10 +1021,14 @@ class FixupBonesLengthsOperation : public Operation
 public:
     const char* GetDescription() const override { return "FixupBonesLengthsOperation"; }
 
+    void AddToFingerprint(OperationFingerprint&) const override
+    {
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
-        auto& input_reference = *context->GetReference("input_reference");
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+        auto& input_reference = *context->GetReference(OperationContext::INPUT_REFERENCE);
         SMDHelper::FixupBonesLengths(
             animation,
             input_reference
@@ -555,22 +1053,38 @@ public:
         _original_anim_left_foot(original_anim_left_foot_name),
         _original_anim_right_foot(original_anim_right_foot_name)
     {
+        _anim_bones.AddName(anim_left_foot_name);
+        _anim_bones.AddName(anim_right_foot_name);
+        _anim_bones.AddName(anim_pelvis_name);
+        _original_anim_bones.AddName(original_anim_left_foot_name);
+        _original_anim_bones.AddName(original_anim_right_foot_name);
     }
 
     const char* GetDescription() const override { return "SolveFootsOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_anim_left_foot);
+        fingerprint.Add(_anim_right_foot);
+        fingerprint.Add(_anim_pelvis);
+        fingerprint.Add(_original_anim_left_foot);
+        fingerprint.Add(_original_anim_right_foot);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
-        const auto& original_animation = *context->GetAnimation("original_animation");
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+        const auto& original_animation = *context->GetAnimation(OperationContext::ORIGINAL_ANIMATION);
+        const auto& anim_bones = _anim_bones.Bind(animation);
+        const auto& original_anim_bones = _original_anim_bones.Bind(original_animation);
         SMDHelper::SolveFoots(
             animation,
-            _anim_left_foot.c_str(),
-            _anim_right_foot.c_str(),
-            _anim_pelvis.c_str(),
+            anim_bones[0],
+            anim_bones[1],
+            anim_bones[2],
             original_animation,
-            _original_anim_left_foot.c_str(),
-            _original_anim_right_foot.c_str()
+            original_anim_bones[0],
+            original_anim_bones[1]
         );
     }
 
@@ -581,6 +1095,11 @@ private:
     std::string _anim_pelvis;
     std::string _original_anim_left_foot;
     std::string _original_anim_right_foot;
+
+    // Left foot, right foot, pelvis.
+    SMDBoneBinding _anim_bones;
+    // Left foot, right foot.
+    SMDBoneBinding _original_anim_bones;
 };
 
 class SolveFootOperation : public Operation
@@ -595,20 +1114,32 @@ public:
         _anim_pelvis(anim_pelvis_name),
         _original_anim_foot(original_anim_foot_name)
     {
+        _anim_bones.AddName(anim_foot_name);
+        _anim_bones.AddName(anim_pelvis_name);
+        _original_anim_bones.AddName(original_anim_foot_name);
     }
 
     const char* GetDescription() const override { return "SolveFootOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_anim_foot);
+        fingerprint.Add(_anim_pelvis);
+        fingerprint.Add(_original_anim_foot);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
-        const auto& original_animation = *context->GetAnimation("original_animation");
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+        const auto& original_animation = *context->GetAnimation(OperationContext::ORIGINAL_ANIMATION);
+        const auto& anim_bones = _anim_bones.Bind(animation);
+        const auto& original_anim_bones = _original_anim_bones.Bind(original_animation);
         SMDHelper::SolveFoot(
             animation,
-            _anim_foot.c_str(),
-            _anim_pelvis.c_str(),
+            anim_bones[0],
+            anim_bones[1],
             original_animation,
-            _original_anim_foot.c_str()
+            original_anim_bones[0]
         );
     }
 
@@ -617,6 +1148,10 @@ private:
     std::string _anim_foot;
     std::string _anim_pelvis;
     std::string _original_anim_foot;
+
+    // Foot, pelvis.
+    SMDBoneBinding _anim_bones;
+    SMDBoneBinding _original_anim_bones;
 };
 
 class TranslateToBoneInWorldSpaceOperation : public Operation
@@ -624,32 +1159,48 @@ class TranslateToBoneInWorldSpaceOperation : public Operation
 public:
 
     TranslateToBoneInWorldSpaceOperation(const char* bone, const char* target_bone, const char* target_bone_animation_variable) :
-        _target_bone_animation_variable(target_bone_animation_variable)
+        _target_bone_animation_variable(target_bone_animation_variable),
+        _target_animation(target_bone_animation_variable)
     {
         _translations.push_back(std::make_pair(bone, target_bone));
+        _bones.AddName(bone);
+        _target_bones.AddName(target_bone);
     }
     TranslateToBoneInWorldSpaceOperation(
         const char* target_bone_animation_variable,
         const std::list<std::pair<const char*, const char*>>& translations) :
-        _target_bone_animation_variable(target_bone_animation_variable)
+        _target_bone_animation_variable(target_bone_animation_variable),
+        _target_animation(target_bone_animation_variable)
     {
         for (const auto& translation : translations)
+        {
             _translations.push_back(translation);
+            _bones.AddName(translation.first);
+            _target_bones.AddName(translation.second);
+        }
     }
 
     const char* GetDescription() const override { return "TranslateToBoneInWorldSpaceOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_translations);
+        fingerprint.Add(_target_bone_animation_variable);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
-        const auto& target_animation = *context->GetAnimation(_target_bone_animation_variable.c_str());
-        for (const auto& translation : _translations)
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+        const auto& target_animation = *context->GetAnimation(_target_animation);
+        const auto& bones = _bones.Bind(animation);
+        const auto& target_bones = _target_bones.Bind(target_animation);
+        for (int i = 0; i < _translations.size(); ++i)
         {
             SMDHelper::TranslateToBoneInWorldSpace(
                 animation,
-                SMDHelper::FindNodeByName(animation.nodes, translation.first.c_str()),
+                bones[i],
                 target_animation,
-                SMDHelper::FindNodeByName(target_animation.nodes, translation.second.c_str())
+                target_bones[i]
             );
         }
     }
@@ -658,6 +1209,9 @@ private:
 
     std::list<std::pair<std::string, std::string>> _translations;
     std::string _target_bone_animation_variable;
+    AnimationHandle _target_animation;
+    SMDBoneBinding _bones;
+    SMDBoneBinding _target_bones;
 };
 
 #if 1
@@ -667,34 +1221,51 @@ public:
     CopyBoneTransformationOperation(const char* bone, const char* target_bone, const char* target_bone_animation_variable,
         int target_bone_frame) :
         _target_bone_frame(target_bone_frame),
-        _target_bone_animation_variable(target_bone_animation_variable)
+        _target_bone_animation_variable(target_bone_animation_variable),
+        _target_animation(target_bone_animation_variable)
     {
         _bones.push_back(std::make_pair(bone, target_bone));
+        _bone_binding.AddName(bone);
+        _target_bone_binding.AddName(target_bone);
     }
     CopyBoneTransformationOperation(
         const char* target_bone_animation_variable,
         const int target_bone_frame,
         const std::list<std::pair<const char*, const char*>>& bones) :
         _target_bone_frame(target_bone_frame),
-        _target_bone_animation_variable(target_bone_animation_variable)
+        _target_bone_animation_variable(target_bone_animation_variable),
+        _target_animation(target_bone_animation_variable)
     {
         for (const auto& bone : bones)
+        {
             _bones.push_back(bone);
+            _bone_binding.AddName(bone.first);
+            _target_bone_binding.AddName(bone.second);
+        }
     }
 
     const char* GetDescription() const override { return "CopyBoneTransformationOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_bones);
+        fingerprint.Add(_target_bone_animation_variable);
+        fingerprint.Add(_target_bone_frame);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
-        const auto& target_animation = *context->GetAnimation(_target_bone_animation_variable.c_str());
-        for (const auto& bones : _bones)
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+        const auto& target_animation = *context->GetAnimation(_target_animation);
+        const auto& bones = _bone_binding.Bind(animation);
+        const auto& target_bones = _target_bone_binding.Bind(target_animation);
+        for (int i = 0; i < _bones.size(); ++i)
         {
             SMDHelper::CopyBoneTransformation(
                 animation,
-                SMDHelper::FindNodeByName(animation.nodes, bones.first.c_str()),
+                bones[i],
                 target_animation,
-                SMDHelper::FindNodeByName(target_animation.nodes, bones.second.c_str()),
+                target_bones[i],
                 _target_bone_frame
             );
         }
@@ -703,7 +1274,10 @@ public:
 private:
     std::list<std::pair<std::string, std::string>> _bones;
     std::string _target_bone_animation_variable;
+    AnimationHandle _target_animation;
     int _target_bone_frame;
+    SMDBoneBinding _bone_binding;
+    SMDBoneBinding _target_bone_binding;
 };
 
 #endif
@@ -719,13 +1293,18 @@ public:
 
     const char* GetDescription() const override { return "WriteOBJOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_output_dir);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
 
         char filepath[_MAX_PATH]{};
         snprintf(filepath, sizeof(filepath), "%s/%s.obj", _output_dir.c_str(), animation.name.c_str());
-        _serializer.WriteOBJ(animation, filepath);
+        context->WriteOBJ(_serializer, animation, filepath);
     }
 
 private:
@@ -745,13 +1324,19 @@ public:
 
     const char* GetDescription() const override { return "WriteAnimationOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_output_dir);
+        fingerprint.Add(static_cast<int>(_serializer.GetFloatFormat()));
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto& animation = *context->GetAnimation("animation");
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
 
         char filepath[_MAX_PATH]{};
         snprintf(filepath, sizeof(filepath), "%s/%s", _output_dir.c_str(), animation.name.c_str());
-        _serializer.WriteAnimation(animation, filepath);
+        context->WriteAnimation(_serializer, animation, filepath);
     }
 
 private:
@@ -772,42 +1357,61 @@ public:
         const char* src_bone,
         int frame = 0) :
         _dest_var(dest_variable),
+        _dest(dest_variable),
         _src_var(src_variable),
         _src_bone(src_bone),
         _frame(frame)
     {
+        _src_bone_binding.AddName(src_bone);
+
+        if (_src_var.type == VariableType::REFERENCE)
+            _src_reference = ReferenceHandle(_src_var.name.c_str());
+        else if (_src_var.type == VariableType::ANIMATION)
+            _src_animation = AnimationHandle(_src_var.name.c_str());
     }
 
     const char* GetDescription() const override { return "GetBonePositionInLocalSpaceOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_dest_var);
+        fingerprint.Add(_src_var);
+        fingerprint.Add(_src_bone);
+        fingerprint.Add(_frame);
+    }
+
     void Invoke(OperationContext* const context) override
     {
         s_animation_t* src = nullptr;
         switch (_src_var.type)
         {
         case  VariableType::REFERENCE:
-            src = context->GetReference(_src_var.name.c_str()); 
+            src = context->GetReference(_src_reference);
             break;
         case  VariableType::ANIMATION:
-            src = context->GetAnimation(_src_var.name.c_str());
+            src = context->GetAnimation(_src_animation);
             break;
         default:
             throw;
         }
 
         glm::vec3 pos = SMDHelper::GetBonePositionInLocalSpace(*src,
-            SMDHelper::FindNodeByName(src->nodes, _src_bone.c_str()),
+            _src_bone_binding.Bind(*src)[0],
             _frame);
 
-        context->SetVector3D(_dest_var.c_str(), pos);
+        context->SetVector3D(_dest, pos);
     }
 
 private:
 
     std::string _dest_var;
+    Vector3DHandle _dest;
     Variable _src_var;
+    ReferenceHandle _src_reference;
+    AnimationHandle _src_animation;
     std::string _src_bone;
     int _frame;
+    SMDBoneBinding _src_bone_binding;
 };
 
 class GetBoneAnglesInLocalSpaceOperation : public Operation
@@ -820,42 +1424,61 @@ public:
         const char* src_bone,
         int frame = 0) :
         _dest_var(dest_variable),
+        _dest(dest_variable),
         _src_var(src_variable),
         _src_bone(src_bone),
         _frame(frame)
     {
+        _src_bone_binding.AddName(src_bone);
+
+        if (_src_var.type == VariableType::REFERENCE)
+            _src_reference = ReferenceHandle(_src_var.name.c_str());
+        else if (_src_var.type == VariableType::ANIMATION)
+            _src_animation = AnimationHandle(_src_var.name.c_str());
     }
 
     const char* GetDescription() const override { return "GetBoneAnglesInLocalSpaceOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_dest_var);
+        fingerprint.Add(_src_var);
+        fingerprint.Add(_src_bone);
+        fingerprint.Add(_frame);
+    }
+
     void Invoke(OperationContext* const context) override
     {
         s_animation_t* src = nullptr;
         switch (_src_var.type)
         {
         case  VariableType::REFERENCE:
-            src = context->GetReference(_src_var.name.c_str());
+            src = context->GetReference(_src_reference);
             break;
         case  VariableType::ANIMATION:
-            src = context->GetAnimation(_src_var.name.c_str());
+            src = context->GetAnimation(_src_animation);
             break;
         default:
             throw;
         }
 
         glm::vec3 angles = SMDHelper::GetBoneAnglesInLocalSpace(*src,
-            SMDHelper::FindNodeByName(src->nodes, _src_bone.c_str()),
+            _src_bone_binding.Bind(*src)[0],
             _frame);
 
-        context->SetVector3D(_dest_var.c_str(), angles);
+        context->SetVector3D(_dest, angles);
     }
 
 private:
 
     std::string _dest_var;
+    Vector3DHandle _dest;
     Variable _src_var;
+    ReferenceHandle _src_reference;
+    AnimationHandle _src_animation;
     std::string _src_bone;
     int _frame;
+    SMDBoneBinding _src_bone_binding;
 };
 
 
@@ -867,22 +1490,30 @@ public:
         const char* vector3d_variable,
         const float scale) :
         _variable_name(vector3d_variable),
+        _variable(vector3d_variable),
         _scale(scale)
     {
     }
 
     const char* GetDescription() const override { return "ScaleVector3DOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_variable_name);
+        fingerprint.Add(_scale);
+    }
+
     void Invoke(OperationContext* const context) override
     {
-        auto v = context->GetVector3D(_variable_name.c_str());
+        auto v = context->GetVector3D(_variable);
         v *= _scale;
-        context->SetVector3D(_variable_name.c_str(), v);
+        context->SetVector3D(_variable, v);
     }
 
 private:
 
     std::string _variable_name;
+    Vector3DHandle _variable;
     float _scale;
 };
 
@@ -899,6 +1530,7 @@ public:
         _src_var(src_variable)
     {
         _bones_src_dest.push_back(std::make_pair(src_bone, dest_bone));
+        MakeHandles();
     }
     CopyBoneLocalSpaceTransformToBoneOperation(
         const Variable& dest_variable,
@@ -909,10 +1541,18 @@ public:
     {
         for (auto bone_src_dest : bones_src_dest)
             _bones_src_dest.push_back(bone_src_dest);
+        MakeHandles();
     }
 
     const char* GetDescription() const override { return "CopyBoneLocalSpaceTransformToBoneOperation"; }
 
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_src_var);
+        fingerprint.Add(_dest_var);
+        fingerprint.Add(_bones_src_dest);
+    }
+
     void Invoke(OperationContext* const context) override
     {
         s_animation_t* src = nullptr;
@@ -920,10 +1560,10 @@ public:
         switch (_src_var.type)
         {
         case  VariableType::REFERENCE:
-            src = context->GetReference(_src_var.name.c_str());
+            src = context->GetReference(_src_reference);
             break;
         case  VariableType::ANIMATION:
-            src = context->GetAnimation(_src_var.name.c_str());
+            src = context->GetAnimation(_src_animation);
             break;
         default:
             throw;
@@ -931,10 +1571,10 @@ public:
         switch (_dest_var.type)
         {
         case  VariableType::REFERENCE:
-            dest = context->GetReference(_dest_var.name.c_str());
+            dest = context->GetReference(_dest_reference);
             break;
         case  VariableType::ANIMATION:
-            dest = context->GetAnimation(_dest_var.name.c_str());
+            dest = context->GetAnimation(_dest_animation);
             break;
         default:
             throw;
@@ -943,16 +1583,33 @@ public:
         for (const auto& bone_src_dest : _bones_src_dest) {
             SMDHelper::CopyBoneLocalSpaceTransformToBone(
                 *dest,
-                SMDHelper::FindNodeByName(dest->nodes, bone_src_dest.second.c_str()),
+                SMDHelper::FindNodeByName(*dest, bone_src_dest.second.c_str()),
                 *src,
-                SMDHelper::FindNodeByName(src->nodes, bone_src_dest.first.c_str())
+                SMDHelper::FindNodeByName(*src, bone_src_dest.first.c_str())
             );
         }
     }
 
 private:
+    void MakeHandles()
+    {
+        if (_src_var.type == VariableType::REFERENCE)
+            _src_reference = ReferenceHandle(_src_var.name.c_str());
+        else if (_src_var.type == VariableType::ANIMATION)
+            _src_animation = AnimationHandle(_src_var.name.c_str());
+
+        if (_dest_var.type == VariableType::REFERENCE)
+            _dest_reference = ReferenceHandle(_dest_var.name.c_str());
+        else if (_dest_var.type == VariableType::ANIMATION)
+            _dest_animation = AnimationHandle(_dest_var.name.c_str());
+    }
+
     Variable _src_var;
     Variable _dest_var;
+    ReferenceHandle _src_reference;
+    AnimationHandle _src_animation;
+    ReferenceHandle _dest_reference;
+    AnimationHandle _dest_animation;
 
     // src -> dest
     std::list<std::pair<std::string, std::string>> _bones_src_dest;
@@ -967,158 +1624,1045 @@ public:
         const char* reference_bone)
     {
         _bones_anim_ref.push_back(std::make_pair(anim_bone, reference_bone));
+        _anim_bones.AddName(anim_bone);
+        _reference_bones.AddName(reference_bone);
     }
     CopyReferenceBoneLocalSpaceToAnimationBoneOperation(
         const std::list<std::pair<const char*, const char*>>& bones_anim_ref)
     {
         for (auto bone_anim_ref : bones_anim_ref)
+        {
             _bones_anim_ref.push_back(bone_anim_ref);
+            _anim_bones.AddName(bone_anim_ref.first);
+            _reference_bones.AddName(bone_anim_ref.second);
+        }
+    }
+
+    const char* GetDescription() const override { return "CopyReferenceBoneLocalSpaceToAnimationBoneOperation"; }
+
+    void AddToFingerprint(OperationFingerprint& fingerprint) const override
+    {
+        fingerprint.Add(_bones_anim_ref);
+    }
+
+    void Invoke(OperationContext* const context) override
+    {
+        auto& animation = *context->GetAnimation(OperationContext::ANIMATION);
+        auto& input_reference = *context->GetReference(OperationContext::INPUT_REFERENCE);
+        const auto& anim_bones = _anim_bones.Bind(animation);
+        const auto& reference_bones = _reference_bones.Bind(input_reference);
+        for (int i = 0; i < _bones_anim_ref.size(); ++i)
+        {
+            SMDHelper::CopyReferenceBoneLocalSpaceToAnimationBone(
+                animation,
+                anim_bones[i],
+                input_reference,
+                reference_bones[i]
+            );
+        }
+    }
+
+private:
+    // anim <- ref
+    std::list<std::pair<std::string, std::string>> _bones_anim_ref;
+    SMDBoneBinding _anim_bones;
+    SMDBoneBinding _reference_bones;
+};
+
+//========================================================================================
+// Pipeline
+//========================================================================================
+
+struct AnimationPipelineEntry
+{
+    AnimationPipelineEntry(const char* p_name, const char* p_output_dir, 
+        const char* p_original_directory) :
+        name(p_name), directory(p_output_dir), 
+        original_directory(p_original_directory)
+    {
+    }
+    AnimationPipelineEntry(const char* p_name, const char* p_output_dir,
+        const char* p_original_directory, Operation* operation) :
+        AnimationPipelineEntry(p_name, p_output_dir, p_original_directory)
+    {
+        operations.push_back(operation);
+    }
+
+    const char* name = nullptr;
+    const char* directory = nullptr;
+    const char* original_directory = nullptr;
+    std::list<Operation*> operations;
+};
+
+//
+// What a pipeline entry read and wrote the last time it ran, see
+// AnimationPipeline::SetManifestDirectory.
+//
+// The entry is up to date when the fingerprint of its operations and of the
+// shared variables is the same, its input files did not change, and the files
+// it wrote are still there, untouched. Files are compared by modification time
+// and size.
+//
+class AnimationPipelineManifest
+{
+public:
+    // Bump when the operations change what they do, to run all the entries again.
+    static constexpr int VERSION = 1;
+
+    struct FileVersion
+    {
+        std::string path;
+        long long time = 0;
+        unsigned long long size = 0;
+
+        bool operator==(const FileVersion& other) const {
+            return path == other.path && time == other.time && size == other.size;
+        }
+    };
+
+    // False if the file cannot be read.
+    static bool GetFileVersion(const char* path, FileVersion& version)
+    {
+        std::error_code ec;
+        const auto time = std::filesystem::last_write_time(path, ec);
+        if (ec)
+            return false;
+
+        const auto size = std::filesystem::file_size(path, ec);
+        if (ec)
+            return false;
+
+        version.path = path;
+        version.time = static_cast<long long>(time.time_since_epoch().count());
+        version.size = static_cast<unsigned long long>(size);
+        return true;
+    }
+
+    bool AddInput(const char* path) { return AddFile(path, _inputs); }
+    bool AddOutput(const char* path) { return AddFile(path, _outputs); }
+    void SetFingerprint(uint64_t fingerprint) { _fingerprint = fingerprint; }
+
+    // Same fingerprint and inputs as current, and the outputs did not change since.
+    bool IsUpToDate(const AnimationPipelineManifest& current) const
+    {
+        if (_fingerprint != current._fingerprint || _inputs != current._inputs || _outputs.empty())
+            return false;
+
+        for (const auto& output : _outputs) {
+            FileVersion version;
+            if (!GetFileVersion(output.path.c_str(), version) || !(version == output))
+                return false;
+        }
+
+        return true;
+    }
+
+    bool Read(const char* manifest_path)
+    {
+        FILE* fp = fopen(manifest_path, "r");
+        if (!fp)
+            return false;
+
+        char line[_MAX_PATH + 128];
+        int version = 0;
+        bool valid = fgets(line, sizeof(line), fp) && sscanf(line, "smd_manifest %d", &version) == 1 && version == VERSION;
+
+        while (valid && fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\r\n")] = '\0';
+
+            char kind[16];
+            FileVersion file;
+            int path_offset = 0;
+            unsigned long long fingerprint;
+
+            if (sscanf(line, "fingerprint %llx", &fingerprint) == 1)
+                _fingerprint = fingerprint;
+            else if (sscanf(line, "%15s %lld %llu %n", kind, &file.time, &file.size, &path_offset) == 3 && path_offset > 0) {
+                file.path = line + path_offset;
+                if (!strcmp(kind, "input"))
+                    _inputs.push_back(file);
+                else if (!strcmp(kind, "output"))
+                    _outputs.push_back(file);
+                else
+                    valid = false;
+            }
+            else
+                valid = false;
+        }
+
+        fclose(fp);
+        return valid;
+    }
+
+    bool Write(const char* manifest_path) const
+    {
+        FILE* fp = fopen(manifest_path, "w");
+        if (!fp)
+            return false;
+
+        fprintf(fp, "smd_manifest %d\n", VERSION);
+        fprintf(fp, "fingerprint %016llx\n", static_cast<unsigned long long>(_fingerprint));
+        for (const auto& input : _inputs)
+            fprintf(fp, "input %lld %llu %s\n", input.time, input.size, input.path.c_str());
+        for (const auto& output : _outputs)
+            fprintf(fp, "output %lld %llu %s\n", output.time, output.size, output.path.c_str());
+
+        return fclose(fp) == 0;
+    }
+
+private:
+    static bool AddFile(const char* path, std::vector<FileVersion>& files)
+    {
+        FileVersion version;
+        if (!GetFileVersion(path, version))
+            return false;
+
+        files.push_back(version);
+        return true;
+    }
+
+    uint64_t _fingerprint = 0;
+    std::vector<FileVersion> _inputs;
+    std::vector<FileVersion> _outputs;
+};
+
+class AnimationPipeline
+{
+public:
+    AnimationPipeline(const SMDFileLoader& smdloader) : 
+        _smdloader(smdloader),
+        _num_workers(s_default_worker_count),
+        _prefetch_count(s_default_prefetch_count),
+        _manifest_directory(s_default_manifest_directory)
+    {
+    }
+
+    // Number of workers used by Invoke.
+    // 1 processes the files one after another on the calling thread,
+    // 0 or less uses one worker per hardware thread.
+    void SetWorkerCount(int num_workers) { _num_workers = num_workers; }
+
+    // Worker count of the pipelines created afterwards.
+    static void SetDefaultWorkerCount(int num_workers) { s_default_worker_count = num_workers; }
+
+    // Keep a manifest of each entry in directory, and skip the entries whose input
+    // files, operations, shared variables and output files did not change since
+    // they last ran. Off when empty. See AnimationPipelineManifest.
+    void SetManifestDirectory(const char* directory) { _manifest_directory = directory ? directory : ""; }
+
+    // Manifest directory of the pipelines created afterwards.
+    static void SetDefaultManifestDirectory(const char* directory) { s_default_manifest_directory = directory ? directory : ""; }
+
+    // Entries skipped by the last Invoke because they were up to date.
+    int GetUpToDateEntryCount() const { return _num_up_to_date_entries; }
+
+    // With more than one worker, also split the frames of each file over the workers,
+    // see SMDHelper::SetThreadPool. Helps when there are fewer files than workers.
+    void SetFrameParallel(bool frame_parallel) { _frame_parallel = frame_parallel; }
+
+    // With one worker, load the files of the next prefetch_count entries on a
+    // background thread, and write the output files of the processed entries on
+    // another, while the calling thread runs the operations. Each stage is at most
+    // prefetch_count entries ahead of the next one, so only about twice that many
+    // entries are in memory whatever the number of files. Like with several
+    // workers, an entry must not read the files written by the entries before
+    // it. Off when 0. Logs are printed per entry, in registration order.
+    void SetPrefetchCount(int prefetch_count) { _prefetch_count = prefetch_count; }
+
+    // Prefetch count of the pipelines created afterwards.
+    static void SetDefaultPrefetchCount(int prefetch_count) { s_default_prefetch_count = prefetch_count; }
+
+    void SetContextAnimation(const char* name, s_animation_t& animation, Variable* output_var = nullptr)
+    {
+        _context.SetAnimation(name, &animation);
+        if (output_var) {
+            output_var->type = VariableType::ANIMATION;
+            output_var->name = name;
+        }
+    }
+
+    void SetContextReference(const char* name, s_animation_t& reference, Variable* output_var = nullptr)
+    {
+        _context.SetReference(name, &reference);
+        if (output_var) {
+            output_var->type = VariableType::REFERENCE;
+            output_var->name = name;
+        }
+    }
+
+    void RegisterFiles(const std::list<const char*>& filenames,
+        const char* input_directory,
+        const char* original_directory)
+    {
+        for (const auto name : filenames)
+            AddEntry(AnimationPipelineEntry(name, input_directory, original_directory));
+    }
+
+    void RegisterFilesWithOperation(Operation* operation, const std::list<const char*>& filenames,
+        const char* input_directory,
+        const char* original_directory)
+    {
+        for (const auto name : filenames)
+            AddEntry(AnimationPipelineEntry(name, input_directory, original_directory, operation));
+    }
+
+    void AddOperationToAllFiles(Operation* operation)
+    {
+        for (auto& entry : _entries)
+            entry.operations.push_back(operation);
+    }
+
+    void AddOperationToFiles(Operation* operation, const std::list<const char*>& animations)
+    {
+        // Entries get the operation once, in registration order, even if named twice.
+        std::vector<int> indices;
+        for (const auto animation_name : animations) {
+            auto it = _entry_indices.find(std::string_view(animation_name));
+            if (it != _entry_indices.end())
+                indices.insert(indices.end(), it->second.begin(), it->second.end());
+        }
+
+        std::sort(indices.begin(), indices.end());
+        indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+        for (int index : indices)
+            _entries[index].operations.push_back(operation);
+    }
+
+    void Invoke()
+    {
+        _num_written_files = 0;
+        _num_unchanged_files = 0;
+        _num_up_to_date_entries = 0;
+
+        if (!_manifest_directory.empty()) {
+            std::error_code ec;
+            std::filesystem::create_directories(_manifest_directory, ec);
+
+            OperationFingerprint fingerprint;
+            fingerprint.Add(AnimationPipelineManifest::VERSION);
+            _context.AddToFingerprint(fingerprint);
+            _shared_fingerprint = fingerprint;
+        }
+
+        if (_num_workers != 1)
+        {
+            InvokeParallel();
+        }
+        else if (_prefetch_count > 0)
+        {
+            InvokeStreaming();
+        }
+        else
+        {
+            for (const auto& entry : _entries)
+                InvokeEntry(entry);
+        }
+
+        LogPrintf("%d files written, %d unchanged\n", _num_written_files.load(), _num_unchanged_files.load());
+        if (!_manifest_directory.empty())
+            LogPrintf("%d entries up to date\n", _num_up_to_date_entries.load());
+    }
+
+private:
+    void AddEntry(AnimationPipelineEntry&& entry)
+    {
+        _entry_indices[entry.name].push_back(static_cast<int>(_entries.size()));
+        _entries.push_back(std::move(entry));
+    }
+
+    void InvokeParallel()
+    {
+
+        // Shared variables are read by every file at the same time.
+        _context.UpdateWorldTransforms();
+
+        ThreadPool pool(_num_workers);
+        ThreadPool::TaskGroup group;
+
+        // Each file logs to its own buffer. Buffers are printed in registration
+        // order, as soon as all the files registered before are done.
+        std::vector<std::string> logs(_entries.size());
+        std::vector<bool> done(_entries.size(), false);
+        std::string* output = LogCapture::GetBuffer();
+        size_t next_log = 0;
+        std::mutex log_mutex;
+
+        size_t index = 0;
+        for (const auto& entry : _entries)
+        {
+            pool.Submit(group, [&, index, p_entry = &entry]() {
+                {
+                    LogCapture capture(logs[index]);
+                    SMDHelper::ThreadPoolScope frame_pool(_frame_parallel ? &pool : nullptr);
+                    InvokeEntry(*p_entry);
+                }
+
+                std::lock_guard<std::mutex> lock(log_mutex);
+                done[index] = true;
+                for (; next_log < logs.size() && done[next_log]; ++next_log)
+                {
+                    PrintEntryLog(output, logs[next_log]);
+                    std::string().swap(logs[next_log]);
+                }
+            });
+            ++index;
+        }
+
+        pool.Wait(group);
+        fflush(stdout);
+    }
+
+    // An entry on its way through the pipeline: its files are loaded, its
+    // operations run, then its outputs and manifest are written.
+    struct EntryJob
+    {
+        EntryJob(const AnimationPipelineEntry& p_entry, const OperationContext* shared_context) :
+            entry(p_entry),
+            context(shared_context)
+        {
+        }
+
+        const AnimationPipelineEntry& entry;
+        // Shared variables are only read, each file sets its own on top of them.
+        OperationContext context;
+        std::string file_path;
+        std::string original_file_path;
+        std::string manifest_path;
+        AnimationPipelineManifest manifest;
+        bool up_to_date = false;
+        std::shared_ptr<const s_animation_t> shared_anim;
+        std::shared_ptr<const s_animation_t> shared_original_anim;
+        // Thrown again by RunEntry, to be reported like the errors of the operations.
+        std::exception_ptr load_error;
+        bool succeeded = false;
+        // Logs of the entry, printed once it is done.
+        std::string log;
+    };
+
+    void InvokeStreaming()
+    {
+        BoundedQueue<std::unique_ptr<EntryJob>> loaded_jobs(_prefetch_count);
+        BoundedQueue<std::unique_ptr<EntryJob>> processed_jobs(_prefetch_count);
+        std::string* output = LogCapture::GetBuffer();
+
+        std::thread prefetch_thread([&]() {
+            for (const auto& entry : _entries)
+            {
+                auto job = std::make_unique<EntryJob>(entry, &_context);
+                {
+                    LogCapture capture(job->log);
+                    LoadEntry(*job);
+                }
+                loaded_jobs.Push(std::move(job));
+            }
+            loaded_jobs.Close();
+        });
+
+        std::thread write_thread([&]() {
+            std::unique_ptr<EntryJob> job;
+            while (processed_jobs.Pop(job))
+            {
+                {
+                    LogCapture capture(job->log);
+                    FinishEntry(*job);
+                }
+                PrintEntryLog(output, job->log);
+            }
+        });
+
+        std::unique_ptr<EntryJob> job;
+        while (loaded_jobs.Pop(job))
+        {
+            {
+                LogCapture capture(job->log);
+                job->context.SetDeferWrites(true);
+                RunEntry(*job);
+            }
+            processed_jobs.Push(std::move(job));
+        }
+        processed_jobs.Close();
+
+        prefetch_thread.join();
+        write_thread.join();
+        fflush(stdout);
+    }
+
+    // Print the logs of an entry where the thread that invoked the pipeline logs to.
+    static void PrintEntryLog(std::string* output, const std::string& log)
+    {
+        if (output)
+            output->append(log);
+        else
+            fputs(log.c_str(), stdout);
+    }
+
+    void InvokeEntry(const AnimationPipelineEntry& entry) const
+    {
+        EntryJob job(entry, &_context);
+        LoadEntry(job);
+        RunEntry(job);
+        FinishEntry(job);
+    }
+
+    void LoadEntry(EntryJob& job) const
+    {
+        char file_path[_MAX_PATH]{};
+        snprintf(file_path, sizeof(file_path), "%s/%s.smd", job.entry.directory, job.entry.name);
+        job.file_path = file_path;
+
+        char original_file_path[_MAX_PATH]{};
+        snprintf(original_file_path, sizeof(original_file_path), "%s/%s.smd", job.entry.original_directory, job.entry.name);
+        job.original_file_path = original_file_path;
+
+        if (!_manifest_directory.empty() && PrepareManifest(job.entry, file_path, original_file_path, job.manifest_path, job.manifest))
+        {
+            AnimationPipelineManifest previous;
+            if (previous.Read(job.manifest_path.c_str()) && previous.IsUpToDate(job.manifest))
+            {
+                LogPrintf("%s is up to date\n", file_path);
+                ++_num_up_to_date_entries;
+                job.up_to_date = true;
+                return;
+            }
+
+            // Only entries that ran to the end get a manifest.
+            std::error_code ec;
+            std::filesystem::remove(job.manifest_path, ec);
+        }
+
+        try
+        {
+            // The original animation is often the input file itself, it is read once and copied.
+            job.shared_anim = SMDSharedAnimationCache::Load(_smdloader, file_path);
+            job.shared_original_anim = SMDSharedAnimationCache::Load(_smdloader, original_file_path);
+        }
+        catch (...)
+        {
+            job.load_error = std::current_exception();
+        }
+    }
+
+    void RunEntry(EntryJob& job) const
+    {
+        if (job.up_to_date)
+            return;
+
+        auto& context = job.context;
+
+        try
+        {
+            if (job.load_error)
+                std::rethrow_exception(job.load_error);
+
+            s_animation_t anim = *job.shared_anim;
+            s_animation_t original_anim = *job.shared_original_anim;
+            job.shared_anim.reset();
+            job.shared_original_anim.reset();
+
+            context.SetAnimation(OperationContext::ANIMATION, &anim);
+            context.SetAnimation(OperationContext::ORIGINAL_ANIMATION, &original_anim);
+
+            InvokeOperations(job.entry.operations, &context, [](const auto& step) { step(); });
+
+            job.succeeded = true;
+        }
+        catch (const std::exception& e)
+        {
+            // Report and move on to the next file.
+            LogPrintf("\n************ ERROR ************\n%s\n", e.what());
+        }
+        catch (...)
+        {
+            int a = 2;
+            a++;
+        }
+
+        // The animations are gone, so is anything the operations pointed at them.
+        context.SetAnimation(OperationContext::ANIMATION, nullptr);
+        context.SetAnimation(OperationContext::ORIGINAL_ANIMATION, nullptr);
+    }
+
+    void FinishEntry(EntryJob& job) const
+    {
+        if (job.up_to_date)
+            return;
+
+        auto& context = job.context;
+
+        try
+        {
+            context.RunDeferredWrites();
+        }
+        catch (const std::exception& e)
+        {
+            LogPrintf("\n************ ERROR ************\n%s\n", e.what());
+            job.succeeded = false;
+        }
+        catch (...)
+        {
+            job.succeeded = false;
+        }
+
+        _num_written_files += context.GetOutputFileCount(SMDWriteResult::WRITTEN);
+        _num_unchanged_files += context.GetOutputFileCount(SMDWriteResult::UNCHANGED);
+
+        // Outputs kept in memory only cannot be checked, and skipping the entry
+        // would leave them out of memory, so the entry runs again. An old file
+        // left at their path on disk must not stand for them.
+        if (job.succeeded && !job.manifest_path.empty() && !context.HasMemoryOnlyOutputs())
+        {
+            bool outputs_on_disk = true;
+            for (const auto& output : context.GetOutputFiles())
+                outputs_on_disk = outputs_on_disk && job.manifest.AddOutput(output.c_str());
+
+            if (outputs_on_disk)
+                job.manifest.Write(job.manifest_path.c_str());
+        }
+    }
+
+    // Fingerprint and inputs of the entry, false if its inputs cannot be checked.
+    bool PrepareManifest(const AnimationPipelineEntry& entry, const char* file_path, const char* original_file_path,
+        std::string& manifest_path, AnimationPipelineManifest& manifest) const
+    {
+        // Inputs written in memory by an earlier conversion are read from there,
+        // the version of the file on disk says nothing about them.
+        if (SMDMemoryFiles::Find(file_path) || SMDMemoryFiles::Find(original_file_path))
+            return false;
+
+        if (!manifest.AddInput(file_path))
+            return false;
+
+        if (strcmp(file_path, original_file_path) && !manifest.AddInput(original_file_path))
+            return false;
+
+        OperationFingerprint fingerprint = _shared_fingerprint;
+        for (const auto o : entry.operations) {
+            fingerprint.Add(std::string(o->GetDescription()));
+            o->AddToFingerprint(fingerprint);
+        }
+        manifest.SetFingerprint(fingerprint.GetValue());
+
+        // One manifest per input and original file pair and operations, so the
+        // conversions reading the same files do not replace each other's manifests.
+        OperationFingerprint path_hash;
+        path_hash.Add(std::string(file_path));
+        path_hash.Add(std::string(original_file_path));
+        const uint64_t operations_hash = fingerprint.GetValue();
+        path_hash.AddBytes(&operations_hash, sizeof(operations_hash));
+
+        char manifest_name[_MAX_PATH]{};
+        snprintf(manifest_name, sizeof(manifest_name), "%s_%016llx.manifest", entry.name,
+            static_cast<unsigned long long>(path_hash.GetValue()));
+        manifest_path = (std::filesystem::path(_manifest_directory) / manifest_name).string();
+        return true;
+    }
+
+    const SMDFileLoader& _smdloader;
+    std::vector<AnimationPipelineEntry> _entries;
+    // Entries of each file name, several when a name is registered from several directories.
+    NameMap<std::vector<int>> _entry_indices;
+    OperationContext _context;
+    int _num_workers;
+    bool _frame_parallel = true;
+    int _prefetch_count;
+    mutable std::atomic<int> _num_written_files{ 0 };
+    mutable std::atomic<int> _num_unchanged_files{ 0 };
+    mutable std::atomic<int> _num_up_to_date_entries{ 0 };
+    std::string _manifest_directory;
+    OperationFingerprint _shared_fingerprint;
+
+    inline static int s_default_worker_count = 1;
+    inline static int s_default_prefetch_count = 0;
+    inline static std::string s_default_manifest_directory;
+};
+
+//
+// Conversions that main can run by name, each registered with the files and
+// directories it reads and the directories it writes, see REGISTER_CONVERSION_JOB.
+//
+// Run starts the jobs concurrently, except that a job waits for the jobs before
+// it in the list that write a path it reads or writes, or that read a path it
+// writes. Running a list of jobs gives the same files as running them one after
+// another, in order. The jobs load their files through SMDSharedAnimationCache,
+// where the inputs that several jobs declare are retained: the animations loaded
+// from them stay loaded until the last of these jobs is done.
+//
+class ConversionJobs
+{
+public:
+    struct Files
+    {
+        // Files and directories read by the job.
+        std::vector<std::string> inputs;
+        // Directories written by the job.
+        std::vector<std::string> outputs;
+    };
+
+    struct Job
+    {
+        std::string name;
+        std::function<void()> invoke;
+        Files files;
+        // False for the jobs that redo other jobs, like chains, which only run when named.
+        bool run_by_all;
+    };
+
+    template<typename Conversion>
+    static bool Register(const char* name, bool run_by_all = true)
+    {
+        GetJobs().push_back({ name, []() { Conversion().Invoke(); }, Conversion::GetFiles(), run_by_all });
+        return true;
+    }
+
+    // Jobs in registration order.
+    static std::vector<Job>& GetJobs()
+    {
+        static std::vector<Job> jobs;
+        return jobs;
+    }
+
+    // Null if no job has the name. Case insensitive.
+    static const Job* Find(const char* name)
+    {
+        for (const auto& job : GetJobs())
+        {
+            if (_stricmp(job.name.c_str(), name) == 0)
+                return &job;
+        }
+
+        return nullptr;
+    }
+
+    // Run up to num_workers jobs at the same time, 0 or less for one per hardware
+    // thread. With several workers, the logs of each job are printed once it is done,
+    // in list order. A job that fails does not stop the jobs that do not depend on
+    // it, the first error is thrown again once they are done.
+    static void Run(const std::vector<const Job*>& jobs, int num_workers)
+    {
+        std::vector<std::vector<std::string>> shared_inputs = GetSharedInputs(jobs);
+        for (const auto& inputs : shared_inputs)
+        {
+            for (const auto& input : inputs)
+                SMDSharedAnimationCache::Retain(input.c_str());
+        }
+
+        try
+        {
+            if (num_workers == 1 || jobs.size() < 2)
+                RunSerially(jobs, shared_inputs);
+            else
+                RunConcurrently(jobs, num_workers, shared_inputs);
+        }
+        catch (...)
+        {
+            for (auto& inputs : shared_inputs)
+                ReleaseInputs(inputs);
+            throw;
+        }
     }
 
-    const char* GetDescription() const override { return "CopyReferenceBoneLocalSpaceToAnimationBoneOperation"; }
+private:
+    // shared_inputs[i] are the inputs of jobs[i] that other jobs read too. The
+    // animations loaded from them are kept until the last of these jobs is done.
+    static std::vector<std::vector<std::string>> GetSharedInputs(const std::vector<const Job*>& jobs)
+    {
+        // Inputs of each job keyed by normalized path, read once per job.
+        std::vector<std::map<std::string, std::string>> job_inputs(jobs.size());
+        std::unordered_map<std::string, int> num_readers;
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            for (const auto& input : jobs[i]->files.inputs)
+            {
+                const std::string normalized = NormalizePath(input);
+                if (job_inputs[i].emplace(normalized, input).second)
+                    ++num_readers[normalized];
+            }
+        }
+
+        std::vector<std::vector<std::string>> shared_inputs(jobs.size());
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            for (const auto& [normalized, input] : job_inputs[i])
+            {
+                if (num_readers[normalized] > 1)
+                    shared_inputs[i].push_back(input);
+            }
+        }
+
+        return shared_inputs;
+    }
+
+    static void ReleaseInputs(std::vector<std::string>& inputs)
+    {
+        for (const auto& input : inputs)
+            SMDSharedAnimationCache::Release(input.c_str());
+        inputs.clear();
+    }
+
+    // Logs the error of the job and keeps the first one in error.
+    static bool InvokeJob(const Job& job, std::exception_ptr& error, std::mutex& mutex)
+    {
+        try
+        {
+            job.invoke();
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            LogPrintf("\n************ ERROR ************\n%s\n", e.what());
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+
+        return false;
+    }
+
+    static void RunSerially(const std::vector<const Job*>& jobs, std::vector<std::vector<std::string>>& shared_inputs)
+    {
+        // Set when a job, or a job it waits for, failed.
+        std::vector<bool> failed(jobs.size(), false);
+        std::exception_ptr error;
+        std::mutex mutex;
+
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            LogPrintf("==== %s ====\n", jobs[i]->name.c_str());
+            bool succeeded = false;
+            if (failed[i])
+                LogPrintf("skipped, a job it depends on failed\n");
+            else
+                succeeded = InvokeJob(*jobs[i], error, mutex);
+            ReleaseInputs(shared_inputs[i]);
+
+            if (!succeeded)
+            {
+                for (size_t j = i + 1; j < jobs.size(); ++j)
+                {
+                    if (DependsOn(*jobs[j], *jobs[i]))
+                        failed[j] = true;
+                }
+            }
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    static void RunConcurrently(const std::vector<const Job*>& jobs, int num_workers, std::vector<std::vector<std::string>>& shared_inputs)
+    {
+        // dependents[i] are the jobs after i that wait for it.
+        std::vector<std::vector<size_t>> dependents(jobs.size());
+        std::vector<int> num_dependencies(jobs.size(), 0);
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            for (size_t j = i + 1; j < jobs.size(); ++j)
+            {
+                if (DependsOn(*jobs[j], *jobs[i]))
+                {
+                    dependents[i].push_back(j);
+                    ++num_dependencies[j];
+                }
+            }
+        }
+
+        ThreadPool pool(num_workers);
+        ThreadPool::TaskGroup group;
+
+        std::vector<std::string> logs(jobs.size());
+        std::vector<bool> done(jobs.size(), false);
+        // Set when a job, or a job it waits for, failed.
+        std::vector<bool> failed(jobs.size(), false);
+        size_t next_log = 0;
+        std::exception_ptr error;
+        std::mutex mutex;
+
+        std::function<void(size_t)> submit = [&](size_t index) {
+            pool.Submit(group, [&, index]() {
+                bool succeeded = false;
+                {
+                    LogCapture capture(logs[index]);
+                    LogPrintf("==== %s ====\n", jobs[index]->name.c_str());
+                    if (failed[index])
+                    {
+                        LogPrintf("skipped, a job it depends on failed\n");
+                    }
+                    else
+                    {
+                        succeeded = InvokeJob(*jobs[index], error, mutex);
+                    }
+                }
+
+                ReleaseInputs(shared_inputs[index]);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                done[index] = true;
+                for (; next_log < logs.size() && done[next_log]; ++next_log)
+                {
+                    fputs(logs[next_log].c_str(), stdout);
+                    std::string().swap(logs[next_log]);
+                }
+
+                for (size_t dependent : dependents[index])
+                {
+                    if (!succeeded)
+                        failed[dependent] = true;
+                    if (--num_dependencies[dependent] == 0)
+                        submit(dependent);
+                }
+            });
+        };
 
-    void Invoke(OperationContext* const context) override
-    {
-        auto& animation = *context->GetAnimation("animation");
-        auto& input_reference = *context->GetReference("input_reference");
-        for (const auto& bone_anim_ref : _bones_anim_ref)
         {
-            SMDHelper::CopyReferenceBoneLocalSpaceToAnimationBone(
-                animation,
-                SMDHelper::FindNodeByName(animation.nodes, bone_anim_ref.first.c_str()),
-                input_reference,
-                SMDHelper::FindNodeByName(input_reference.nodes, bone_anim_ref.second.c_str())
-            );
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < jobs.size(); ++i)
+            {
+                if (num_dependencies[i] == 0)
+                    submit(i);
+            }
         }
-    }
-
-private:
-    // anim <- ref
-    std::list<std::pair<std::string, std::string>> _bones_anim_ref;
-};
 
-//========================================================================================
-// Pipeline
-//========================================================================================
+        pool.Wait(group);
+        fflush(stdout);
 
-struct AnimationPipelineEntry
-{
-    AnimationPipelineEntry(const char* p_name, const char* p_output_dir, 
-        const char* p_original_directory) :
-        name(p_name), directory(p_output_dir), 
-        original_directory(p_original_directory)
-    {
-    }
-    AnimationPipelineEntry(const char* p_name, const char* p_output_dir,
-        const char* p_original_directory, Operation* operation) :
-        AnimationPipelineEntry(p_name, p_output_dir, p_original_directory)
-    {
-        operations.push_back(operation);
+        if (error)
+            std::rethrow_exception(error);
     }
 
-    const char* name = nullptr;
-    const char* directory = nullptr;
-    const char* original_directory = nullptr;
-    std::list<Operation*> operations;
-};
-
-class AnimationPipeline
-{
-public:
-    AnimationPipeline(const SMDFileLoader& smdloader) : _smdloader(smdloader)
+    static std::string NormalizePath(const std::string& path)
     {
+        std::string normalized = std::filesystem::path(path).lexically_normal().generic_string();
+        while (normalized.size() > 1 && normalized.back() == '/')
+            normalized.pop_back();
+        std::transform(normalized.begin(), normalized.end(), normalized.begin(), [](unsigned char c) { return std::tolower(c); });
+        return normalized;
     }
 
-    void SetContextAnimation(const char* name, s_animation_t& animation, Variable* output_var = nullptr)
+    // True if one of the paths is the other or is inside it.
+    static bool PathsOverlap(const std::string& a, const std::string& b)
     {
-        _context.SetAnimation(name, &animation);
-        if (output_var) {
-            output_var->type = VariableType::ANIMATION;
-            output_var->name = name;
-        }
+        const std::string na = NormalizePath(a);
+        const std::string nb = NormalizePath(b);
+        const std::string& shorter = na.size() < nb.size() ? na : nb;
+        const std::string& longer = na.size() < nb.size() ? nb : na;
+        return longer.compare(0, shorter.size(), shorter) == 0 &&
+            (longer.size() == shorter.size() || longer[shorter.size()] == '/');
     }
 
-    void SetContextReference(const char* name, s_animation_t& reference, Variable* output_var = nullptr)
+    static bool AnyPathsOverlap(const std::vector<std::string>& a, const std::vector<std::string>& b)
     {
-        _context.SetReference(name, &reference);
-        if (output_var) {
-            output_var->type = VariableType::REFERENCE;
-            output_var->name = name;
+        for (const auto& path_a : a)
+        {
+            for (const auto& path_b : b)
+            {
+                if (PathsOverlap(path_a, path_b))
+                    return true;
+            }
         }
-    }
 
-    void RegisterFiles(const std::list<const char*>& filenames,
-        const char* input_directory,
-        const char* original_directory)
-    {
-        for (const auto name : filenames)
-            _entries.push_back(AnimationPipelineEntry(name, input_directory, original_directory));
+        return false;
     }
 
-    void RegisterFilesWithOperation(Operation* operation, const std::list<const char*>& filenames,
-        const char* input_directory,
-        const char* original_directory)
+    // True if job, listed after other, must wait for it.
+    static bool DependsOn(const Job& job, const Job& other)
     {
-        for (const auto name : filenames)
-            _entries.push_back(AnimationPipelineEntry(name, input_directory, original_directory, operation));
+        return AnyPathsOverlap(job.files.inputs, other.files.outputs) ||
+            AnyPathsOverlap(job.files.outputs, other.files.outputs) ||
+            AnyPathsOverlap(job.files.outputs, other.files.inputs);
     }
+};
 
-    void AddOperationToAllFiles(Operation* operation)
+// Register the conversion class as a job named after it. The class has a
+// static GetFiles returning the ConversionJobs::Files of its Invoke.
+#define REGISTER_CONVERSION_JOB(Conversion) \
+    static const bool s_##Conversion##_registered = ConversionJobs::Register<Conversion>(#Conversion)
+
+// Same for a class running a ConversionChain of registered jobs, left out of "all".
+#define REGISTER_CONVERSION_CHAIN_JOB(Chain) \
+    static const bool s_##Chain##_registered = ConversionJobs::Register<Chain>(#Chain, false)
+
+
+//
+// Conversions run one after another, each stage reading the files written by
+// the ones before it. Files written by a stage are kept in memory and read
+// from there by the next stages, see SMDMemoryFiles. Only the last stage and
+// the checkpointed ones write their files to disk, the files of the other
+// stages are dropped at the end of the chain. The output mode only applies to
+// the serializers the stages create, so jobs running at the same time on other
+// threads still write to disk.
+//
+class ConversionChain
+{
+public:
+    template<typename Conversion>
+    void AddStage(bool checkpoint = false)
     {
-        for (auto& entry : _entries)
-            entry.operations.push_back(operation);
+        _stages.push_back({ []() { Conversion().Invoke(); }, Conversion::GetFiles(), checkpoint });
     }
 
-    void AddOperationToFiles(Operation* operation, const std::list<const char*>& animations)
+    // Files of all the stages, to run the chain as a conversion job.
+    ConversionJobs::Files GetFiles() const
     {
-        for (auto& entry : _entries) {
-            for (const auto animation_name : animations) {
-                if (!_stricmp(entry.name, animation_name))
-                {
-                    entry.operations.push_back(operation);
-                    break;
-                }
-            }
+        ConversionJobs::Files files;
+        for (const auto& stage : _stages)
+        {
+            files.inputs.insert(files.inputs.end(), stage.files.inputs.begin(), stage.files.inputs.end());
+            files.outputs.insert(files.outputs.end(), stage.files.outputs.begin(), stage.files.outputs.end());
         }
+
+        return files;
     }
 
     void Invoke()
     {
-        for (auto& entry : _entries)
+        try
         {
-            try
+            for (size_t i = 0; i < _stages.size(); ++i)
             {
-                char file_path[_MAX_PATH]{};
-                snprintf(file_path, sizeof(file_path), "%s/%s.smd", entry.directory, entry.name);
+                const bool last = i + 1 == _stages.size();
+                SMDMemoryFiles::SetOutputMode(last ? SMDOutputMode::DISK :
+                    _stages[i].checkpoint ? SMDOutputMode::MEMORY_AND_DISK : SMDOutputMode::MEMORY);
 
-                char original_file_path[_MAX_PATH]{};
-                snprintf(original_file_path, sizeof(original_file_path), "%s/%s.smd", entry.original_directory, entry.name);
-
-                s_animation_t anim{}, original_anim{};
+                _stages[i].invoke();
+            }
+        }
+        catch (...)
+        {
+            SMDMemoryFiles::SetOutputMode(SMDOutputMode::DISK);
+            ClearMemoryFiles();
+            throw;
+        }
 
-                _smdloader.LoadAnimation(file_path, anim);
-                _smdloader.LoadAnimation(original_file_path, original_anim);
+        SMDMemoryFiles::SetOutputMode(SMDOutputMode::DISK);
+        ClearMemoryFiles();
+    }
 
-                _context.SetAnimation("animation", &anim);
-                _context.SetAnimation("original_animation", &original_anim);
+private:
+    struct Stage
+    {
+        std::function<void()> invoke;
+        ConversionJobs::Files files;
+        bool checkpoint;
+    };
 
-                for (auto o : entry.operations) {
-                    printf("%s\n", o->GetDescription());
-                    o->Invoke(&_context);
-                }
-            }
-            catch (...)
-            {
-                int a = 2;
-                a++;
-            }
+    // Only the files of this chain, other chains may be running.
+    void ClearMemoryFiles() const
+    {
+        for (const auto& stage : _stages)
+        {
+            for (const auto& directory : stage.files.outputs)
+                SMDMemoryFiles::ClearDirectory(directory.c_str());
         }
     }
 
-private:
-    const SMDFileLoader& _smdloader;
-    std::list<AnimationPipelineEntry> _entries;
-    OperationContext _context;
+    std::vector<Stage> _stages;
 };
 
 
@@ -1128,23 +2672,39 @@ private:
 class Convert_LD_BlueShift_animations_to_LD_HL1
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/scientist";
-        constexpr const char* INPUT_DIRECTORY_CIV_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/civ_scientist";
-        constexpr const char* INPUT_DIRECTORY_CIV_PAPER_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/civ_paper_scientist";
-        constexpr const char* INPUT_DIRECTORY_CONSOLE_CIV_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/console_civ_scientist";
-        constexpr const char* INPUT_DIRECTORY_SCIENTIST_COWER = INPUT_DIRECTORY_BASE "/""bshift/ld/scientist_cower";
-        constexpr const char* INPUT_DIRECTORY_GORDON_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/gordon_scientist";
+    static constexpr const char* INPUT_DIRECTORY_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/scientist";
+    static constexpr const char* INPUT_DIRECTORY_CIV_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/civ_scientist";
+    static constexpr const char* INPUT_DIRECTORY_CIV_PAPER_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/civ_paper_scientist";
+    static constexpr const char* INPUT_DIRECTORY_CONSOLE_CIV_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/console_civ_scientist";
+    static constexpr const char* INPUT_DIRECTORY_SCIENTIST_COWER = INPUT_DIRECTORY_BASE "/""bshift/ld/scientist_cower";
+    static constexpr const char* INPUT_DIRECTORY_GORDON_SCIENTIST = INPUT_DIRECTORY_BASE "/""bshift/ld/gordon_scientist";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE "/""scientist/animations/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE "/""scientist/meshes/ld/SCI3_Template_Biped1(Headless_Body).smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE "/""scientist/animations/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE "/""scientist/meshes/ld/SCI3_Template_Biped1(Headless_Body).smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return {
+            {
+                INPUT_DIRECTORY_SCIENTIST,
+                INPUT_DIRECTORY_CIV_SCIENTIST,
+                INPUT_DIRECTORY_CIV_PAPER_SCIENTIST,
+                INPUT_DIRECTORY_CONSOLE_CIV_SCIENTIST,
+                INPUT_DIRECTORY_SCIENTIST_COWER,
+                INPUT_DIRECTORY_GORDON_SCIENTIST,
+                TARGET_REFERENCE,
+            },
+            { TARGET_DIRECTORY }
+        };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         p.SetContextReference("input_reference", target_reference);
@@ -1596,9 +3156,30 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_BlueShift_animations_to_LD_HL1);
+
 class Convert_LD_HL1_and_LD_Op4_animations_to_LD_BlueShift
 {
 public:
+    static constexpr const char* INPUT_DIRECTORY_HL1 = INPUT_DIRECTORY_BASE"/""hl1/ld/scientist";
+    static constexpr const char* INPUT_DIRECTORY_OP4 = INPUT_DIRECTORY_BASE"/""gearbox/ld/scientist";
+    static constexpr const char* INPUT_DIRECTORY_OP4_CS = INPUT_DIRECTORY_BASE"/""gearbox/ld/cleansuit_scientist";
+
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""scientist/animations/ld/bshift";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""bshift/ld/scientist/sci3_template_biped1(headless_body).smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return {
+            {
+                INPUT_DIRECTORY_HL1,
+                INPUT_DIRECTORY_OP4,
+                INPUT_DIRECTORY_OP4_CS,
+                TARGET_REFERENCE,
+            },
+            { TARGET_DIRECTORY }
+        };
+    }
 
     void Invoke()
     {
@@ -1606,18 +3187,11 @@ public:
         // Default operations to apply to all HL1 and Op4 sequences
         //=================================================================================
 
-        constexpr const char* INPUT_DIRECTORY_HL1 = INPUT_DIRECTORY_BASE"/""hl1/ld/scientist";
-        constexpr const char* INPUT_DIRECTORY_OP4 = INPUT_DIRECTORY_BASE"/""gearbox/ld/scientist";
-        constexpr const char* INPUT_DIRECTORY_OP4_CS = INPUT_DIRECTORY_BASE"/""gearbox/ld/cleansuit_scientist";
-
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""scientist/animations/ld/bshift";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""bshift/ld/scientist/sci3_template_biped1(headless_body).smd";
-
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -2039,9 +3613,30 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_HL1_and_LD_Op4_animations_to_LD_BlueShift);
+
 class Convert_LD_HL1_and_LD_Op4_animations_to_HD_Op4
 {
 public:
+    static constexpr const char* INPUT_DIRECTORY_HL1 = INPUT_DIRECTORY_BASE"/""hl1/ld/scientist";
+    static constexpr const char* INPUT_DIRECTORY_OP4 = INPUT_DIRECTORY_BASE"/""gearbox/ld/scientist";
+    static constexpr const char* INPUT_DIRECTORY_OP4_CS = INPUT_DIRECTORY_BASE"/""gearbox/ld/cleansuit_scientist";
+
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""scientist/animations/hd";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""gearbox/hd/scientist/dc_sci_(headless_body).smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return {
+            {
+                INPUT_DIRECTORY_HL1,
+                INPUT_DIRECTORY_OP4,
+                INPUT_DIRECTORY_OP4_CS,
+                TARGET_REFERENCE,
+            },
+            { TARGET_DIRECTORY }
+        };
+    }
 
     void Invoke()
     {
@@ -2049,18 +3644,11 @@ public:
         // Default operations to apply to all HL1 and Op4 sequences
         //=================================================================================
 
-        constexpr const char* INPUT_DIRECTORY_HL1 = INPUT_DIRECTORY_BASE"/""hl1/ld/scientist";
-        constexpr const char* INPUT_DIRECTORY_OP4 = INPUT_DIRECTORY_BASE"/""gearbox/ld/scientist";
-        constexpr const char* INPUT_DIRECTORY_OP4_CS = INPUT_DIRECTORY_BASE"/""gearbox/ld/cleansuit_scientist";
-
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""scientist/animations/hd";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""gearbox/hd/scientist/dc_sci_(headless_body).smd";
-
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -2373,25 +3961,40 @@ public:
 
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_HL1_and_LD_Op4_animations_to_HD_Op4);
+
 class Convert_HD_Civilian_Blue_Shift_to_HD_Scientist
 {
 public:
+    static constexpr const char* INPUT_DIRECTORY_CIV_SCIENTIST = INPUT_DIRECTORY_BASE"/""bshift/hd/civ_scientist";
+    static constexpr const char* INPUT_DIRECTORY_CIV_COAT_SCIENTIST = INPUT_DIRECTORY_BASE"/""bshift/hd/civ_coat_scientist";
+    static constexpr const char* INPUT_DIRECTORY_CIV_PAPER_SCIENTIST = INPUT_DIRECTORY_BASE"/""bshift/hd/civ_paper_scientist";
+    static constexpr const char* INPUT_DIRECTORY_CONSOLE_CIV_SCIENTIST = INPUT_DIRECTORY_BASE"/""bshift/hd/console_civ_scientist";
 
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_CIV_SCIENTIST = INPUT_DIRECTORY_BASE"/""bshift/hd/civ_scientist";
-        constexpr const char* INPUT_DIRECTORY_CIV_COAT_SCIENTIST = INPUT_DIRECTORY_BASE"/""bshift/hd/civ_coat_scientist";
-        constexpr const char* INPUT_DIRECTORY_CIV_PAPER_SCIENTIST = INPUT_DIRECTORY_BASE"/""bshift/hd/civ_paper_scientist";
-        constexpr const char* INPUT_DIRECTORY_CONSOLE_CIV_SCIENTIST = INPUT_DIRECTORY_BASE"/""bshift/hd/console_civ_scientist";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/civ_scientists/hd";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/hd/scientist/dc_sci_(headless_body).smd";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/civ_scientists/hd";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/hd/scientist/dc_sci_(headless_body).smd";
+    static ConversionJobs::Files GetFiles()
+    {
+        return {
+            {
+                INPUT_DIRECTORY_CIV_SCIENTIST,
+                INPUT_DIRECTORY_CIV_COAT_SCIENTIST,
+                INPUT_DIRECTORY_CIV_PAPER_SCIENTIST,
+                INPUT_DIRECTORY_CONSOLE_CIV_SCIENTIST,
+                TARGET_REFERENCE,
+            },
+            { TARGET_DIRECTORY }
+        };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -2651,22 +4254,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_HD_Civilian_Blue_Shift_to_HD_Scientist);
+
 class Fixup_Gman_LD_Briefcase
 {
 public:
+    static constexpr const char* INPUT_DIRECTORY_GMAN = INPUT_DIRECTORY_BASE"/""temp_gman_briefcase/ld";
 
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_GMAN = INPUT_DIRECTORY_BASE"/""temp_gman_briefcase/ld";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""gman/animations/ld";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""temp_gman_briefcase/ld/gman_reference.smd";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""gman/animations/ld";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""temp_gman_briefcase/ld/gman_reference.smd";
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_GMAN, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -2726,23 +4335,36 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Fixup_Gman_LD_Briefcase);
+
 class Convert_LD_BlueShift_Otis_Sequences_To_LD_Op4_Otis
 {
 public:
+    static constexpr const char* INPUT_DIRECTORY_BSHIFT_OTIS = INPUT_DIRECTORY_BASE"/""bshift/ld/otis";
+    static constexpr const char* INPUT_DIRECTORY_BSHIFT_INTRO_OTIS = INPUT_DIRECTORY_BASE"/""bshift/ld/intro_otis";
 
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_BSHIFT_OTIS = INPUT_DIRECTORY_BASE"/""bshift/ld/otis";
-        constexpr const char* INPUT_DIRECTORY_BSHIFT_INTRO_OTIS = INPUT_DIRECTORY_BASE"/""bshift/ld/intro_otis";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""otis/animations";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""gearbox/ld/otis/otis_body_reference.smd";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""otis/animations";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""gearbox/ld/otis/otis_body_reference.smd";
+    static ConversionJobs::Files GetFiles()
+    {
+        return {
+            {
+                INPUT_DIRECTORY_BSHIFT_OTIS,
+                INPUT_DIRECTORY_BSHIFT_INTRO_OTIS,
+                TARGET_REFERENCE,
+            },
+            { TARGET_DIRECTORY }
+        };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -2793,23 +4415,29 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_BlueShift_Otis_Sequences_To_LD_Op4_Otis);
+
 class Convert_LD_Otis_Sequences_To_HD_Barney
 {
 public:
+    static constexpr const char* INPUT_DIRECTORY_OP4_OTIS = INPUT_DIRECTORY_BASE"/""gearbox/ld/otis";
+    static constexpr const char* INPUT_DIRECTORY_BSHIFT_OTIS = INPUT_DIRECTORY_BASE"/""bshift/ld/otis";
 
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_OP4_OTIS = INPUT_DIRECTORY_BASE"/""gearbox/ld/otis";
-        constexpr const char* INPUT_DIRECTORY_BSHIFT_OTIS = INPUT_DIRECTORY_BASE"/""bshift/ld/otis";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/otis/hd";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/hd/barney/dc_barney_Reference.smd";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/otis/hd";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/hd/barney/dc_barney_Reference.smd";
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_OP4_OTIS, INPUT_DIRECTORY_BSHIFT_OTIS, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3011,21 +4639,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_Otis_Sequences_To_HD_Barney);
+
 class Fixup_HGrunt_LD_BlueShift_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_BSHIFT_HGRUNT = INPUT_DIRECTORY_BASE"/""bshift/ld/hgrunt";
+    static constexpr const char* INPUT_DIRECTORY_BSHIFT_HGRUNT = INPUT_DIRECTORY_BASE"/""bshift/ld/hgrunt";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""hgrunt/animations/ld";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/ld/hgrunt/gruntbody.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""hgrunt/animations/ld";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/ld/hgrunt/gruntbody.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_BSHIFT_HGRUNT, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3098,21 +4733,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Fixup_HGrunt_LD_BlueShift_Sequences);
+
 class Convert_LD_HL1_HGrunt_To_HD_HL1_HGrunt_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_HGRUNT = INPUT_DIRECTORY_BASE"/""temp_hgrunt/ld";
+    static constexpr const char* INPUT_DIRECTORY_HGRUNT = INPUT_DIRECTORY_BASE"/""temp_hgrunt/ld";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""hgrunt/animations/hd";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/hd/DC_soldier_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""hgrunt/animations/hd";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/hd/DC_soldier_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_HGRUNT, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3169,21 +4811,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_HL1_HGrunt_To_HD_HL1_HGrunt_Sequences);
+
 class Fix_Op4_LD_Skeleton_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_SKELETON = INPUT_DIRECTORY_BASE"/""gearbox/ld/skeleton";
+    static constexpr const char* INPUT_DIRECTORY_SKELETON = INPUT_DIRECTORY_BASE"/""gearbox/ld/skeleton";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""skeleton/animations";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""skeleton/meshes/SKELETON_Template_Biped1.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""skeleton/animations";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""skeleton/meshes/SKELETON_Template_Biped1.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_SKELETON, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3243,27 +4892,34 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Fix_Op4_LD_Skeleton_Sequences);
+
 #if 0
 class Convert_Egon_LD_to_HD_Egon_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_EGON = INPUT_DIRECTORY_BASE"/""hl1/ld/v_egon";
+    static constexpr const char* INPUT_DIRECTORY_EGON = INPUT_DIRECTORY_BASE"/""hl1/ld/v_egon";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""v_egon/animations/hd";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""v_egon/meshes/hd/v_egon_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""v_egon/animations/hd";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""v_egon/meshes/hd/v_egon_reference.smd";
 
-        constexpr const char* SAMPLE_HD_ANIMATION = TARGET_DIRECTORY_BASE"/""v_egon/animations/hd/idle1.smd";
+    static constexpr const char* SAMPLE_HD_ANIMATION = TARGET_DIRECTORY_BASE"/""v_egon/animations/hd/idle1.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_EGON, TARGET_REFERENCE, SAMPLE_HD_ANIMATION }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         s_animation_t sample_hd_animation;
-        smd_loader.LoadAnimation(SAMPLE_HD_ANIMATION, sample_hd_animation);
+        sample_hd_animation = *SMDSharedAnimationCache::Load(smd_loader, SAMPLE_HD_ANIMATION);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3339,24 +4995,31 @@ public:
         p.Invoke();
     }
 };
+
+REGISTER_CONVERSION_JOB(Convert_Egon_LD_to_HD_Egon_Sequences);
 #endif
 
 
 class Convert_LD_HL1_HGrunt_To_LD_Op4_Massn_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_HGRUNT = TARGET_DIRECTORY_BASE"/""hgrunt/animations/ld";
+    static constexpr const char* INPUT_DIRECTORY_HGRUNT = TARGET_DIRECTORY_BASE"/""hgrunt/animations/ld";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_HGRUNT, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3506,21 +5169,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_HL1_HGrunt_To_LD_Op4_Massn_Sequences);
+
 class Fix_Op4_LD_Medic_Grunts_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_MEDIC = INPUT_DIRECTORY_BASE"/""gearbox/ld/hgrunt_medic";
+    static constexpr const char* INPUT_DIRECTORY_MEDIC = INPUT_DIRECTORY_BASE"/""gearbox/ld/hgrunt_medic";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_medic/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_medic/meshes/ld/grunt_medic_head_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_medic/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_medic/meshes/ld/grunt_medic_head_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_MEDIC, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3589,21 +5259,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Fix_Op4_LD_Medic_Grunts_Sequences);
+
 class Fix_Op4_LD_Engineer_Grunts_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_TORCH = INPUT_DIRECTORY_BASE"/""gearbox/ld/hgrunt_torch";
+    static constexpr const char* INPUT_DIRECTORY_TORCH = INPUT_DIRECTORY_BASE"/""gearbox/ld/hgrunt_torch";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""hgrunt_torch/animations/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_torch/meshes/ld/engineer_head_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""hgrunt_torch/animations/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_torch/meshes/ld/engineer_head_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_TORCH, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3672,21 +5349,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Fix_Op4_LD_Engineer_Grunts_Sequences);
+
 class Fix_Op4_LD_Opfor_Grunts_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_OPFOR = INPUT_DIRECTORY_BASE"/""gearbox/ld/hgrunt_opfor";
+    static constexpr const char* INPUT_DIRECTORY_OPFOR = INPUT_DIRECTORY_BASE"/""gearbox/ld/hgrunt_opfor";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_opfor/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_opfor/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_OPFOR, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3827,21 +5511,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Fix_Op4_LD_Opfor_Grunts_Sequences);
+
 class Fix_Op4_LD_Opfor_Grunts_Shared_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_OPFOR = INPUT_DIRECTORY_BASE"/""gearbox/ld/hgrunt_opfor";
+    static constexpr const char* INPUT_DIRECTORY_OPFOR = INPUT_DIRECTORY_BASE"/""gearbox/ld/hgrunt_opfor";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_opfor/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_opfor/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_OPFOR, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -3932,21 +5623,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Fix_Op4_LD_Opfor_Grunts_Shared_Sequences);
+
 class Convert_LD_Op4_Intro_Regular_To_LD_HL1_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/intro_regular";
+    static constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/intro_regular";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_regular/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_regular/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -4033,21 +5731,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_Op4_Intro_Regular_To_LD_HL1_Sequences);
+
 class Convert_LD_Op4_Intro_SAW_To_LD_HL1_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/intro_saw";
+    static constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/intro_saw";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_saw/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_saw/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -4116,22 +5821,29 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_Op4_Intro_SAW_To_LD_HL1_Sequences);
+
 
 class Convert_LD_Op4_Intro_Torch_To_LD_HL1_Sequences
 {
 public:
+    static constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/intro_torch";
+
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_torch/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
+
     void Invoke()
     {
-        constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/intro_torch";
-
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_torch/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
-
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -4197,21 +5909,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_Op4_Intro_Torch_To_LD_HL1_Sequences);
+
 class Convert_LD_Op4_Intro_Medic_To_LD_HL1_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/intro_medic";
+    static constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/intro_medic";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_medic/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_medic/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -4279,28 +5998,35 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_Op4_Intro_Medic_To_LD_HL1_Sequences);
+
 class Convert_HD_Op4_Intro_SAW_To_HD_HL1_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/hd/intro_saw";
+    static constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/hd/intro_saw";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_saw/hd";
-        //constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/hd/DC_soldier_reference.smd";
-        
-        /*
-           TODO: This should be DC_soldier_reference.smd, but due to the forearm length difference between
-           HD HL1 grunts and HD Op4 grunts, the hand position will be inconsistent. For now, target the
-           HD Op4 grunt so the forearm length stays the same across LD and HD. 
-        */
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_opfor/meshes/hd/grunt_head_mask_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/intro_saw/hd";
+    //static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/hd/DC_soldier_reference.smd";
+
+    /*
+       TODO: This should be DC_soldier_reference.smd, but due to the forearm length difference between
+       HD HL1 grunts and HD Op4 grunts, the hand position will be inconsistent. For now, target the
+       HD Op4 grunt so the forearm length stays the same across LD and HD.
+    */
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_opfor/meshes/hd/grunt_head_mask_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -4378,21 +6104,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_HD_Op4_Intro_SAW_To_HD_HL1_Sequences);
+
 class Convert_LD_Op4_Grunt_To_LD_Op4_Massn_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_OP4_HGRUNT = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_opfor/ld";
+    static constexpr const char* INPUT_DIRECTORY_OP4_HGRUNT = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_opfor/ld";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_OP4_HGRUNT, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -4495,25 +6228,70 @@ public:
     }
 };
 
-class Convert_LD_Op4_Intro_Grunts_To_LD_Op4_Massn_Sequences
+REGISTER_CONVERSION_JOB(Convert_LD_Op4_Grunt_To_LD_Op4_Massn_Sequences);
+
+// Fixes the LD Opfor grunt sequences, then converts them to massn sequences
+// without reading them back from disk. The fixed sequences are still written
+// since they are assets of their own.
+class Chain_LD_Op4_Grunts_To_LD_Op4_Massn_Sequences
 {
 public:
+    static ConversionChain GetChain()
+    {
+        ConversionChain chain;
+        chain.AddStage<Fix_Op4_LD_Opfor_Grunts_Sequences>(true);
+        chain.AddStage<Fix_Op4_LD_Opfor_Grunts_Shared_Sequences>(true);
+        chain.AddStage<Convert_LD_Op4_Grunt_To_LD_Op4_Massn_Sequences>();
+        return chain;
+    }
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return GetChain().GetFiles();
+    }
+
     void Invoke()
     {
-        constexpr const char* INPUT_DIRECTORY_INTRO_COMMANDER = TARGET_DIRECTORY_BASE"/""shared/animations/intro_commander/ld";
-        constexpr const char* INPUT_DIRECTORY_INTRO_MEDIC = "C:/Users/marc-/Documents/temp_conversion/intro_medic/ld";
-        constexpr const char* INPUT_DIRECTORY_INTRO_REGULAR = "C:/Users/marc-/Documents/temp_conversion/intro_regular/ld";
-        constexpr const char* INPUT_DIRECTORY_INTRO_SAW = "C:/Users/marc-/Documents/temp_conversion/intro_saw/ld";
-        constexpr const char* INPUT_DIRECTORY_INTRO_TORCH = "C:/Users/marc-/Documents/temp_conversion/intro_torch/ld";
+        GetChain().Invoke();
+    }
+};
+
+REGISTER_CONVERSION_CHAIN_JOB(Chain_LD_Op4_Grunts_To_LD_Op4_Massn_Sequences);
+
+class Convert_LD_Op4_Intro_Grunts_To_LD_Op4_Massn_Sequences
+{
+public:
+    static constexpr const char* INPUT_DIRECTORY_INTRO_COMMANDER = TARGET_DIRECTORY_BASE"/""shared/animations/intro_commander/ld";
+    static constexpr const char* INPUT_DIRECTORY_INTRO_MEDIC = "C:/Users/marc-/Documents/temp_conversion/intro_medic/ld";
+    static constexpr const char* INPUT_DIRECTORY_INTRO_REGULAR = "C:/Users/marc-/Documents/temp_conversion/intro_regular/ld";
+    static constexpr const char* INPUT_DIRECTORY_INTRO_SAW = "C:/Users/marc-/Documents/temp_conversion/intro_saw/ld";
+    static constexpr const char* INPUT_DIRECTORY_INTRO_TORCH = "C:/Users/marc-/Documents/temp_conversion/intro_torch/ld";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return {
+            {
+                INPUT_DIRECTORY_INTRO_COMMANDER,
+                INPUT_DIRECTORY_INTRO_MEDIC,
+                INPUT_DIRECTORY_INTRO_REGULAR,
+                INPUT_DIRECTORY_INTRO_SAW,
+                INPUT_DIRECTORY_INTRO_TORCH,
+                TARGET_REFERENCE,
+            },
+            { TARGET_DIRECTORY }
+        };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -4673,24 +6451,40 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_Op4_Intro_Grunts_To_LD_Op4_Massn_Sequences);
+
 class Convert_HD_Op4_Intro_Grunts_To_HD_Op4_Massn_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_INTRO_MEDIC = "C:/Users/marc-/Documents/temp_conversion/intro_medic/ld";
-        constexpr const char* INPUT_DIRECTORY_INTRO_REGULAR = "C:/Users/marc-/Documents/temp_conversion/intro_regular/ld";
-        constexpr const char* INPUT_DIRECTORY_INTRO_SAW = "C:/Users/marc-/Documents/temp_conversion/intro_saw/ld";
-        constexpr const char* INPUT_DIRECTORY_INTRO_TORCH = "C:/Users/marc-/Documents/temp_conversion/intro_torch/ld";
+    static constexpr const char* INPUT_DIRECTORY_INTRO_MEDIC = "C:/Users/marc-/Documents/temp_conversion/intro_medic/ld";
+    static constexpr const char* INPUT_DIRECTORY_INTRO_REGULAR = "C:/Users/marc-/Documents/temp_conversion/intro_regular/ld";
+    static constexpr const char* INPUT_DIRECTORY_INTRO_SAW = "C:/Users/marc-/Documents/temp_conversion/intro_saw/ld";
+    static constexpr const char* INPUT_DIRECTORY_INTRO_TORCH = "C:/Users/marc-/Documents/temp_conversion/intro_torch/ld";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/hd";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/hd";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
 
+    static ConversionJobs::Files GetFiles()
+    {
+        return {
+            {
+                INPUT_DIRECTORY_INTRO_MEDIC,
+                INPUT_DIRECTORY_INTRO_REGULAR,
+                INPUT_DIRECTORY_INTRO_SAW,
+                INPUT_DIRECTORY_INTRO_TORCH,
+                TARGET_REFERENCE,
+            },
+            { TARGET_DIRECTORY }
+        };
+    }
+
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -4820,21 +6614,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_HD_Op4_Intro_Grunts_To_HD_Op4_Massn_Sequences);
+
 class Convert_LD_Massn_To_LD_HL1_Grunt_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/massn";
+    static constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/ld/massn";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt/ld";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt/ld";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/ld/gruntbody.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -4923,27 +6724,34 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_Massn_To_LD_HL1_Grunt_Sequences);
+
 class Convert_HD_Massn_To_HD_HL1_Grunt_Sequences
 {
 public:
-    void Invoke()
+    static constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/hd/massn";
+
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt/hd";
+    //static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/hd/DC_soldier_reference.smd";
+    /*
+       TODO: This should be DC_soldier_reference.smd, but due to the forearm length difference between
+       HD HL1 grunts and HD Op4 grunts, the hand position will be inconsistent. For now, target the
+       HD Op4 grunt so the forearm length stays the same across LD and HD.
+    */
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_opfor/meshes/hd/grunt_head_mask_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
     {
-        constexpr const char* INPUT_DIRECTORY = INPUT_DIRECTORY_BASE"/""gearbox/hd/massn";
-
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt/hd";
-        //constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt/meshes/hd/DC_soldier_reference.smd";
-        /*
-           TODO: This should be DC_soldier_reference.smd, but due to the forearm length difference between
-           HD HL1 grunts and HD Op4 grunts, the hand position will be inconsistent. For now, target the
-           HD Op4 grunt so the forearm length stays the same across LD and HD.
-        */
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_opfor/meshes/hd/grunt_head_mask_reference.smd";
+        return { { INPUT_DIRECTORY, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -5021,26 +6829,33 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_HD_Massn_To_HD_HL1_Grunt_Sequences);
+
 class Fix_HD_Crossbow_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_CROSSBOW = INPUT_DIRECTORY_BASE"/""gearbox/hd/v_crossbow";
+    static constexpr const char* INPUT_DIRECTORY_CROSSBOW = INPUT_DIRECTORY_BASE"/""gearbox/hd/v_crossbow";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""v_crossbow/animations/hd";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""v_crossbow/meshes/hd/v_crossbow_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""v_crossbow/animations/hd";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""v_crossbow/meshes/hd/v_crossbow_reference.smd";
 
-        constexpr const char* IDLE2_HD_ANIMATION = TARGET_DIRECTORY_BASE"/""v_crossbow/animations/hd/idle2.smd";
+    static constexpr const char* IDLE2_HD_ANIMATION = TARGET_DIRECTORY_BASE"/""v_crossbow/animations/hd/idle2.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_CROSSBOW, TARGET_REFERENCE, IDLE2_HD_ANIMATION }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         s_animation_t idle2_hd_animation;
-        smd_loader.LoadAnimation(IDLE2_HD_ANIMATION, idle2_hd_animation);
+        idle2_hd_animation = *SMDSharedAnimationCache::Load(smd_loader, IDLE2_HD_ANIMATION);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -5134,21 +6949,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Fix_HD_Crossbow_Sequences);
+
 class Convert_HD_Op4_Grunt_To_HD_Grunt_Sequences 
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_OP4_HGRUNT = INPUT_DIRECTORY_BASE "/""gearbox/hd/hgrunt_opfor";
+    static constexpr const char* INPUT_DIRECTORY_OP4_HGRUNT = INPUT_DIRECTORY_BASE "/""gearbox/hd/hgrunt_opfor";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_opfor/hd";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_opfor/meshes/hd/torso_regular_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/hgrunt_opfor/hd";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""hgrunt_opfor/meshes/hd/torso_regular_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_OP4_HGRUNT, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -5238,21 +7060,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_HD_Op4_Grunt_To_HD_Grunt_Sequences);
+
 class Convert_HD_Op4_Grunt_To_HD_Massn_Sequences 
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_OP4_HGRUNT = TARGET_DIRECTORY_BASE "/""shared/animations/hgrunt_opfor/hd";
+    static constexpr const char* INPUT_DIRECTORY_OP4_HGRUNT = TARGET_DIRECTORY_BASE "/""shared/animations/hgrunt_opfor/hd";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/hd";
-        constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""massn/animations/hd";
+    static constexpr const char* TARGET_REFERENCE = TARGET_DIRECTORY_BASE"/""massn/meshes/ld/Massn_reference.smd";
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_OP4_HGRUNT, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -5293,22 +7122,29 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_HD_Op4_Grunt_To_HD_Massn_Sequences);
+
 class Convert_LD_HL1_Zombie_Soldier_To_LD_HL1_Zombie_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""gearbox/ld/zombie_soldier";
+    static constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""gearbox/ld/zombie_soldier";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/zombies";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/ld/zombie/idle1.smd"; // Used for animation bone length because the LD reference is scaled up.
-        //constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/ld/zombie/Zom3_Template_Biped(White_Suit)1.smd"; // Used for animation bone length because the LD reference is scaled up.
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""shared/animations/zombies";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/ld/zombie/idle1.smd"; // Used for animation bone length because the LD reference is scaled up.
+    //static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/ld/zombie/Zom3_Template_Biped(White_Suit)1.smd"; // Used for animation bone length because the LD reference is scaled up.
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_LD_ZOMBIE, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -5403,21 +7239,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_HL1_Zombie_Soldier_To_LD_HL1_Zombie_Sequences);
+
 class Convert_LD_HL1_Zombie_To_LD_Op4_Zombie_Soldier_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""hl1/ld/zombie";
+    static constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""hl1/ld/zombie";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""zombie_soldier/animations";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""gearbox/ld/zombie_soldier/idle1.smd"; // Used for animation bone length because the LD reference is scaled up.
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""zombie_soldier/animations";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""gearbox/ld/zombie_soldier/idle1.smd"; // Used for animation bone length because the LD reference is scaled up.
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_LD_ZOMBIE, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -5578,21 +7421,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_HL1_Zombie_To_LD_Op4_Zombie_Soldier_Sequences);
+
 class Convert_LD_BShift_Zombie_To_LD_Op4_Zombie_Soldier_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""bshift/ld/zombie";
+    static constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""bshift/ld/zombie";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""zombie_soldier/animations";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""gearbox/ld/zombie_soldier/idle1.smd"; // Used for animation bone length because the LD reference is scaled up.
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""zombie_soldier/animations";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""gearbox/ld/zombie_soldier/idle1.smd"; // Used for animation bone length because the LD reference is scaled up.
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_LD_ZOMBIE, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -5718,21 +7568,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_BShift_Zombie_To_LD_Op4_Zombie_Soldier_Sequences);
+
 class Convert_LD_Op4_Zombie_Soldier_To_HD_HL1_Zombie_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""gearbox/ld/zombie_soldier";
+    static constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""gearbox/ld/zombie_soldier";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""zombie/animations/hd";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/hd/zombie/idle1.smd"; // Used for animation bone length because the HD reference is scaled up.
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""zombie/animations/hd";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/hd/zombie/idle1.smd"; // Used for animation bone length because the HD reference is scaled up.
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_LD_ZOMBIE, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -5812,21 +7669,28 @@ public:
     }
 };
 
+REGISTER_CONVERSION_JOB(Convert_LD_Op4_Zombie_Soldier_To_HD_HL1_Zombie_Sequences);
+
 class Convert_LD_HL1_Zombie_To_HD_HL1_Zombie_Sequences
 {
 public:
-    void Invoke()
-    {
-        constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""hl1/ld/zombie";
+    static constexpr const char* INPUT_DIRECTORY_LD_ZOMBIE = INPUT_DIRECTORY_BASE"/""hl1/ld/zombie";
 
-        constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""zombie/animations/hd";
-        constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/hd/zombie/idle1.smd"; // Used for animation bone length because the HD reference is scaled up.
+    static constexpr const char* TARGET_DIRECTORY = TARGET_DIRECTORY_BASE"/""zombie/animations/hd";
+    static constexpr const char* TARGET_REFERENCE = INPUT_DIRECTORY_BASE"/""hl1/hd/zombie/idle1.smd"; // Used for animation bone length because the HD reference is scaled up.
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { INPUT_DIRECTORY_LD_ZOMBIE, TARGET_REFERENCE }, { TARGET_DIRECTORY } };
+    }
 
+    void Invoke()
+    {
         SMDFileLoader smd_loader;
         SMDSerializer smd_serializer;
 
         s_animation_t target_reference;
-        smd_loader.LoadAnimation(TARGET_REFERENCE, target_reference);
+        target_reference = *SMDSharedAnimationCache::Load(smd_loader, TARGET_REFERENCE);
 
         AnimationPipeline p(smd_loader);
         Variable var_target_reference;
@@ -5949,7 +7813,78 @@ public:
     }
 };
 
-int main()
+REGISTER_CONVERSION_JOB(Convert_LD_HL1_Zombie_To_HD_HL1_Zombie_Sequences);
+
+// Runs a pipeline over synthetic files twice with a manifest directory. The
+// second run skips every entry, since nothing changed in between. Needs none
+// of the decompiled models.
+class Demo_PipelineManifest
+{
+public:
+    static std::string GetDirectory(const char* name)
+    {
+        return (std::filesystem::temp_directory_path() / "smd_manifest_demo" / name).generic_string();
+    }
+
+    static ConversionJobs::Files GetFiles()
+    {
+        return { { GetDirectory("input") }, { GetDirectory("output"), GetDirectory("manifests") } };
+    }
+
+    void Invoke()
+    {
+        const std::string input_directory = GetDirectory("input");
+        const std::string output_directory = GetDirectory("output");
+        const std::string manifest_directory = GetDirectory("manifests");
+        std::filesystem::create_directories(input_directory);
+        std::filesystem::create_directories(output_directory);
+
+        SMDFileLoader smd_loader;
+        SMDSerializer smd_serializer;
+
+        // Written again with the same content, the files are left untouched.
+        const std::list<const char*> names = { "walk", "run", "idle", "jump" };
+        for (const auto name : names)
+        {
+            s_animation_t anim;
+            BuildBenchmarkAnimation(anim, 16, 30);
+            smd_serializer.WriteAnimation(anim, (input_directory + "/" + name + ".smd").c_str());
+        }
+
+        for (int run = 1; run <= 2; ++run)
+        {
+            AnimationPipeline p(smd_loader);
+            p.SetManifestDirectory(manifest_directory.c_str());
+            p.RegisterFiles(names, input_directory.c_str(), input_directory.c_str());
+
+            TranslateBoneInLocalSpaceOperation op_translation({
+                { "Bone0", glm::vec3(0, 0, 1) },
+            }); p.AddOperationToAllFiles(&op_translation);
+
+            WriteAnimationOperation op_wanim(output_directory.c_str(), smd_serializer); p.AddOperationToAllFiles(&op_wanim);
+
+            p.Invoke();
+            LogPrintf("run %d: %d of %d entries up to date\n", run, p.GetUpToDateEntryCount(), static_cast<int>(names.size()));
+        }
+    }
+};
+
+// Only run when named, it is not a conversion.
+static const bool s_Demo_PipelineManifest_registered = ConversionJobs::Register<Demo_PipelineManifest>("Demo_PipelineManifest", false);
+
+static void PrintUsage()
+{
+    printf("usage: test_smd_tool [-j workers] [--manifest directory] [--prefetch count] all | job...\n");
+    printf("  -j          number of jobs run at the same time, 0 for one per hardware thread (default)\n");
+    printf("  --manifest  keep a manifest of each file in directory, and skip the files that did not change since\n");
+    printf("  --prefetch  process the files of each job one after another, loading the next count files and\n");
+    printf("              writing the outputs on other threads, to bound the memory use\n");
+    printf("jobs:\n");
+    for (const auto& job : ConversionJobs::GetJobs())
+        printf("  %s%s\n", job.name.c_str(), job.run_by_all ? "" : " (not run by all)");
+}
+
+int main(int argc, char* argv[])
 {
 #ifdef _DEBUG
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
@@ -5958,111 +7893,91 @@ int main()
     _CrtSetReportMode(_CRT_ASSERT, _CRTDBG_MODE_WNDW);
 #endif
 
-#if 0
-    Convert_LD_BlueShift_animations_to_LD_HL1().Invoke();
-#endif
-#if 0
-    Convert_LD_HL1_and_LD_Op4_animations_to_LD_BlueShift().Invoke();
-#endif
-#if 0
-    Convert_LD_HL1_and_LD_Op4_animations_to_HD_Op4().Invoke();
-#endif
-#if 0
-    Convert_HD_Civilian_Blue_Shift_to_HD_Scientist().Invoke();
-#endif
-#if 0
-    Fixup_Gman_LD_Briefcase().Invoke();
-#endif
-#if 0
-    Convert_LD_BlueShift_Otis_Sequences_To_LD_Op4_Otis().Invoke();
-#endif
-#if 0
-    Convert_LD_Otis_Sequences_To_HD_Barney().Invoke();
-#endif
-#if 0
-    Fixup_HGrunt_LD_BlueShift_Sequences().Invoke();
-#endif
-#if 0
-    Convert_LD_HL1_HGrunt_To_HD_HL1_HGrunt_Sequences().Invoke();
-#endif
-#if 0
-    Fix_Op4_LD_Skeleton_Sequences().Invoke();
-#endif
-#if 0
-    //Convert_Egon_LD_to_HD_Egon_Sequences().Invoke(); // UNFINISHED !! DON'T DO
-#endif
-#if 0
-    Convert_LD_HL1_HGrunt_To_LD_Op4_Massn_Sequences().Invoke();
-#endif
-#if 0
-    Fix_Op4_LD_Medic_Grunts_Sequences().Invoke();
-#endif
-#if 0
-    Fix_Op4_LD_Engineer_Grunts_Sequences().Invoke();
-#endif
-#if 0
-    Fix_Op4_LD_Opfor_Grunts_Sequences().Invoke();
-#endif
-#if 0
-    Fix_Op4_LD_Opfor_Grunts_Shared_Sequences().Invoke();
-#endif
-#if 0
-    Convert_LD_Op4_Intro_Regular_To_LD_HL1_Sequences().Invoke();
-#endif
-#if 0
-    Convert_LD_Op4_Intro_SAW_To_LD_HL1_Sequences().Invoke();
-#endif
-#if 0
-    Convert_LD_Op4_Intro_Torch_To_LD_HL1_Sequences().Invoke();
-#endif
-#if 0
-    Convert_LD_Op4_Intro_Medic_To_LD_HL1_Sequences().Invoke();
-#endif
-#if 0
-    Convert_HD_Op4_Intro_SAW_To_HD_HL1_Sequences().Invoke();
-#endif
-#if 0
-    Convert_LD_Op4_Grunt_To_LD_Op4_Massn_Sequences().Invoke();
-#endif
-#if 0
-    Convert_LD_Op4_Intro_Grunts_To_LD_Op4_Massn_Sequences().Invoke();
-#endif
-#if 0
-    Convert_HD_Op4_Intro_Grunts_To_HD_Op4_Massn_Sequences().Invoke();
-#endif
-#if 0
-    Convert_LD_Massn_To_LD_HL1_Grunt_Sequences().Invoke();
-#endif
-#if 0
-    Convert_HD_Massn_To_HD_HL1_Grunt_Sequences().Invoke();
-#endif
-#if 0
-    Fix_HD_Crossbow_Sequences().Invoke();
-#endif
+    try
+    {
+        std::vector<const ConversionJobs::Job*> jobs;
+        int num_job_workers = 0;
+        int prefetch_count = 0;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            {
+                num_job_workers = atoi(argv[++i]);
+            }
+            else if (!strcmp(argv[i], "--manifest") && i + 1 < argc)
+            {
+                AnimationPipeline::SetDefaultManifestDirectory(argv[++i]);
+            }
+            else if (!strcmp(argv[i], "--prefetch") && i + 1 < argc)
+            {
+                prefetch_count = atoi(argv[++i]);
+            }
+            else if (!_stricmp(argv[i], "all"))
+            {
+                for (const auto& job : ConversionJobs::GetJobs())
+                {
+                    if (job.run_by_all)
+                        jobs.push_back(&job);
+                }
+            }
+            else if (const auto* job = ConversionJobs::Find(argv[i]))
+            {
+                jobs.push_back(job);
+            }
+            else
+            {
+                printf("unknown job %s\n", argv[i]);
+                PrintUsage();
+                return 1;
+            }
+        }
+
+        // Jobs run in registration order, which is the order of their dependencies.
+        std::sort(jobs.begin(), jobs.end());
+        jobs.erase(std::unique(jobs.begin(), jobs.end()), jobs.end());
+
+        if (jobs.empty())
+            PrintUsage();
+
+        // Several jobs at the same time use all the cores between them, each job
+        // processes its files one after another. Otherwise each job processes its
+        // files on all cores. Streaming needs the files one after another.
+        const bool concurrent_jobs = jobs.size() > 1 && num_job_workers != 1;
+        AnimationPipeline::SetDefaultWorkerCount(concurrent_jobs || prefetch_count > 0 ? 1 : 0);
+        AnimationPipeline::SetDefaultPrefetchCount(prefetch_count);
+
+        ConversionJobs::Run(jobs, num_job_workers);
+
+        //convert_HD_HL1_animations_to_LD_BlueShift(); // OBSOLETE !! DON'T DO
 
 #if 0
-    Convert_HD_Op4_Grunt_To_HD_Grunt_Sequences().Invoke();
+        Benchmark_LoadAnimation().Invoke();
 #endif
 #if 0
-    Convert_HD_Op4_Grunt_To_HD_Massn_Sequences().Invoke();
+        Benchmark_FrameLayout().Invoke();
 #endif
 #if 0
-    Convert_LD_HL1_Zombie_Soldier_To_LD_HL1_Zombie_Sequences().Invoke();
+        Benchmark_CompactPose().Invoke();
 #endif
 #if 0
-    Convert_LD_HL1_Zombie_To_LD_Op4_Zombie_Soldier_Sequences().Invoke();
+        Benchmark_EditChain().Invoke();
 #endif
 #if 0
-    Convert_LD_BShift_Zombie_To_LD_Op4_Zombie_Soldier_Sequences().Invoke();
+        Benchmark_FrameParallel().Invoke();
 #endif
 #if 0
-    Convert_LD_Op4_Zombie_Soldier_To_HD_HL1_Zombie_Sequences().Invoke();
+        Benchmark_TransformKernels().Invoke();
 #endif
-#if 1
-    Convert_LD_HL1_Zombie_To_HD_HL1_Zombie_Sequences().Invoke();
+#if 0
+        Benchmark_AnimationArchive().Invoke();
 #endif
-
-    //convert_HD_HL1_animations_to_LD_BlueShift(); // OBSOLETE !! DON'T DO
+    }
+    catch (const std::exception& e)
+    {
+        printf("\n************ ERROR ************\n%s\n", e.what());
+        return 1;
+    }
 
 #ifdef _DEBUG
     _CrtDumpMemoryLeaks();
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+
+// Read-only view of a whole file mapped in memory.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const char* path);
+	void Close();
+
+	inline bool IsOpen() const { return _open; }
+	inline const char* GetData() const { return _data; }
+	inline size_t GetSize() const { return _size; }
+
+private:
+	bool _open = false;
+	const char* _data = nullptr;
+	size_t _size = 0;
+
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#else
+	int _fd = -1;
+#endif
+};
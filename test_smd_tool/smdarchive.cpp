@@ -0,0 +1,486 @@
+#include "smdarchive.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+//
+// Archive layout, in native byte order:
+//
+//   s_archive_header_t
+//   frame blocks, each aligned on ARCHIVE_ALIGNMENT: num_frames * num_nodes
+//     s_animation_frame_entry_t of an animation, frame after frame
+//   s_archive_animation_t for each animation, sorted by key, the lowercased name
+//   s_archive_skeleton_t for each skeleton
+//   s_archive_node_t for each node of each skeleton
+//   strings: animation names and keys and bone names, each stored once
+//
+// The tables come last so the frames can be written while the files are loaded.
+// Bump ARCHIVE_VERSION whenever the layout or the meaning of the transforms change.
+//
+
+static constexpr uint32_t ARCHIVE_MAGIC = 'S' | ('M' << 8) | ('D' << 16) | ('A' << 24);
+static constexpr uint32_t ARCHIVE_VERSION = 2;
+static constexpr size_t ARCHIVE_ALIGNMENT = 64;
+
+struct s_archive_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t num_animations;
+	uint32_t num_skeletons;
+	uint32_t num_nodes;
+	uint64_t animations_offset;
+	uint64_t skeletons_offset;
+	uint64_t nodes_offset;
+	uint64_t strings_offset;
+	uint64_t strings_size;
+};
+
+struct s_archive_animation_t
+{
+	uint32_t name_offset;
+	uint32_t name_size;
+	uint32_t skeleton;
+	// Lowercased name, name_size long.
+	uint32_t key_offset;
+	uint64_t num_frames;
+	uint64_t frames_offset;
+};
+
+struct s_archive_skeleton_t
+{
+	uint32_t first_node;
+	uint32_t num_nodes;
+};
+
+struct s_archive_node_t
+{
+	uint32_t name_offset;
+	uint32_t name_size;
+	int32_t parent;
+};
+
+// Tables of an opened archive, pointing into the mapped file.
+struct s_archive_tables_t
+{
+	const s_archive_header_t* header;
+	const s_archive_animation_t* animations;
+	const s_archive_skeleton_t* skeletons;
+	const s_archive_node_t* nodes;
+	const char* strings;
+};
+
+static s_archive_tables_t get_archive_tables(const char* data)
+{
+	const auto header = reinterpret_cast<const s_archive_header_t*>(data);
+	return {
+		header,
+		reinterpret_cast<const s_archive_animation_t*>(data + header->animations_offset),
+		reinterpret_cast<const s_archive_skeleton_t*>(data + header->skeletons_offset),
+		reinterpret_cast<const s_archive_node_t*>(data + header->nodes_offset),
+		data + header->strings_offset,
+	};
+}
+
+static bool is_in_file(uint64_t offset, uint64_t size, uint64_t file_size)
+{
+	return offset <= file_size && size <= file_size - offset;
+}
+
+// Animations are looked up by lowercased name, paths are case insensitive like _stricmp.
+static std::string get_index_key(std::string name)
+{
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+	return name;
+}
+
+// Check every offset once, so the lookups and loads can trust them.
+static bool validate_archive(const char* data, size_t size)
+{
+	if (size < sizeof(s_archive_header_t))
+		return false;
+
+	const auto& header = *reinterpret_cast<const s_archive_header_t*>(data);
+	if (header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION
+		|| header.entry_size != sizeof(s_animation_frame_entry_t))
+		return false;
+
+	if (!is_in_file(header.animations_offset, uint64_t(header.num_animations) * sizeof(s_archive_animation_t), size)
+		|| !is_in_file(header.skeletons_offset, uint64_t(header.num_skeletons) * sizeof(s_archive_skeleton_t), size)
+		|| !is_in_file(header.nodes_offset, uint64_t(header.num_nodes) * sizeof(s_archive_node_t), size)
+		|| !is_in_file(header.strings_offset, header.strings_size, size)
+		|| header.animations_offset % alignof(s_archive_animation_t) != 0
+		|| header.skeletons_offset % alignof(s_archive_skeleton_t) != 0
+		|| header.nodes_offset % alignof(s_archive_node_t) != 0)
+		return false;
+
+	const auto tables = get_archive_tables(data);
+
+	for (uint32_t i = 0; i < header.num_nodes; i++)
+	{
+		if (!is_in_file(tables.nodes[i].name_offset, tables.nodes[i].name_size, header.strings_size))
+			return false;
+	}
+
+	for (uint32_t i = 0; i < header.num_skeletons; i++)
+	{
+		const auto& skeleton = tables.skeletons[i];
+		if (!is_in_file(skeleton.first_node, skeleton.num_nodes, header.num_nodes))
+			return false;
+
+		for (uint32_t j = 0; j < skeleton.num_nodes; j++)
+		{
+			const int32_t parent = tables.nodes[skeleton.first_node + j].parent;
+			if (parent < -1 || parent >= static_cast<int32_t>(j))
+				return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < header.num_animations; i++)
+	{
+		const auto& animation = tables.animations[i];
+		if (!is_in_file(animation.name_offset, animation.name_size, header.strings_size)
+			|| !is_in_file(animation.key_offset, animation.name_size, header.strings_size)
+			|| animation.skeleton >= header.num_skeletons
+			|| animation.frames_offset % ARCHIVE_ALIGNMENT != 0)
+			return false;
+
+		const uint64_t num_nodes = tables.skeletons[animation.skeleton].num_nodes;
+		if (num_nodes != 0 && animation.num_frames > size / sizeof(s_animation_frame_entry_t) / num_nodes)
+			return false;
+
+		const uint64_t frames_size = animation.num_frames * num_nodes * sizeof(s_animation_frame_entry_t);
+		if (!is_in_file(animation.frames_offset, frames_size, size))
+			return false;
+	}
+
+	return true;
+}
+
+bool SMDAnimationArchive::Open(const char* archive_path, const char* mount_directory)
+{
+	Close();
+
+	if (!_file.Open(archive_path))
+		return false;
+
+	if (!validate_archive(_file.GetData(), _file.GetSize()))
+	{
+		Close();
+		return false;
+	}
+
+	std::error_code ec;
+	_mount_directory = std::filesystem::absolute(mount_directory, ec).lexically_normal();
+	if (ec)
+	{
+		Close();
+		return false;
+	}
+
+	// Without the trailing separator, so that lexically_relative works.
+	if (!_mount_directory.has_filename())
+		_mount_directory = _mount_directory.parent_path();
+
+	return true;
+}
+
+void SMDAnimationArchive::Close()
+{
+	_file.Close();
+	_mount_directory.clear();
+}
+
+int SMDAnimationArchive::GetAnimationCount() const
+{
+	if (!IsOpen())
+		return 0;
+
+	return static_cast<int>(get_archive_tables(_file.GetData()).header->num_animations);
+}
+
+std::string_view SMDAnimationArchive::GetAnimationName(int index) const
+{
+	const auto tables = get_archive_tables(_file.GetData());
+	const auto& animation = tables.animations[index];
+	return { tables.strings + animation.name_offset, animation.name_size };
+}
+
+int SMDAnimationArchive::FindAnimation(const char* file_path) const
+{
+	if (!IsOpen())
+		return -1;
+
+	std::error_code ec;
+	const auto relative_path = std::filesystem::absolute(file_path, ec).lexically_normal().lexically_relative(_mount_directory);
+	if (ec || relative_path.empty() || *relative_path.begin() == "..")
+		return -1;
+
+	const std::string key = get_index_key(relative_path.generic_string());
+	const auto tables = get_archive_tables(_file.GetData());
+
+	// The index is sorted by key.
+	int first = 0;
+	int last = GetAnimationCount();
+	while (first < last)
+	{
+		const int middle = first + (last - first) / 2;
+		const auto& animation = tables.animations[middle];
+		const int order = std::string_view(tables.strings + animation.key_offset, animation.name_size).compare(key);
+		if (order == 0)
+			return middle;
+
+		if (order < 0)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	return -1;
+}
+
+void SMDAnimationArchive::LoadAnimation(int index, s_animation_t& anim) const
+{
+	const auto tables = get_archive_tables(_file.GetData());
+	const auto& animation = tables.animations[index];
+	const auto& skeleton = tables.skeletons[animation.skeleton];
+
+	anim = {};
+	anim.name = std::filesystem::path(GetAnimationName(index)).filename().string();
+
+	anim.nodes.resize(skeleton.num_nodes);
+	for (uint32_t i = 0; i < skeleton.num_nodes; i++)
+	{
+		const auto& archive_node = tables.nodes[skeleton.first_node + i];
+
+		auto& node = anim.nodes[i];
+		node.index = static_cast<int>(i);
+		node.name.assign(tables.strings + archive_node.name_offset, archive_node.name_size);
+		node.parent = archive_node.parent;
+		if (node.parent != -1)
+		{
+			anim.nodes[node.parent].children.push_back(node.index);
+		}
+	}
+
+	// The block has the layout of the frame entries, world transforms included.
+	const size_t num_frames = static_cast<size_t>(animation.num_frames);
+	const size_t num_nodes = skeleton.num_nodes;
+	anim.frames.Resize(num_frames, num_nodes);
+
+	const auto entries = reinterpret_cast<const s_animation_frame_entry_t*>(_file.GetData() + animation.frames_offset);
+	for (size_t t = 0; t < num_frames; t++)
+	{
+		auto&& frame = anim.frames[t];
+		memcpy(frame.entries.data(), entries + t * num_nodes, num_nodes * sizeof(s_animation_frame_entry_t));
+	}
+
+	SMDHelper::UpdateSkeleton(anim);
+}
+
+bool SMDAnimationArchive::TryLoadAnimation(const char* file_path, s_animation_t& anim) const
+{
+	const int index = FindAnimation(file_path);
+	if (index < 0)
+		return false;
+
+	LogPrintf("grabbing %s (archive)\n", file_path);
+
+	LoadAnimation(index, anim);
+	return true;
+}
+
+//
+// Build
+//
+
+class SMDArchiveWriter
+{
+public:
+	SMDArchiveWriter(FILE* file) : _file(file)
+	{
+	}
+
+	void Write(const void* data, size_t size)
+	{
+		if (size > 0 && fwrite(data, 1, size, _file) != size)
+			throw std::runtime_error("cannot write the archive");
+		_offset += size;
+	}
+
+	void Align(size_t alignment)
+	{
+		static const char zeros[ARCHIVE_ALIGNMENT]{};
+		Write(zeros, (alignment - _offset % alignment) % alignment);
+	}
+
+	inline uint64_t GetOffset() const { return _offset; }
+
+	// Offset of the string in the string table, added the first time.
+	uint32_t InternString(const std::string& s)
+	{
+		auto it = _string_offsets.find(s);
+		if (it != _string_offsets.end())
+			return it->second;
+
+		const auto offset = static_cast<uint32_t>(_strings.size());
+		_strings += s;
+		_string_offsets.emplace(s, offset);
+		return offset;
+	}
+
+	// Index of the skeleton of the animation, added the first time.
+	uint32_t InternSkeleton(const s_animation_t& anim)
+	{
+		std::string key;
+		for (const auto& node : anim.nodes)
+		{
+			key += node.name;
+			key += '\0';
+			key.append(reinterpret_cast<const char*>(&node.parent), sizeof(node.parent));
+		}
+
+		auto it = _skeleton_indices.find(key);
+		if (it != _skeleton_indices.end())
+			return it->second;
+
+		const auto index = static_cast<uint32_t>(_skeletons.size());
+		_skeletons.push_back({ static_cast<uint32_t>(_nodes.size()), static_cast<uint32_t>(anim.nodes.size()) });
+		for (const auto& node : anim.nodes)
+			_nodes.push_back({ InternString(node.name), static_cast<uint32_t>(node.name.size()), node.parent });
+
+		_skeleton_indices.emplace(std::move(key), index);
+		return index;
+	}
+
+	void AddAnimation(const std::string& name, const s_animation_t& anim)
+	{
+		s_archive_animation_t animation{};
+		animation.name_offset = InternString(name);
+		animation.name_size = static_cast<uint32_t>(name.size());
+		animation.key_offset = InternString(get_index_key(name));
+		animation.skeleton = InternSkeleton(anim);
+		animation.num_frames = anim.frames.size();
+
+		Align(ARCHIVE_ALIGNMENT);
+		animation.frames_offset = GetOffset();
+
+		for (size_t t = 0; t < anim.frames.size(); t++)
+		{
+			auto&& frame = anim.frames[t];
+			Write(frame.entries.data(), anim.nodes.size() * sizeof(s_animation_frame_entry_t));
+		}
+
+		_animations.push_back(animation);
+	}
+
+	// Write the tables after the frames, then the header.
+	void Finish()
+	{
+		s_archive_header_t header{};
+		header.magic = ARCHIVE_MAGIC;
+		header.version = ARCHIVE_VERSION;
+		header.entry_size = sizeof(s_animation_frame_entry_t);
+		header.num_animations = static_cast<uint32_t>(_animations.size());
+		header.num_skeletons = static_cast<uint32_t>(_skeletons.size());
+		header.num_nodes = static_cast<uint32_t>(_nodes.size());
+
+		Align(alignof(s_archive_animation_t));
+		header.animations_offset = GetOffset();
+		Write(_animations.data(), _animations.size() * sizeof(s_archive_animation_t));
+
+		header.skeletons_offset = GetOffset();
+		Write(_skeletons.data(), _skeletons.size() * sizeof(s_archive_skeleton_t));
+
+		header.nodes_offset = GetOffset();
+		Write(_nodes.data(), _nodes.size() * sizeof(s_archive_node_t));
+
+		header.strings_offset = GetOffset();
+		header.strings_size = _strings.size();
+		Write(_strings.data(), _strings.size());
+
+		if (fseek(_file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, _file) != 1)
+			throw std::runtime_error("cannot write the archive");
+	}
+
+	inline size_t GetSkeletonCount() const { return _skeletons.size(); }
+
+private:
+	FILE* _file;
+	uint64_t _offset = 0;
+	std::string _strings;
+	std::unordered_map<std::string, uint32_t> _string_offsets;
+	std::unordered_map<std::string, uint32_t> _skeleton_indices;
+	std::vector<s_archive_animation_t> _animations;
+	std::vector<s_archive_skeleton_t> _skeletons;
+	std::vector<s_archive_node_t> _nodes;
+};
+
+void SMDAnimationArchive::Build(const char* directory, const char* archive_path, const SMDFileLoader& loader)
+{
+	// Sorted by key, which is the order of the index.
+	std::vector<std::pair<std::string, std::filesystem::path>> files;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(directory))
+	{
+		if (!entry.is_regular_file() || _stricmp(entry.path().extension().string().c_str(), ".smd"))
+			continue;
+
+		files.emplace_back(entry.path().lexically_relative(directory).generic_string(), entry.path());
+	}
+
+	std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+		return get_index_key(a.first) < get_index_key(b.first);
+	});
+
+	// Written next to the archive and renamed over it once complete.
+	const std::string temp_path = std::string(archive_path) + ".tmp";
+	FILE* file = fopen(temp_path.c_str(), "wb");
+	if (!file)
+		throw std::runtime_error(std::string("cannot write ") + archive_path);
+
+	try
+	{
+		SMDArchiveWriter writer(file);
+
+		// Room for the header, written last.
+		const s_archive_header_t header{};
+		writer.Write(&header, sizeof(header));
+
+		for (const auto& [name, path] : files)
+		{
+			s_animation_t anim;
+			loader.LoadAnimation(path.string().c_str(), anim);
+			SMDHelper::UpdateWorldTransforms(anim);
+			writer.AddAnimation(name, anim);
+		}
+
+		writer.Finish();
+
+		LogPrintf("%d animations, %d skeletons written to %s\n", static_cast<int>(files.size()),
+			static_cast<int>(writer.GetSkeletonCount()), archive_path);
+
+		if (fclose(file) != 0)
+		{
+			file = nullptr;
+			throw std::runtime_error(std::string("cannot write ") + archive_path);
+		}
+		file = nullptr;
+
+		std::filesystem::rename(temp_path, archive_path);
+	}
+	catch (...)
+	{
+		if (file)
+			fclose(file);
+
+		std::error_code ec;
+		std::filesystem::remove(temp_path, ec);
+		throw;
+	}
+}
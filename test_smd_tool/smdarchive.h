@@ -0,0 +1,57 @@
+#pragma once
+
+#include "smdfile.h"
+#include "mappedfile.h"
+
+#include <filesystem>
+#include <string_view>
+
+//
+// The animations of a directory tree, packed in a single file.
+//
+// SMDAnimationArchive::Build parses every .smd file below a directory once and
+// writes them to one archive: an index of the file paths sorted by name, the
+// skeletons, each stored once with interned bone names, and the frames of each
+// animation as an aligned block of s_animation_frame_entry_t with the world
+// transforms already built. An opened archive is memory mapped and its index is
+// searched in place. Loading an animation is an index lookup and a copy of its
+// frame block, without opening or parsing its file.
+//
+// An archive is a snapshot: it does not check the files it was built from,
+// build it again after editing them.
+//
+class SMDAnimationArchive
+{
+public:
+	SMDAnimationArchive() = default;
+
+	SMDAnimationArchive(const SMDAnimationArchive&) = delete;
+	SMDAnimationArchive& operator=(const SMDAnimationArchive&) = delete;
+
+	// Pack the .smd files below directory, named by their path relative to it.
+	// Throws SMDLoadException if a file cannot be loaded, std::runtime_error if
+	// the archive cannot be written.
+	static void Build(const char* directory, const char* archive_path, const SMDFileLoader& loader = SMDFileLoader());
+
+	// Map the archive, whose animations then stand for the files below mount_directory.
+	// Returns false if the file cannot be opened or is not a valid archive.
+	bool Open(const char* archive_path, const char* mount_directory);
+	void Close();
+
+	inline bool IsOpen() const { return _file.IsOpen(); }
+
+	int GetAnimationCount() const;
+	// Path of the animation relative to the mount directory, with / separators.
+	std::string_view GetAnimationName(int index) const;
+
+	// Index of the animation that stands for file_path, -1 if none. Case insensitive.
+	int FindAnimation(const char* file_path) const;
+	// The animation is named after the file name, like SMDFileLoader does.
+	void LoadAnimation(int index, s_animation_t& anim) const;
+	// Returns false if the file is not in the archive.
+	bool TryLoadAnimation(const char* file_path, s_animation_t& anim) const;
+
+private:
+	MappedFile _file;
+	std::filesystem::path _mount_directory;
+};
@@ -0,0 +1,550 @@
+#include "smdfile.h"
+#include "mappedfile.h"
+#include "log.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+//
+// Entry layout, in native byte order:
+//
+//   s_cache_header_t
+//   source path, path_size bytes
+//   s_cache_node_t for each node
+//   node names, back to back, names_size bytes
+//   padding to CACHE_ALIGNMENT
+//   local transforms, frame after frame, num_nodes per frame
+//   world transforms, same layout, if CACHE_HAS_WORLD_TRANSFORMS
+//
+// Bump CACHE_VERSION whenever the layout or the meaning of the transforms
+// change, older entries are then ignored.
+//
+
+static constexpr uint32_t CACHE_MAGIC = 'S' | ('M' << 8) | ('D' << 16) | ('C' << 24);
+static constexpr uint32_t CACHE_VERSION = 1;
+static constexpr uint32_t CACHE_HAS_WORLD_TRANSFORMS = 1;
+static constexpr size_t CACHE_ALIGNMENT = 16;
+
+struct s_cache_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t flags;
+	int64_t source_time;
+	uint64_t source_size;
+	uint32_t path_size;
+	uint32_t num_nodes;
+	uint64_t num_frames;
+	uint64_t names_size;
+};
+
+struct s_cache_node_t
+{
+	int32_t parent;
+	uint32_t name_size;
+};
+
+static size_t align_cache_offset(size_t offset)
+{
+	return (offset + CACHE_ALIGNMENT - 1) & ~(CACHE_ALIGNMENT - 1);
+}
+
+// Offset of the local transforms.
+static size_t get_transforms_offset(const s_cache_header_t& header)
+{
+	return align_cache_offset(sizeof(s_cache_header_t) + header.path_size
+		+ header.num_nodes * sizeof(s_cache_node_t) + header.names_size);
+}
+
+static uint64_t get_transforms_size(const s_cache_header_t& header)
+{
+	return header.num_frames * header.num_nodes * sizeof(glm::mat4);
+}
+
+static std::string get_entry_path(const std::string& directory, const std::string& source_path)
+{
+	// FNV-1a, collisions are caught by the source path stored in the entry.
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : source_path)
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.smdcache", static_cast<unsigned long long>(hash));
+	return (std::filesystem::path(directory) / name).string();
+}
+
+static bool get_source_version(const char* source_path, SMDAnimationCache::SourceVersion& version)
+{
+	std::error_code ec;
+	const std::filesystem::path path = std::filesystem::absolute(source_path, ec).lexically_normal();
+	if (ec)
+		return false;
+
+	// The file time is used as is, it only has to change when the file does.
+	const auto time = std::filesystem::last_write_time(path, ec);
+	if (ec)
+		return false;
+
+	const auto size = std::filesystem::file_size(path, ec);
+	if (ec)
+		return false;
+
+	version.path = path.string();
+	version.time = static_cast<int64_t>(time.time_since_epoch().count());
+	version.size = static_cast<uint64_t>(size);
+	return true;
+}
+
+bool SMDAnimationCache::TryLoad(const char* source_path, s_animation_t& anim, SourceVersion& version) const
+{
+	version = {};
+	if (!get_source_version(source_path, version))
+		return false;
+
+	MappedFile file;
+	if (!file.Open(get_entry_path(_directory, version.path).c_str()))
+		return false;
+
+	const char* data = file.GetData();
+	const size_t size = file.GetSize();
+
+	s_cache_header_t header;
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+
+	if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION
+		|| header.entry_size != sizeof(s_animation_frame_entry_t)
+		|| header.source_time != version.time || header.source_size != version.size
+		|| header.path_size != version.path.size())
+		return false;
+
+	// Entries without world transforms are rewritten when they are wanted.
+	const bool has_world_transforms = (header.flags & CACHE_HAS_WORLD_TRANSFORMS) != 0;
+	if (_world_transforms && !has_world_transforms)
+		return false;
+
+	const size_t transforms_offset = get_transforms_offset(header);
+	const uint64_t transforms_size = get_transforms_size(header);
+	if (size != transforms_offset + transforms_size * (has_world_transforms ? 2 : 1))
+		return false;
+
+	const char* path = data + sizeof(header);
+	if (memcmp(path, version.path.data(), header.path_size) != 0)
+		return false;
+
+	anim = {};
+	anim.name = std::filesystem::path(source_path).filename().string();
+
+	LogPrintf("grabbing %s (cached)\n", source_path);
+
+	const char* node_data = path + header.path_size;
+	const char* names = node_data + header.num_nodes * sizeof(s_cache_node_t);
+	const char* names_end = names + header.names_size;
+
+	anim.nodes.resize(header.num_nodes);
+	for (uint32_t i = 0; i < header.num_nodes; i++)
+	{
+		s_cache_node_t cache_node;
+		memcpy(&cache_node, node_data + i * sizeof(s_cache_node_t), sizeof(cache_node));
+
+		if (cache_node.name_size > static_cast<size_t>(names_end - names)
+			|| cache_node.parent < -1 || cache_node.parent >= static_cast<int32_t>(i))
+		{
+			anim = {};
+			return false;
+		}
+
+		auto& node = anim.nodes[i];
+		node.index = static_cast<int>(i);
+		node.name.assign(names, cache_node.name_size);
+		node.parent = cache_node.parent;
+		if (node.parent != -1)
+		{
+			anim.nodes[node.parent].children.push_back(node.index);
+		}
+
+		names += cache_node.name_size;
+	}
+
+	const size_t num_frames = static_cast<size_t>(header.num_frames);
+	const size_t num_nodes = header.num_nodes;
+	anim.frames.Resize(num_frames, num_nodes);
+
+	const char* local_transforms = data + transforms_offset;
+	const char* world_transforms = local_transforms + transforms_size;
+	for (size_t t = 0; t < num_frames; t++)
+	{
+		auto&& frame = anim.frames[t];
+		for (size_t i = 0; i < num_nodes; i++)
+		{
+			const size_t offset = (t * num_nodes + i) * sizeof(glm::mat4);
+			memcpy(&frame.entries[i].local_transform, local_transforms + offset, sizeof(glm::mat4));
+			if (has_world_transforms)
+				memcpy(&frame.entries[i].world_transform, world_transforms + offset, sizeof(glm::mat4));
+		}
+	}
+
+	SMDHelper::UpdateSkeleton(anim);
+	if (!has_world_transforms)
+		SMDHelper::MarkAllBonesDirty(anim);
+
+	return true;
+}
+
+// Write the transforms selected by member, frame after frame.
+static bool write_cache_transforms(FILE* file, const s_animation_t& anim, glm::mat4 s_animation_frame_entry_t::* member)
+{
+	std::vector<glm::mat4> frame_transforms(anim.nodes.size());
+	for (size_t t = 0; t < anim.frames.size(); t++)
+	{
+		auto&& frame = anim.frames[t];
+		for (size_t i = 0; i < frame_transforms.size(); i++)
+			frame_transforms[i] = frame.entries[i].*member;
+
+		if (fwrite(frame_transforms.data(), sizeof(glm::mat4), frame_transforms.size(), file) != frame_transforms.size())
+			return false;
+	}
+	return true;
+}
+
+static bool write_cache_entry(FILE* file, const SMDAnimationCache::SourceVersion& version, const s_animation_t& anim, bool world_transforms)
+{
+	s_cache_header_t header{};
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.entry_size = sizeof(s_animation_frame_entry_t);
+	header.flags = world_transforms ? CACHE_HAS_WORLD_TRANSFORMS : 0;
+	header.source_time = version.time;
+	header.source_size = version.size;
+	header.path_size = static_cast<uint32_t>(version.path.size());
+	header.num_nodes = static_cast<uint32_t>(anim.nodes.size());
+	header.num_frames = anim.frames.size();
+
+	std::vector<s_cache_node_t> cache_nodes;
+	cache_nodes.reserve(anim.nodes.size());
+	std::string names;
+	for (const auto& node : anim.nodes)
+	{
+		cache_nodes.push_back({ node.parent, static_cast<uint32_t>(node.name.size()) });
+		names += node.name;
+	}
+	header.names_size = names.size();
+
+	const size_t padding = get_transforms_offset(header) - (sizeof(header) + version.path.size()
+		+ cache_nodes.size() * sizeof(s_cache_node_t) + names.size());
+	const char zeros[CACHE_ALIGNMENT]{};
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1
+		|| fwrite(version.path.data(), 1, version.path.size(), file) != version.path.size()
+		|| fwrite(cache_nodes.data(), sizeof(s_cache_node_t), cache_nodes.size(), file) != cache_nodes.size()
+		|| fwrite(names.data(), 1, names.size(), file) != names.size()
+		|| fwrite(zeros, 1, padding, file) != padding)
+		return false;
+
+	if (!write_cache_transforms(file, anim, &s_animation_frame_entry_t::local_transform))
+		return false;
+
+	if (world_transforms && !write_cache_transforms(file, anim, &s_animation_frame_entry_t::world_transform))
+		return false;
+
+	return true;
+}
+
+void SMDAnimationCache::Store(const SourceVersion& version, s_animation_t& anim) const
+{
+	if (_world_transforms)
+		SMDHelper::UpdateWorldTransforms(anim);
+
+	std::error_code ec;
+	std::filesystem::create_directories(_directory, ec);
+	if (ec)
+		return;
+
+	// Write to a file of our own and rename it over the entry, so that a process
+	// or thread loading the same file never sees a partial entry.
+	static std::atomic<unsigned int> s_temp_counter{ 0 };
+	const std::string entry_path = get_entry_path(_directory, version.path);
+	const std::string temp_path = entry_path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()))
+		+ "." + std::to_string(s_temp_counter++) + ".tmp";
+
+	FILE* file = fopen(temp_path.c_str(), "wb");
+	if (!file)
+		return;
+
+	const bool written = write_cache_entry(file, version, anim, _world_transforms);
+	if (fclose(file) != 0 || !written)
+	{
+		std::filesystem::remove(temp_path, ec);
+		return;
+	}
+
+	std::filesystem::rename(temp_path, entry_path, ec);
+	if (ec)
+		std::filesystem::remove(temp_path, ec);
+}
+
+//
+// SMDSharedAnimationCache
+//
+
+struct s_shared_animation_t
+{
+	SMDAnimationCache::SourceVersion version;
+	std::weak_ptr<const s_animation_t> animation;
+	// Keeps the animation alive while its path is retained.
+	std::shared_ptr<const s_animation_t> retained;
+	// Valid while the animation is being loaded, identified by load_id.
+	std::shared_future<std::shared_ptr<const s_animation_t>> pending;
+	uint64_t load_id = 0;
+};
+
+static std::mutex s_shared_animations_mutex;
+static std::unordered_map<std::string, s_shared_animation_t> s_shared_animations;
+static size_t s_shared_animations_pruned_size = 0;
+static uint64_t s_shared_animations_load_id = 0;
+// Retain counts of the files and directories whose animations are kept.
+static std::unordered_map<std::string, int> s_retained_paths;
+
+// Absolute path, to compare the paths given in different ways.
+static std::string get_path_key(const char* path)
+{
+	std::error_code ec;
+	const auto absolute_path = std::filesystem::absolute(path, ec);
+	return ec ? std::string(path) : absolute_path.lexically_normal().string();
+}
+
+// True if the file is one of the retained paths or is inside one.
+static bool is_path_retained(const std::string& file_path)
+{
+	for (const auto& [retained_path, count] : s_retained_paths)
+	{
+		const auto relative_path = std::filesystem::path(file_path).lexically_relative(retained_path);
+		if (!relative_path.empty() && *relative_path.begin() != "..")
+			return true;
+	}
+
+	return false;
+}
+
+// Forget the animations nobody uses anymore, once the map has doubled since the last time.
+static void prune_shared_animations()
+{
+	if (s_shared_animations.size() < 2 * s_shared_animations_pruned_size + 16)
+		return;
+
+	for (auto it = s_shared_animations.begin(); it != s_shared_animations.end();)
+	{
+		if (!it->second.pending.valid() && it->second.animation.expired())
+			it = s_shared_animations.erase(it);
+		else
+			++it;
+	}
+
+	s_shared_animations_pruned_size = s_shared_animations.size();
+}
+
+std::shared_ptr<const s_animation_t> SMDSharedAnimationCache::Load(const SMDFileLoader& loader, const char* file_path)
+{
+	// Files written in memory are already shared.
+	if (auto memory_anim = SMDMemoryFiles::Find(file_path))
+	{
+		LogPrintf("grabbing %s (memory)\n", file_path);
+		return memory_anim;
+	}
+
+	SMDAnimationCache::SourceVersion version;
+	if (!get_source_version(file_path, version))
+	{
+		// Let the loader report the error.
+		auto anim = std::make_shared<s_animation_t>();
+		loader.LoadAnimation(file_path, *anim);
+		return anim;
+	}
+
+	std::promise<std::shared_ptr<const s_animation_t>> promise;
+	uint64_t load_id;
+
+	{
+		std::unique_lock<std::mutex> lock(s_shared_animations_mutex);
+
+		auto& entry = s_shared_animations[version.path];
+		if (entry.version.time == version.time && entry.version.size == version.size)
+		{
+			if (auto anim = entry.animation.lock())
+			{
+				lock.unlock();
+				LogPrintf("grabbing %s (shared)\n", file_path);
+				return anim;
+			}
+
+			if (entry.pending.valid())
+			{
+				auto pending = entry.pending;
+				lock.unlock();
+				auto anim = pending.get();
+				LogPrintf("grabbing %s (shared)\n", file_path);
+				return anim;
+			}
+		}
+
+		load_id = ++s_shared_animations_load_id;
+		entry.version = version;
+		entry.animation.reset();
+		entry.retained.reset();
+		entry.pending = promise.get_future().share();
+		entry.load_id = load_id;
+
+		prune_shared_animations();
+	}
+
+	try
+	{
+		auto loaded = std::make_shared<s_animation_t>();
+		loader.LoadAnimation(file_path, *loaded);
+		std::shared_ptr<const s_animation_t> anim = std::move(loaded);
+
+		{
+			std::lock_guard<std::mutex> lock(s_shared_animations_mutex);
+			auto it = s_shared_animations.find(version.path);
+			if (it != s_shared_animations.end() && it->second.load_id == load_id)
+			{
+				it->second.animation = anim;
+				if (is_path_retained(version.path))
+					it->second.retained = anim;
+				it->second.pending = {};
+			}
+		}
+
+		promise.set_value(anim);
+		return anim;
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard<std::mutex> lock(s_shared_animations_mutex);
+			auto it = s_shared_animations.find(version.path);
+			if (it != s_shared_animations.end() && it->second.load_id == load_id)
+				s_shared_animations.erase(it);
+		}
+
+		promise.set_exception(std::current_exception());
+		throw;
+	}
+}
+
+void SMDSharedAnimationCache::Retain(const char* path)
+{
+	std::lock_guard<std::mutex> lock(s_shared_animations_mutex);
+
+	++s_retained_paths[get_path_key(path)];
+}
+
+void SMDSharedAnimationCache::Release(const char* path)
+{
+	std::lock_guard<std::mutex> lock(s_shared_animations_mutex);
+
+	auto it = s_retained_paths.find(get_path_key(path));
+	if (it == s_retained_paths.end() || --it->second > 0)
+		return;
+
+	s_retained_paths.erase(it);
+	for (auto& [file_path, entry] : s_shared_animations)
+	{
+		if (entry.retained && !is_path_retained(file_path))
+			entry.retained.reset();
+	}
+}
+
+//
+// SMDMemoryFiles
+//
+
+static thread_local SMDOutputMode t_memory_output_mode = SMDOutputMode::DISK;
+static std::mutex s_memory_files_mutex;
+static std::unordered_map<std::string, std::shared_ptr<const s_animation_t>> s_memory_files;
+// Lets the loads skip the lock and the path lookup when there are no files in memory.
+static std::atomic<size_t> s_num_memory_files{ 0 };
+
+void SMDMemoryFiles::SetOutputMode(SMDOutputMode mode)
+{
+	t_memory_output_mode = mode;
+}
+
+SMDOutputMode SMDMemoryFiles::GetOutputMode()
+{
+	return t_memory_output_mode;
+}
+
+std::shared_ptr<const s_animation_t> SMDMemoryFiles::Find(const char* file_path)
+{
+	if (s_num_memory_files == 0)
+		return nullptr;
+
+	const std::string key = get_path_key(file_path);
+
+	std::lock_guard<std::mutex> lock(s_memory_files_mutex);
+	auto it = s_memory_files.find(key);
+	return it != s_memory_files.end() ? it->second : nullptr;
+}
+
+void SMDMemoryFiles::Store(const char* file_path, const s_animation_t& anim)
+{
+	// Named after the file, like a loaded animation.
+	auto stored = std::make_shared<s_animation_t>(anim);
+	stored->name = std::filesystem::path(file_path).filename().string();
+	const std::string key = get_path_key(file_path);
+
+	std::lock_guard<std::mutex> lock(s_memory_files_mutex);
+	s_memory_files[key] = std::move(stored);
+	s_num_memory_files = s_memory_files.size();
+}
+
+void SMDMemoryFiles::Remove(const char* file_path)
+{
+	if (s_num_memory_files == 0)
+		return;
+
+	const std::string key = get_path_key(file_path);
+
+	std::lock_guard<std::mutex> lock(s_memory_files_mutex);
+	s_memory_files.erase(key);
+	s_num_memory_files = s_memory_files.size();
+}
+
+void SMDMemoryFiles::ClearDirectory(const char* directory)
+{
+	if (s_num_memory_files == 0)
+		return;
+
+	const std::filesystem::path key = get_path_key(directory);
+
+	std::lock_guard<std::mutex> lock(s_memory_files_mutex);
+	for (auto it = s_memory_files.begin(); it != s_memory_files.end();)
+	{
+		const auto relative_path = std::filesystem::path(it->first).lexically_relative(key);
+		if (!relative_path.empty() && *relative_path.begin() != "..")
+			it = s_memory_files.erase(it);
+		else
+			++it;
+	}
+
+	s_num_memory_files = s_memory_files.size();
+}
+
+void SMDMemoryFiles::Clear()
+{
+	std::lock_guard<std::mutex> lock(s_memory_files_mutex);
+	s_memory_files.clear();
+	s_num_memory_files = 0;
+}
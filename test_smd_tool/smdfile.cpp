@@ -2,6 +2,9 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdarg>
+#include <cctype>
+#include <charconv>
+#include <string_view>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -9,6 +12,11 @@
 #include <filesystem>
 
 #include "smdfile.h"
+#include "mappedfile.h"
+#include "smdarchive.h"
+#include "log.h"
+#include "threadpool.h"
+#include "transformkernels.h"
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_access.hpp"
@@ -28,20 +36,6 @@
 
 #define DEBUG_MESSAGES 0
 
-void Error (const char *error, ...)
-{
-	va_list argptr;
-
-	printf ("\n************ ERROR ************\n");
-
-	va_start (argptr,error);
-	vprintf (error,argptr);
-	va_end (argptr);
-	printf ("\n");
-
-	exit (1);
-}
-
 int	FileTime (char *path)
 {
 	struct	stat	buf;
@@ -52,11 +46,6 @@ int	FileTime (char *path)
 	return buf.st_mtime;
 }
 
-char	filename[1024]{};
-FILE* input = nullptr;
-char	line[1024]{};
-int		linecount = 0;
-
 void clip_rotations( glm::vec3& rot )
 {
 	int j;
@@ -74,9 +63,10 @@ void make_zero_positive(glm::vec3 &v)
 {
 	int i;
 
+	// -0 becomes 0. Compares the float itself, abs() may resolve to the int overload.
 	for (i = 0; i < 3; i++) {
-		if (abs(v[i]) == 0.0f)
-			v[i] = abs(v[i]);
+		if (v[i] == 0.0f)
+			v[i] = 0.0f;
 	}
 }
 
@@ -91,6 +81,18 @@ inline void extract_position_from_matrix(const glm::mat4& m, glm::vec3& pos)
 }
 
 
+// World transform of a bone from its parent world transform and its local transform.
+inline glm::mat4 world_from_local(const glm::mat4& parent_world, const glm::mat4& local)
+{
+	return s_affinetransform_t::Multiply(parent_world, local);
+}
+
+// Local transform of a bone from its parent world transform and its world transform.
+inline glm::mat4 local_from_world(const glm::mat4& parent_world, const glm::mat4& world)
+{
+	return s_affinetransform_t::InverseMultiply(parent_world, world);
+}
+
 inline glm::mat4 create_rotation_matrix(const glm::vec3& anglesPitchYawRoll)
 {
 	glm::mat4 xRot = glm::rotate(glm::identity<glm::mat4>(), anglesPitchYawRoll[0], glm::vec3(1,0,0));
@@ -101,18 +103,275 @@ inline glm::mat4 create_rotation_matrix(const glm::vec3& anglesPitchYawRoll)
 }
 
 
-void Grab_Nodes( std::vector<s_node_t>& nodes )
+//
+// Memory mapped reader helpers.
+//
+// The file is mapped once and tokenized in place. Numbers are parsed with
+// std::from_chars, which does not depend on the current locale and does not
+// need a null terminated copy of the line.
+//
+
+struct s_mapped_line_t
+{
+	const char* begin;
+	const char* end;
+};
+
+inline bool read_mapped_line(const char*& p, const char* end, s_mapped_line_t& l)
+{
+	if (p >= end)
+		return false;
+
+	const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+	if (!eol)
+		eol = end;
+
+	l.begin = p;
+	l.end = eol;
+	p = eol < end ? eol + 1 : end;
+	return true;
+}
+
+inline const char* skip_blanks(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		++p;
+	return p;
+}
+
+inline bool parse_int(const char*& p, const char* end, int& value)
+{
+	p = skip_blanks(p, end);
+	if (p < end && *p == '+')
+		++p;
+
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc())
+		return false;
+
+	p = result.ptr;
+	return true;
+}
+
+inline bool parse_float(const char*& p, const char* end, float& value)
+{
+	p = skip_blanks(p, end);
+	if (p < end && *p == '+')
+		++p;
+
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc())
+		return false;
+
+	p = result.ptr;
+	return true;
+}
+
+inline bool parse_word(const char*& p, const char* end, std::string_view& word)
+{
+	p = skip_blanks(p, end);
+
+	const char* start = p;
+	while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+		++p;
+
+	word = std::string_view(start, p - start);
+	return !word.empty();
+}
+
+inline bool parse_quoted(const char*& p, const char* end, std::string_view& text)
+{
+	p = skip_blanks(p, end);
+	if (p >= end || *p != '"')
+		return false;
+
+	const char* start = ++p;
+	while (p < end && *p != '"')
+		++p;
+
+	if (p >= end || p == start)
+		return false;
+
+	text = std::string_view(start, p - start);
+	++p;
+	return true;
+}
+
+inline std::string_view mapped_line_text(const s_mapped_line_t& l)
+{
+	const char* end = l.end;
+	if (end > l.begin && end[-1] == '\r')
+		--end;
+	return std::string_view(l.begin, end - l.begin);
+}
+
+//
+// SMDParser
+//
+// All the state needed to read one file lives in the parser, so any number of
+// files can be loaded at the same time. Errors are reported by throwing
+// SMDLoadException, which SMDFileLoader turns into an SMDLoadError.
+// The parser fills either an s_animation_t or an s_compact_animation_t.
+//
+
+class SMDParser
+{
+public:
+	SMDParser(const char* file_path, s_animation_t& anim) :
+		_file_path(file_path),
+		_nodes(anim.nodes),
+		_anim(&anim)
+	{
+	}
+
+	SMDParser(const char* file_path, s_compact_animation_t& anim) :
+		_file_path(file_path),
+		_nodes(anim.nodes),
+		_compact(&anim)
+	{
+	}
+
+	~SMDParser()
+	{
+		if (_input)
+			fclose(_input);
+	}
+
+	SMDParser(const SMDParser&) = delete;
+	SMDParser& operator=(const SMDParser&) = delete;
+
+	void Option_Animation();
+	void Option_Animation_Mapped();
+
+private:
+	[[noreturn]] void Fail(const char* format, ...) const;
+
+	void Grab_Nodes();
+	void Grab_Animation();
+
+	void Grab_Nodes_Mapped(const char*& p, const char* end);
+	void Grab_Animation_Mapped(const char*& p, const char* end);
+
+	void AddFrame();
+	// Returns false if index is not a bone of the current frame.
+	bool SetBoneLocalTransform(int index, const glm::vec3& pos, const glm::vec3& rot);
+	// Convert the bones of the current frame set since the last flush.
+	void FlushFrame();
+	void EndAnimation();
+
+	std::string _file_path;
+	std::vector<s_node_t>& _nodes;
+	s_animation_t* _anim = nullptr;
+	s_compact_animation_t* _compact = nullptr;
+
+	FILE* _input = nullptr;
+	char _line[1024]{};
+	int _linecount = 0;
+
+	// Bone lines of the current frame, converted to matrices together by FlushFrame.
+	std::vector<int> _frame_bones;
+	std::vector<glm::vec3> _frame_angles;
+	std::vector<glm::vec3> _frame_positions;
+};
+
+void SMDParser::Fail(const char* format, ...) const
+{
+	char message[1024];
+
+	va_list argptr;
+	va_start(argptr, format);
+	vsnprintf(message, sizeof(message), format, argptr);
+	va_end(argptr);
+
+	// Lines read by fgets keep their line break.
+	message[strcspn(message, "\r\n")] = '\0';
+
+	SMDLoadError error;
+	error.file_path = _file_path;
+	error.line = _linecount;
+	error.message = message;
+	throw SMDLoadException(error);
+}
+
+void SMDParser::AddFrame()
+{
+	if (_anim)
+	{
+		FlushFrame();
+		_anim->frames.AddFrame(_nodes.size());
+	}
+	else
+	{
+		_compact->local_poses.resize(_compact->local_poses.size() + _nodes.size());
+		++_compact->num_frames;
+	}
+}
+
+bool SMDParser::SetBoneLocalTransform(int index, const glm::vec3& pos, const glm::vec3& rot)
+{
+	if (_anim)
+	{
+		if (_anim->frames.empty() || index < 0 || index >= _anim->frames.back().entries.size())
+			return false;
+
+		_frame_bones.push_back(index);
+		_frame_angles.push_back(rot);
+		_frame_positions.push_back(pos);
+	}
+	else
+	{
+		if (_compact->num_frames == 0 || index < 0 || index >= _nodes.size())
+			return false;
+
+		_compact->GetLocalPose(index, static_cast<int>(_compact->num_frames - 1)) = s_bonepose_t::FromEulerAngles(rot, pos);
+	}
+
+	return true;
+}
+
+void SMDParser::FlushFrame()
+{
+	if (_frame_bones.empty())
+		return;
+
+	EulerAnglesToLocalTransforms(_anim->frames.back().entries.data(), _frame_bones.data(),
+		_frame_angles.data(), _frame_positions.data(), static_cast<int>(_frame_bones.size()));
+
+	_frame_bones.clear();
+	_frame_angles.clear();
+	_frame_positions.clear();
+}
+
+void SMDParser::EndAnimation()
+{
+	// World transforms are built the first time they are needed,
+	// files that are only converted in local space never build them.
+	if (_anim)
+	{
+		FlushFrame();
+		SMDHelper::UpdateSkeleton(*_anim);
+		SMDHelper::MarkAllBonesDirty(*_anim);
+	}
+}
+
+void SMDParser::Grab_Nodes()
 {
 	int index;
 	char name[1024];
 	int parent;
-	int i;
 
-	while (fgets( line, sizeof( line ), input ) != NULL) 
+	auto& nodes = _nodes;
+
+	while (fgets( _line, sizeof( _line ), _input ) != NULL)
 	{
-		linecount++;
-		if (sscanf( line, "%d \"%[^\"]\" %d", &index, name, &parent ) == 3)
+		_linecount++;
+		if (sscanf( _line, "%d \"%[^\"]\" %d", &index, name, &parent ) == 3)
 		{
+			if (index != nodes.size())
+				Fail( "bad node index : %s", _line );
+			if (parent != -1 && (parent < 0 || parent >= index))
+				Fail( "bad node parent : %s", _line );
+
 			nodes.push_back({});
 
 			nodes[index].index = index;
@@ -128,24 +387,20 @@ void Grab_Nodes( std::vector<s_node_t>& nodes )
 			return;
 		}
 	}
-	Error( "Unexpected EOF at line %d\n", linecount );
-	return;
+	Fail( "unexpected EOF in nodes" );
 }
 
-void Grab_Animation( s_animation_t & anim )
+void SMDParser::Grab_Animation()
 {
 	glm::vec3 pos;
 	glm::vec3 rot;
 	char cmd[1024];
 	int index = 0;
-	int	t = -99999999;
-	int start = 99999;
-	int end = 0;
 
-	while (fgets( line, sizeof( line ), input ) != NULL) 
+	while (fgets( _line, sizeof( _line ), _input ) != NULL)
 	{
-		linecount++;
-		if (sscanf( line, "%d %f %f %f %f %f %f", &index, &pos[0], &pos[1], &pos[2], &rot[0], &rot[1], &rot[2] ) == 7)
+		_linecount++;
+		if (sscanf( _line, "%d %f %f %f %f %f %f", &index, &pos[0], &pos[1], &pos[2], &rot[0], &rot[1], &rot[2] ) == 7)
 		{
 			clip_rotations(rot);
 
@@ -157,434 +412,1269 @@ void Grab_Animation( s_animation_t & anim )
 //local_transform.m = create_rotation_matrix(glm::vec3(rot[1], rot[2], rot[0]));
 
 
-			auto& local_transform = anim.frames.back().entries[index].local_transform;
-			local_transform = create_rotation_matrix(rot);
-			local_transform[3] = glm::vec4(pos, 1.0);
+			if (!SetBoneLocalTransform(index, pos, rot))
+				Fail( "bad bone index : %s", _line );
 		}
-		else if (sscanf( line, "%s %d", cmd, &index ))
+		else if (sscanf( _line, "%s %d", cmd, &index ) > 0)
 		{
 			if (strcmp( cmd, "time" ) == 0) 
 			{
-				t = index;
-				anim.frames.push_back({});
-				anim.frames.back().entries.resize(anim.nodes.size());
+				AddFrame();
 			}
 			else if (strcmp( cmd, "end") == 0) 
 			{
-				// Build bone world transform.
-				SMDHelper::BuildAnimationWorldTransform(anim);
+				EndAnimation();
 
 				return;
 			}
 			else
 			{
-				Error( "Error(%d) : %s", linecount, line );
+				Fail( "%s", _line );
 			}
 		}
-		else
-		{
-			Error( "Error(%d) : %s", linecount, line );
-		}
 	}
-	Error( "unexpected EOF: %s\n", anim.name.c_str() );
+	Fail( "unexpected EOF in skeleton" );
 }
 
-void Option_Animation ( const char *file_path, s_animation_t& anim )
+void SMDParser::Option_Animation()
 {
-	int		time1;
 	char	cmd[1024]{};
-	int		option;
-
-	char name[MAX_PATH]{};
-	strcpy(name, std::filesystem::path(file_path).filename().string().c_str());
+	int		option = 0;
 
-	anim.name = name;
+	if ((_input = fopen(_file_path.c_str(), "r")) == 0)
+		Fail("could not open file");
 
-	sprintf (filename, "%s", file_path);
-
-	time1 = FileTime (filename);
-	if (time1 == -1)
-		Error ("%s doesn't exist", filename);
-
-	printf ("grabbing %s\n", filename);
-
-	if ((input = fopen(filename, "r")) == 0) {
-		fprintf(stderr,"reader: could not open file '%s'\n", filename);
-		Error(0);
-	}
-	linecount = 0;
+	while (fgets( _line, sizeof( _line ), _input ) != NULL) {
+		_linecount++;
+		if (sscanf( _line, "%s %d", cmd, &option ) <= 0)
+			continue; // Blank line.
 
-	while (fgets( line, sizeof( line ), input ) != NULL) {
-		linecount++;
-		sscanf( line, "%s %d", cmd, &option );
 		if (strcmp( cmd, "version" ) == 0) {
 			if (option != 1) {
-				Error("bad version\n");
+				Fail("bad version");
 			}
 		}
 		else if (strcmp( cmd, "nodes" ) == 0) {
-			Grab_Nodes( anim.nodes );
+			Grab_Nodes();
 		}
 		else if (strcmp( cmd, "skeleton" ) == 0) {
-			Grab_Animation( anim );
+			Grab_Animation();
 		}
 		else 
 		{
-			printf("unknown studio command : %s\n", cmd );
-			while (fgets( line, sizeof( line ), input ) != NULL) {
-				linecount++;
-				if (strncmp(line,"end",3)==0)
+			LogPrintf("unknown studio command : %s\n", cmd );
+			while (fgets( _line, sizeof( _line ), _input ) != NULL) {
+				_linecount++;
+				if (strncmp(_line,"end",3)==0)
 					break;
 			}
 		}
 	}
-	fclose( input );
-}
 
-void SMDFileLoader::LoadAnimation(const char* file_path, s_animation_t& anim) const
-{
-	Option_Animation(file_path, anim);
+	fclose( _input );
+	_input = nullptr;
 }
 
-void SMDSerializer::WriteAnimation(const s_animation_t& anim, const char* output_path) const
+void SMDParser::Grab_Nodes_Mapped( const char*& p, const char* end )
 {
-	FILE* fp = nullptr;
-    if (fopen_s(&fp, output_path, "w") != 0)
-        throw;
+	s_mapped_line_t l;
+	int index;
+	std::string_view name;
+	int parent;
 
-    fprintf(fp, "version %d\n", SMD_VERSION);
-    fputs("nodes\n", fp);
+	auto& nodes = _nodes;
 
-	for (int i = 0; i < anim.nodes.size(); ++i)
+	while (read_mapped_line( p, end, l ))
 	{
-		fprintf(fp, "%3d \"%s\" %d\n",
-			i,
-			anim.nodes[i].name.c_str(),
-			anim.nodes[i].parent
-		);
-	}
+		_linecount++;
 
-    fputs("end\n", fp);
-    fputs("skeleton\n", fp);
+		const char* c = l.begin;
+		if (parse_int( c, l.end, index ) && parse_quoted( c, l.end, name ) && parse_int( c, l.end, parent ))
+		{
+			if (index != nodes.size())
+				Fail( "bad node index : %.*s", static_cast<int>(mapped_line_text( l ).size()), l.begin );
+			if (parent != -1 && (parent < 0 || parent >= index))
+				Fail( "bad node parent : %.*s", static_cast<int>(mapped_line_text( l ).size()), l.begin );
 
-	for (int t = 0; t < anim.frames.size(); ++t)
-    {
-		fprintf(fp, "time %d\n", t);
-
-        for (int i = 0; i < anim.frames[t].entries.size(); ++i)
-        {
-			const auto& local_m = anim.frames[t].entries[i].local_transform;
-
-			glm::vec3 rot, pos;
-			extract_euler_angles_from_matrix(local_m, rot);
-			extract_position_from_matrix(local_m, pos);
-			make_zero_positive(pos);
-			make_zero_positive(rot);
-
-			fprintf(fp, "%3d   %f %f %f %f %f %f\n",
-				i,
-				pos[0], pos[1], pos[2],
-				rot[0], rot[1], rot[2]
-			);
-        }
-    }
+			nodes.push_back({});
 
-    fputs("end\n", fp);
-    fclose(fp);
-    fp = nullptr;
+			nodes[index].index = index;
+			nodes[index].name = name;
+			nodes[index].parent = parent;
+			if (parent != -1)
+			{
+				nodes[parent].children.push_back(index);
+			}
+		}
+		else
+		{
+			return;
+		}
+	}
+	Fail( "unexpected EOF in nodes" );
 }
 
-void SMDSerializer::WriteOBJ(const s_animation_t& anim, const char* output_path) const
+void SMDParser::Grab_Animation_Mapped( const char*& p, const char* end )
 {
-	FILE* fp = nullptr;
-	if (fopen_s(&fp, output_path, "w") != 0)
-		throw;
-
-	const auto& frame = anim.frames[0];
-
-	int num_vertices = 0;
-	int skeleton_vertex_base = 1;
-
-	// Skeleton with lines
-	fprintf(fp, "o objSkeleton\n\n");
+	s_mapped_line_t l;
+	glm::vec3 pos;
+	glm::vec3 rot;
+	std::string_view cmd;
+	int index = 0;
 
-	for (int i = 0; i < frame.entries.size(); ++i)
+	while (read_mapped_line( p, end, l ))
 	{
-		const auto& world_m = frame.entries[i].world_transform;
+		_linecount++;
 
-		glm::vec3 rot, pos;
-		extract_euler_angles_from_matrix(world_m, rot);
-		extract_position_from_matrix(world_m, pos);
+		const char* c = l.begin;
+		if (parse_int( c, l.end, index ) &&
+			parse_float( c, l.end, pos[0] ) && parse_float( c, l.end, pos[1] ) && parse_float( c, l.end, pos[2] ) &&
+			parse_float( c, l.end, rot[0] ) && parse_float( c, l.end, rot[1] ) && parse_float( c, l.end, rot[2] ))
+		{
+			clip_rotations(rot);
 
-		fprintf(fp, "v %f %f %f\n", pos[0], pos[1], pos[2]);
-		++num_vertices;
-	}
+			if (!SetBoneLocalTransform(index, pos, rot))
+				Fail( "bad bone index : %.*s", static_cast<int>(mapped_line_text( l ).size()), l.begin );
+			continue;
+		}
 
-	fprintf(fp, "\n");
+		c = l.begin;
+		if (!parse_word( c, l.end, cmd ))
+			continue; // Blank line.
 
-	for (int i = 0; i < anim.nodes.size(); ++i)
-	{
-		const auto& n = anim.nodes[i];
+		if (cmd == "time")
+		{
+			AddFrame();
+		}
+		else if (cmd == "end")
+		{
+			EndAnimation();
 
-		if (n.parent != -1)
+			return;
+		}
+		else
 		{
-			fprintf(fp, "l %d %d\n", skeleton_vertex_base + n.parent, skeleton_vertex_base + n.index);
+			Fail( "%.*s", static_cast<int>(mapped_line_text( l ).size()), l.begin );
 		}
 	}
+	Fail( "unexpected EOF in skeleton" );
+}
 
-	fprintf(fp, "\n");
-
-	// matrices axes
-
-	fprintf(fp, "o objMatrices\n\n");
-
-	const char* axis_group_name[3] = { 
-		"Forward", "Right", "Up"
-	};
+void SMDParser::Option_Animation_Mapped()
+{
+	MappedFile file;
+	if (!file.Open(_file_path.c_str()))
+		Fail("could not open file");
 
-	for (int v = 0; v < 3; ++v)
-	{
-		fprintf(fp, "g grp%s\n\n", axis_group_name[v]);
+	const char* p = file.GetData();
+	const char* end = p + file.GetSize();
 
-		int axis_vertex_base = num_vertices + 1;
+	s_mapped_line_t l;
+	std::string_view cmd;
+	int option;
 
-		for (int i = 0; i < frame.entries.size(); ++i)
-		{
-			const auto& world_m = frame.entries[i].world_transform;
-			glm::vec3 pos;
-			glm::vec3 dir = glm::normalize(glm::vec3(world_m[v]));
-			extract_position_from_matrix(world_m, pos);
+	while (read_mapped_line( p, end, l )) {
+		_linecount++;
 
-			glm::vec3 axis_end = pos + dir * 1.0f;
+		const char* c = l.begin;
+		if (!parse_word( c, l.end, cmd ))
+			continue; // Blank line.
 
-			fprintf(fp, "v %f %f %f\n", axis_end[0], axis_end[1], axis_end[2]);
-			++num_vertices;
+		if (cmd == "version") {
+			if (!parse_int( c, l.end, option ) || option != 1) {
+				Fail("bad version");
+			}
 		}
-
-		fprintf(fp, "\n");
-
-		for (int i = 0; i < frame.entries.size(); ++i)
+		else if (cmd == "nodes") {
+			Grab_Nodes_Mapped( p, end );
+		}
+		else if (cmd == "skeleton") {
+			Grab_Animation_Mapped( p, end );
+		}
+		else
 		{
-			const auto& n = anim.nodes[i];
-
-			fprintf(fp, "l %d %d\n", skeleton_vertex_base + n.index, axis_vertex_base + n.index);
+			LogPrintf("unknown studio command : %.*s\n", static_cast<int>(cmd.size()), cmd.data() );
+			while (read_mapped_line( p, end, l )) {
+				_linecount++;
+				if (l.end - l.begin >= 3 && strncmp(l.begin,"end",3)==0)
+					break;
+			}
 		}
 	}
-
-	fprintf(fp, "\n");
-
-
-	fclose(fp);
-	fp = nullptr;
 }
 
+std::string SMDLoadError::ToString() const
+{
+	char text[2048];
+	if (line > 0)
+		snprintf(text, sizeof(text), "%s(%d) : %s", file_path.c_str(), line, message.c_str());
+	else
+		snprintf(text, sizeof(text), "%s : %s", file_path.c_str(), message.c_str());
+	return text;
+}
 
-int SMDHelper::FindNodeByName(const std::vector<s_node_t>& nodes, const char* name)
+template<typename Animation>
+static bool try_load_animation(SMDLoadMode mode, const char* file_path, Animation& anim, SMDLoadError& error)
 {
-	for (int i = 0; i < nodes.size(); ++i)
+	anim = {};
+	anim.name = std::filesystem::path(file_path).filename().string();
+
+	LogPrintf("grabbing %s\n", file_path);
+
+	try
 	{
-		if (!_stricmp(nodes[i].name.c_str(), name))
+		SMDParser parser(file_path, anim);
+
+		switch (mode)
 		{
-			return i;
+		case SMDLoadMode::STREAM:
+			parser.Option_Animation();
+			break;
+		case SMDLoadMode::MEMORY_MAPPED:
+			parser.Option_Animation_Mapped();
+			break;
 		}
 	}
+	catch (const SMDLoadException& e)
+	{
+		error = e.GetError();
+		return false;
+	}
+	catch (const std::invalid_argument& e)
+	{
+		// Skeleton the parser accepted but that cannot be built, like a hierarchy with a cycle.
+		error = {};
+		error.file_path = file_path;
+		error.message = e.what();
+		return false;
+	}
 
-	return -1;
+	return true;
 }
 
-void SMDHelper::BuildAnimationWorldTransform(s_animation_t& anim)
+bool SMDFileLoader::TryLoadAnimation(const char* file_path, s_animation_t& anim, SMDLoadError& error) const
 {
-	for (int t = 0; t < anim.frames.size(); ++t)
+	if (auto memory_anim = SMDMemoryFiles::Find(file_path))
 	{
-		for (int i = 0; i < anim.nodes.size(); ++i)
-		{
-			auto& node = anim.frames[t].entries[i];
-
-			if (anim.nodes[i].parent == -1)
-			{
-				node.world_transform = node.local_transform;
-			}
-			else
-			{
-				const auto& parent_node = anim.frames[t].entries[anim.nodes[i].parent];
-				node.world_transform = parent_node.world_transform * node.local_transform;
-			}
-		}
+		LogPrintf("grabbing %s (memory)\n", file_path);
+		anim = *memory_anim;
+		return true;
 	}
-}
 
+	if (_archive && _archive->TryLoadAnimation(file_path, anim))
+		return true;
 
-void SMDHelper::UpdateBoneHierarchyLocalTransformFromWorldTransform(s_animation_t& anim, int bone, int frame)
+	if (!_cache.IsEnabled())
+		return try_load_animation(_mode, file_path, anim, error);
+
+	SMDAnimationCache::SourceVersion version;
+	if (_cache.TryLoad(file_path, anim, version))
+		return true;
+
+	if (!try_load_animation(_mode, file_path, anim, error))
+		return false;
+
+	if (!version.path.empty())
+		_cache.Store(version, anim);
+	return true;
+}
+
+bool SMDFileLoader::TryLoadAnimation(const char* file_path, s_compact_animation_t& anim, SMDLoadError& error) const
+{
+	if (auto memory_anim = SMDMemoryFiles::Find(file_path))
+	{
+		LogPrintf("grabbing %s (memory)\n", file_path);
+		SMDHelper::CompactAnimation(*memory_anim, anim);
+		return true;
+	}
+
+	return try_load_animation(_mode, file_path, anim, error);
+}
+
+void SMDFileLoader::LoadAnimation(const char* file_path, s_animation_t& anim) const
+{
+	SMDLoadError error;
+	if (!TryLoadAnimation(file_path, anim, error))
+		throw SMDLoadException(error);
+}
+
+void SMDFileLoader::LoadAnimation(const char* file_path, s_compact_animation_t& anim) const
+{
+	SMDLoadError error;
+	if (!TryLoadAnimation(file_path, anim, error))
+		throw SMDLoadException(error);
+}
+
+//
+// SMDWriter
+//
+// Formats the whole file in memory, so it can be compared with the existing
+// file and written in one block instead of one fprintf per line. Numbers are
+// formatted with std::to_chars, which does not depend on the current locale.
+// The fixed format gives the same text as %f.
+//
+
+class SMDWriter
+{
+public:
+	SMDWriter(SMDFloatFormat float_format) : _float_format(float_format)
+	{
+		_data.reserve(INITIAL_SIZE);
+	}
+
+	SMDWriter(const SMDWriter&) = delete;
+	SMDWriter& operator=(const SMDWriter&) = delete;
+
+	void Write(std::string_view text)
+	{
+		_data.append(text);
+	}
+
+	// Right aligned on width characters, like %3d.
+	void WriteInt(int value, int width = 0)
+	{
+		char digits[16];
+		const int length = static_cast<int>(std::to_chars(digits, digits + sizeof(digits), value).ptr - digits);
+
+		if (length < width)
+			_data.append(width - length, ' ');
+
+		_data.append(digits, length);
+	}
+
+	void WriteFloat(float value)
+	{
+		// Longest float in fixed notation, FLT_MAX has 39 digits before the point.
+		char text[64];
+
+		const auto result = _float_format == SMDFloatFormat::FIXED ?
+			std::to_chars(text, text + sizeof(text), value, std::chars_format::fixed, 6) :
+			std::to_chars(text, text + sizeof(text), value, std::chars_format::fixed);
+
+		_data.append(text, result.ptr - text);
+	}
+
+	const std::string& GetData() const { return _data; }
+
+private:
+	static constexpr size_t INITIAL_SIZE = 256 * 1024;
+
+	SMDFloatFormat _float_format;
+	std::string _data;
+};
+
+// Returns true if the file exists and has exactly this content. The file is
+// read in text mode, like it was written, and compared block after block.
+static bool file_has_content(const char* file_path, std::string_view data)
+{
+	FILE* fp = nullptr;
+	if (fopen_s(&fp, file_path, "r") != 0)
+		return false;
+
+	std::vector<char> buffer(64 * 1024);
+	size_t offset = 0;
+	bool same = true;
+
+	while (same)
+	{
+		const size_t size = fread(buffer.data(), 1, buffer.size(), fp);
+		if (size == 0)
+			break;
+
+		same = size <= data.size() - offset && memcmp(buffer.data(), data.data() + offset, size) == 0;
+		offset += size;
+	}
+
+	fclose(fp);
+
+	return same && offset == data.size();
+}
+
+SMDWriteResult SMDSerializer::WriteFile(const char* output_path, std::string_view data) const
+{
+	if (_skip_unchanged_files && file_has_content(output_path, data))
+		return SMDWriteResult::UNCHANGED;
+
+	FILE* fp = nullptr;
+	if (fopen_s(&fp, output_path, "w") != 0)
+		throw std::runtime_error(std::string("cannot write ") + output_path);
+
+	fwrite(data.data(), 1, data.size(), fp);
+
+	fclose(fp);
+	fp = nullptr;
+
+	return SMDWriteResult::WRITTEN;
+}
+
+static void write_smd_nodes(SMDWriter& writer, const std::vector<s_node_t>& nodes)
+{
+	writer.Write("version ");
+	writer.WriteInt(SMD_VERSION);
+	writer.Write("\nnodes\n");
+
+	for (int i = 0; i < nodes.size(); ++i)
+	{
+		writer.WriteInt(i, 3);
+		writer.Write(" \"");
+		writer.Write(nodes[i].name);
+		writer.Write("\" ");
+		writer.WriteInt(nodes[i].parent);
+		writer.Write("\n");
+	}
+
+	writer.Write("end\n");
+}
+
+static void write_smd_bone(SMDWriter& writer, int bone, glm::vec3 pos, glm::vec3 rot)
+{
+	make_zero_positive(pos);
+	make_zero_positive(rot);
+
+	writer.WriteInt(bone, 3);
+	writer.Write("   ");
+
+	for (int i = 0; i < 3; ++i)
+	{
+		writer.WriteFloat(pos[i]);
+		writer.Write(" ");
+	}
+
+	for (int i = 0; i < 3; ++i)
+	{
+		writer.WriteFloat(rot[i]);
+		writer.Write(i < 2 ? " " : "\n");
+	}
+}
+
+SMDWriteResult SMDSerializer::WriteAnimation(const s_animation_t& anim, const char* output_path) const
+{
+	const SMDOutputMode output_mode = _output_mode;
+	if (output_mode != SMDOutputMode::DISK)
+	{
+		SMDMemoryFiles::Store(output_path, anim);
+		if (output_mode == SMDOutputMode::MEMORY)
+			return SMDWriteResult::WRITTEN;
+	}
+	else
+	{
+		// The file on disk replaces the one an earlier stage kept in memory.
+		SMDMemoryFiles::Remove(output_path);
+	}
+
+	SMDWriter writer(_float_format);
+
+	write_smd_nodes(writer, anim.nodes);
+
+	writer.Write("skeleton\n");
+
+	std::vector<glm::vec3> angles(anim.nodes.size());
+	std::vector<glm::vec3> positions(anim.nodes.size());
+
+	for (int t = 0; t < anim.frames.size(); ++t)
+	{
+		writer.Write("time ");
+		writer.WriteInt(t);
+		writer.Write("\n");
+
+		auto&& frame = anim.frames[t];
+		LocalTransformsToEulerAngles(frame.entries.data(), static_cast<int>(frame.entries.size()), angles.data(), positions.data());
+
+		for (int i = 0; i < frame.entries.size(); ++i)
+			write_smd_bone(writer, i, positions[i], angles[i]);
+	}
+
+	writer.Write("end\n");
+
+	return WriteFile(output_path, writer.GetData());
+}
+
+SMDWriteResult SMDSerializer::WriteAnimation(const s_compact_animation_t& anim, const char* output_path) const
+{
+	const SMDOutputMode output_mode = _output_mode;
+	if (output_mode != SMDOutputMode::DISK)
+	{
+		s_animation_t expanded;
+		SMDHelper::ExpandAnimation(anim, expanded);
+		SMDMemoryFiles::Store(output_path, expanded);
+		if (output_mode == SMDOutputMode::MEMORY)
+			return SMDWriteResult::WRITTEN;
+	}
+	else
+	{
+		SMDMemoryFiles::Remove(output_path);
+	}
+
+	SMDWriter writer(_float_format);
+
+	write_smd_nodes(writer, anim.nodes);
+
+	writer.Write("skeleton\n");
+
+	for (int t = 0; t < anim.GetFrameCount(); ++t)
+	{
+		writer.Write("time ");
+		writer.WriteInt(t);
+		writer.Write("\n");
+
+		for (int i = 0; i < anim.GetBoneCount(); ++i)
+		{
+			const auto& pose = anim.GetLocalPose(i, t);
+			write_smd_bone(writer, i, pose.translation, pose.GetEulerAngles());
+		}
+	}
+
+	writer.Write("end\n");
+
+	return WriteFile(output_path, writer.GetData());
+}
+
+void SMDSerializer::WriteOBJ(const s_animation_t& anim, const char* output_path) const
+{
+	SMDHelper::EnsureWorldTransforms(anim);
+
+	FILE* fp = nullptr;
+	if (fopen_s(&fp, output_path, "w") != 0)
+		throw std::runtime_error(std::string("cannot write ") + output_path);
+
+	const auto& frame = anim.frames[0];
+
+	int num_vertices = 0;
+	int skeleton_vertex_base = 1;
+
+	// Skeleton with lines
+	fprintf(fp, "o objSkeleton\n\n");
+
+	for (int i = 0; i < frame.entries.size(); ++i)
+	{
+		const auto& world_m = frame.entries[i].world_transform;
+
+		glm::vec3 rot, pos;
+		extract_euler_angles_from_matrix(world_m, rot);
+		extract_position_from_matrix(world_m, pos);
+
+		fprintf(fp, "v %f %f %f\n", pos[0], pos[1], pos[2]);
+		++num_vertices;
+	}
+
+	fprintf(fp, "\n");
+
+	for (int i = 0; i < anim.nodes.size(); ++i)
+	{
+		const auto& n = anim.nodes[i];
+
+		if (n.parent != -1)
+		{
+			fprintf(fp, "l %d %d\n", skeleton_vertex_base + n.parent, skeleton_vertex_base + n.index);
+		}
+	}
+
+	fprintf(fp, "\n");
+
+	// matrices axes
+
+	fprintf(fp, "o objMatrices\n\n");
+
+	const char* axis_group_name[3] = { 
+		"Forward", "Right", "Up"
+	};
+
+	for (int v = 0; v < 3; ++v)
+	{
+		fprintf(fp, "g grp%s\n\n", axis_group_name[v]);
+
+		int axis_vertex_base = num_vertices + 1;
+
+		for (int i = 0; i < frame.entries.size(); ++i)
+		{
+			const auto& world_m = frame.entries[i].world_transform;
+			glm::vec3 pos;
+			glm::vec3 dir = glm::normalize(glm::vec3(world_m[v]));
+			extract_position_from_matrix(world_m, pos);
+
+			glm::vec3 axis_end = pos + dir * 1.0f;
+
+			fprintf(fp, "v %f %f %f\n", axis_end[0], axis_end[1], axis_end[2]);
+			++num_vertices;
+		}
+
+		fprintf(fp, "\n");
+
+		for (int i = 0; i < frame.entries.size(); ++i)
+		{
+			const auto& n = anim.nodes[i];
+
+			fprintf(fp, "l %d %d\n", skeleton_vertex_base + n.index, axis_vertex_base + n.index);
+		}
+	}
+
+	fprintf(fp, "\n");
+
+
+	fclose(fp);
+	fp = nullptr;
+}
+
+
+#if SMD_FLAT_FRAME_STORAGE
+
+void s_animation_frames_t::Resize(size_t num_frames, size_t num_bones)
+{
+	_num_frames = num_frames;
+	_num_bones = num_bones;
+	_entries.assign(num_frames * num_bones, {});
+}
+
+void s_animation_frames_t::AddFrame(size_t num_bones)
+{
+	if (_num_frames == 0)
+		_num_bones = num_bones;
+	else if (num_bones != _num_bones)
+		throw std::invalid_argument("frames must have the same bone count");
+
+	_entries.resize(_entries.size() + num_bones);
+	++_num_frames;
+}
+
+void s_animation_frames_t::RemapBones(const std::vector<int>& new_to_old)
+{
+	const size_t new_num_bones = new_to_old.size();
+
+	// Removing bones without reordering the others can be done in place,
+	// every entry moves to a lower or equal position in the buffer.
+	bool compact_in_place = new_num_bones <= _num_bones;
+	for (size_t i = 0; compact_in_place && i < new_num_bones; ++i)
+	{
+		compact_in_place = new_to_old[i] != -1 && (i == 0 || new_to_old[i] > new_to_old[i - 1]);
+	}
+
+	if (compact_in_place)
+	{
+		for (size_t t = 0; t < _num_frames; ++t)
+		{
+			const size_t old_frame = t * _num_bones;
+			const size_t new_frame = t * new_num_bones;
+
+			for (size_t i = 0; i < new_num_bones; ++i)
+				_entries[new_frame + i] = _entries[old_frame + new_to_old[i]];
+		}
+
+		_entries.resize(_num_frames * new_num_bones);
+		_num_bones = new_num_bones;
+		return;
+	}
+
+	std::vector<s_animation_frame_entry_t> new_entries(_num_frames * new_num_bones);
+
+	for (size_t t = 0; t < _num_frames; ++t)
+	{
+		const auto* old_frame = &_entries[t * _num_bones];
+		auto* new_frame = &new_entries[t * new_num_bones];
+
+		for (size_t i = 0; i < new_num_bones; ++i)
+		{
+			if (new_to_old[i] != -1)
+				new_frame[i] = old_frame[new_to_old[i]];
+		}
+	}
+
+	_entries = std::move(new_entries);
+	_num_bones = new_num_bones;
+}
+
+#else
+
+void s_animation_frames_t::Resize(size_t num_frames, size_t num_bones)
+{
+	_num_bones = num_bones;
+	_frames.assign(num_frames, {});
+	for (auto& frame : _frames)
+		frame.entries.resize(num_bones);
+}
+
+void s_animation_frames_t::AddFrame(size_t num_bones)
+{
+	if (_frames.empty())
+		_num_bones = num_bones;
+	else if (num_bones != _num_bones)
+		throw std::invalid_argument("frames must have the same bone count");
+
+	_frames.push_back({});
+	_frames.back().entries.resize(num_bones);
+}
+
+void s_animation_frames_t::RemapBones(const std::vector<int>& new_to_old)
+{
+	for (auto& frame : _frames)
+	{
+		std::vector<s_animation_frame_entry_t> new_entries(new_to_old.size());
+
+		for (size_t i = 0; i < new_to_old.size(); ++i)
+		{
+			if (new_to_old[i] != -1)
+				new_entries[i] = frame.entries[new_to_old[i]];
+		}
+
+		frame.entries = std::move(new_entries);
+	}
+
+	_num_bones = new_to_old.size();
+}
+
+#endif
+
+s_bonepose_t s_bonepose_t::FromEulerAngles(const glm::vec3& angles, const glm::vec3& translation)
+{
+	// glm builds the quaternion of Z * Y * X in closed form.
+	return s_bonepose_t(glm::quat(angles), translation);
+}
+
+s_bonepose_t s_bonepose_t::FromMatrix(const glm::mat4& m)
+{
+	const float scale = glm::length(glm::vec3(m[0]));
+	return s_bonepose_t(glm::quat_cast(glm::mat3(m) * (1.0f / scale)), m[3], scale);
+}
+
+glm::mat4 s_bonepose_t::ToMatrix() const
+{
+	glm::mat4 m = glm::mat4_cast(rotation);
+	m[0] *= scale;
+	m[1] *= scale;
+	m[2] *= scale;
+	m[3] = glm::vec4(translation, 1.0f);
+	return m;
+}
+
+glm::vec3 s_bonepose_t::GetEulerAngles() const
+{
+	glm::vec3 angles;
+	extract_euler_angles_from_matrix(glm::mat4_cast(rotation), angles);
+	return angles;
+}
+
+int SMDHelper::FindNodeByName(const std::vector<s_node_t>& nodes, const char* name)
+{
+	for (int i = 0; i < nodes.size(); ++i)
+	{
+		if (!_stricmp(nodes[i].name.c_str(), name))
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+int SMDHelper::FindNodeByName(const s_animation_t& anim, const char* name)
+{
+	return GetSkeleton(anim).FindBone(name);
+}
+
+int SMDBoneBinding::AddName(const char* name)
+{
+	_names.push_back(name);
+	return static_cast<int>(_names.size()) - 1;
+}
+
+const std::vector<int>& SMDBoneBinding::Bind(const s_animation_t& anim) const
+{
+	const auto& skeleton = SMDHelper::GetSkeleton(anim);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto it = _bindings.find(skeleton.GetSignature());
+	if (it == _bindings.end())
+	{
+		std::vector<int> bones(_names.size());
+		for (int i = 0; i < _names.size(); ++i)
+			bones[i] = skeleton.FindBone(_names[i]);
+
+		it = _bindings.emplace(skeleton.GetSignature(), std::move(bones)).first;
+	}
+
+	const auto& bones = it->second;
+
+	std::string missing;
+	for (int i = 0; i < bones.size(); ++i)
+	{
+		if (bones[i] == -1)
+			missing += (missing.empty() ? "" : ", ") + _names[i];
+	}
+
+	if (!missing.empty())
+		throw std::invalid_argument("no bone named " + missing + " in " + anim.name);
+
+	return bones;
+}
+
+size_t s_bone_name_hash_t::operator()(std::string_view name) const
+{
+	// FNV-1a over the lower case name.
+	size_t hash = 14695981039346656037ull;
+	for (char c : name)
+	{
+		hash ^= static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(c)));
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+bool s_bone_name_equal_t::operator()(std::string_view a, std::string_view b) const
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+			return false;
+	}
+
+	return true;
+}
+
+void s_skeleton_t::Build(const std::vector<s_node_t>& nodes)
+{
+	const int num_bones = static_cast<int>(nodes.size());
+
+	_parents.resize(num_bones);
+	for (int i = 0; i < num_bones; ++i)
+	{
+		const int parent = nodes[i].parent;
+		_parents[i] = parent >= 0 && parent < num_bones ? parent : -1;
+	}
+
+	// Children, grouped by parent.
+	_child_offsets.assign(num_bones + 1, 0);
+	for (int i = 0; i < num_bones; ++i)
+	{
+		if (_parents[i] != -1)
+			++_child_offsets[_parents[i] + 1];
+	}
+
+	for (int i = 0; i < num_bones; ++i)
+		_child_offsets[i + 1] += _child_offsets[i];
+
+	_children.resize(_child_offsets[num_bones]);
+
+	std::vector<int> next_child(_child_offsets.begin(), _child_offsets.end() - 1);
+	for (int i = 0; i < num_bones; ++i)
+	{
+		if (_parents[i] != -1)
+			_children[next_child[_parents[i]]++] = i;
+	}
+
+	// Depth first order, starting from each root.
+	_order.clear();
+	_order.reserve(num_bones);
+	_order_parents.clear();
+	_order_parents.reserve(num_bones);
+	_order_index.assign(num_bones, -1);
+
+	std::vector<int> stack;
+	for (int root = num_bones - 1; root >= 0; --root)
+	{
+		if (_parents[root] == -1)
+			stack.push_back(root);
+	}
+
+	while (!stack.empty())
+	{
+		const int bone = stack.back();
+		stack.pop_back();
+
+		_order_index[bone] = static_cast<int>(_order.size());
+		_order.push_back(bone);
+		_order_parents.push_back(_parents[bone] == -1 ? -1 : _order_index[_parents[bone]]);
+
+		const auto children = GetChildren(bone);
+		for (int c = children.size() - 1; c >= 0; --c)
+			stack.push_back(children[c]);
+	}
+
+	if (_order.size() != num_bones)
+		throw std::invalid_argument("bone hierarchy has a cycle");
+
+	// Subtree sizes, children before their parents.
+	_subtree_sizes.assign(num_bones, 1);
+	for (int k = num_bones - 1; k >= 0; --k)
+	{
+		const int bone = _order[k];
+		if (_parents[bone] != -1)
+			_subtree_sizes[_parents[bone]] += _subtree_sizes[bone];
+	}
+
+	UpdateNames(nodes);
+}
+
+void s_skeleton_t::UpdateNames(const std::vector<s_node_t>& nodes)
+{
+	_names.clear();
+	_names.reserve(nodes.size());
+
+	// Keep the first bone of duplicated names, like a linear search would.
+	for (int i = 0; i < nodes.size(); ++i)
+		_names.emplace(nodes[i].name, i);
+
+	// Names are hashed like the name index, so skeletons only told apart by
+	// the case of their names bind names the same way.
+	const s_bone_name_hash_t hash_name;
+	_signature = 14695981039346656037ull;
+	auto add = [this](uint64_t value) {
+		_signature ^= value;
+		_signature *= 1099511628211ull;
+	};
+
+	add(_parents.size());
+	for (int i = 0; i < _parents.size(); ++i)
+	{
+		add(hash_name(nodes[i].name));
+		add(static_cast<uint64_t>(_parents[i]));
+	}
+}
+
+void SMDHelper::UpdateSkeleton(s_animation_t& anim)
+{
+	anim.skeleton.Build(anim.nodes);
+}
+
+const s_skeleton_t& SMDHelper::GetSkeleton(const s_animation_t& anim)
+{
+	// The skeleton is derived from the nodes, like the world transforms.
+	if (anim.skeleton.GetBoneCount() != anim.nodes.size())
+		UpdateSkeleton(const_cast<s_animation_t&>(anim));
+
+	return anim.skeleton;
+}
+
+static thread_local ThreadPool* s_thread_pool = nullptr;
+
+// Bone transforms below which a range of frames is not worth a task, a few hundred microseconds.
+static constexpr size_t MIN_FRAME_RANGE_WORK = 16384;
+
+// Ranges per worker, so a slow worker does not hold back the others.
+static constexpr int FRAME_RANGES_PER_WORKER = 4;
+
+void SMDHelper::SetThreadPool(ThreadPool* pool)
+{
+	s_thread_pool = pool;
+}
+
+ThreadPool* SMDHelper::GetThreadPool()
+{
+	return s_thread_pool;
+}
+
+void SMDHelper::ForEachFrameRange(const s_animation_t& anim, size_t work_per_frame,
+	const std::function<void(int begin, int end)>& fn)
+{
+	const int num_frames = static_cast<int>(anim.frames.size());
+	if (num_frames == 0)
+		return;
+
+	// Build the skeleton now if needed, the ranges only read it.
+	GetSkeleton(anim);
+
+	const int min_frames = static_cast<int>(std::max<size_t>(1, MIN_FRAME_RANGE_WORK / std::max<size_t>(1, work_per_frame)));
+
+	if (!s_thread_pool || s_thread_pool->GetWorkerCount() < 2 || num_frames < 2 * min_frames)
+	{
+		fn(0, num_frames);
+		return;
+	}
+
+	const int max_ranges = s_thread_pool->GetWorkerCount() * FRAME_RANGES_PER_WORKER;
+	const int grain = std::max(min_frames, (num_frames + max_ranges - 1) / max_ranges);
+
+	s_thread_pool->ParallelFor(num_frames, grain, fn);
+}
+
+// World transform of each bone in the range, from their parent world transform.
+// Parents must come before their children in the range, or be up to date.
+template<typename Entries>
+inline void update_world_transforms(const std::vector<s_node_t>& nodes, Entries& entries, s_bone_range_t bones)
+{
+	BuildWorldTransforms(entries.data(), nodes.data(), bones.begin(), bones.size());
+}
+
+void SMDHelper::BuildAnimationWorldTransform(s_animation_t& anim)
+{
+	anim.dirty_bones.clear();
+
+	const auto bones = GetSkeleton(anim).GetOrder();
+
+	ForEachFrameRange(anim, bones.size(), [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			auto&& frame = anim.frames[t];
+			update_world_transforms(anim.nodes, frame.entries, bones);
+		}
+	});
+}
+
+void SMDHelper::MarkBoneDirty(s_animation_t& anim, int bone)
+{
+	if (anim.dirty_bones.empty())
+		anim.dirty_bones.resize(anim.nodes.size(), false);
+
+	anim.dirty_bones[bone] = true;
+}
+
+void SMDHelper::MarkAllBonesDirty(s_animation_t& anim)
+{
+	anim.dirty_bones.assign(anim.nodes.size(), true);
+}
+
+bool SMDHelper::HasDirtyBones(const s_animation_t& anim)
+{
+	return !anim.dirty_bones.empty();
+}
+
+void SMDHelper::UpdateWorldTransforms(s_animation_t& anim)
+{
+	if (anim.dirty_bones.empty())
+		return;
+
+	const auto& skeleton = GetSkeleton(anim);
+	const auto order = skeleton.GetOrder();
+	const auto& order_parents = skeleton.GetOrderParents();
+
+	// Collect the dirty bones and their children, parents first.
+	std::vector<bool> stale(order.size());
+	std::vector<int> stale_bones;
+	stale_bones.reserve(order.size());
+
+	for (int k = 0; k < order.size(); ++k)
+	{
+		stale[k] = anim.dirty_bones[order[k]] || (order_parents[k] != -1 && stale[order_parents[k]]);
+		if (stale[k])
+			stale_bones.push_back(order[k]);
+	}
+
+	const s_bone_range_t bones(stale_bones.data(), static_cast<int>(stale_bones.size()));
+
+	ForEachFrameRange(anim, bones.size(), [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			auto&& frame = anim.frames[t];
+			update_world_transforms(anim.nodes, frame.entries, bones);
+		}
+	});
+
+	anim.dirty_bones.clear();
+}
+
+void SMDHelper::EnsureWorldTransforms(const s_animation_t& anim)
 {
-	//printf("Computing bone %d local transform\n", bone);
+	if (!anim.dirty_bones.empty())
+		UpdateWorldTransforms(const_cast<s_animation_t&>(anim));
+}
 
-	auto& node = anim.frames[frame].entries[bone];
+void SMDHelper::UpdateBoneHierarchyLocalTransformFromWorldTransform(s_animation_t& anim, int bone, int frame)
+{
+	auto&& frame_entries = anim.frames[frame];
+	auto& entries = frame_entries.entries;
 
-	if (anim.nodes[bone].parent == -1)
+	for (int i : GetSkeleton(anim).GetSubtree(bone))
 	{
-		node.local_transform = node.world_transform;
-	}
-	else
-	{
-		const auto& parent_node = anim.frames[frame].entries[anim.nodes[bone].parent];
-		node.local_transform = glm::inverse(parent_node.world_transform) * node.world_transform;
-	}
+		auto& node = entries[i];
 
-	for(auto& child : anim.nodes[bone].children)
-		UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, child, frame);
+		if (anim.nodes[i].parent == -1)
+		{
+			node.local_transform = node.world_transform;
+		}
+		else
+		{
+			const auto& parent_node = entries[anim.nodes[i].parent];
+			node.local_transform = local_from_world(parent_node.world_transform, node.world_transform);
+		}
+	}
 }
 
 void SMDHelper::UpdateBoneHierarchyLocalTransformFromWorldTransform(s_animation_t& anim, int bone)
 {
-	for (int t = 0; t < anim.frames.size(); ++t)
-		UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, bone, t);
+	UpdateWorldTransforms(anim);
+
+	ForEachFrameRange(anim, GetSkeleton(anim).GetSubtreeSize(bone), [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+			UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, bone, t);
+	});
 }
 
 void SMDHelper::UpdateBoneHierarchyWorldTransformFromLocalTransform(s_animation_t& anim, int bone, int frame)
 {
-	//printf("Computing bone %d local transform\n", bone);
+	auto&& frame_entries = anim.frames[frame];
+	update_world_transforms(anim.nodes, frame_entries.entries, GetSkeleton(anim).GetSubtree(bone));
+}
+
+void SMDHelper::UpdateBoneHierarchyWorldTransformFromLocalTransform(s_animation_t& anim, int bone)
+{
+	UpdateWorldTransforms(anim);
+
+	const auto bones = GetSkeleton(anim).GetSubtree(bone);
+
+	ForEachFrameRange(anim, bones.size(), [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			auto&& frame = anim.frames[t];
+			update_world_transforms(anim.nodes, frame.entries, bones);
+		}
+	});
+}
+
+// Moves of a bone in a single frame, shared by the SMDHelper functions and ApplyBoneTransformEdit.
+// The world space moves expect the world transforms of the frame to be up to date.
+
+inline glm::mat4 rotate_local_matrix(const glm::mat4& local_matrix, const glm::vec3& angles)
+{
+	glm::mat4 r_x = glm::rotate(glm::identity<glm::mat4>(), angles[0], glm::normalize(glm::vec3(local_matrix[0])));
+	glm::mat4 r_y = glm::rotate(glm::identity<glm::mat4>(), angles[1], glm::normalize(glm::vec3(local_matrix[1])));
+	glm::mat4 r_z = glm::rotate(glm::identity<glm::mat4>(), angles[2], glm::normalize(glm::vec3(local_matrix[2])));
+	glm::mat4 rotated_local_matrix = r_z * r_y * r_x * local_matrix;
+	rotated_local_matrix[3] = glm::vec4(glm::vec3(local_matrix[3]), 1.0f);
+
+	return rotated_local_matrix;
+}
+
+inline void rotate_bone_in_world_space_relative(s_animation_t& anim, int bone, int frame, const glm::vec3& angles)
+{
+	const auto& node = anim.nodes[bone];
+	auto& frame_entry = anim.frames[frame].entries[bone];
 
-	auto& node = anim.frames[frame].entries[bone];
+	glm::mat4 local_matrix;
 
-	if (anim.nodes[bone].parent == -1)
+	if (node.parent == -1)
 	{
-		node.world_transform = node.local_transform;
+		local_matrix = frame_entry.world_transform;
 	}
 	else
 	{
-		const auto& parent_node = anim.frames[frame].entries[anim.nodes[bone].parent];
-		node.world_transform = parent_node.world_transform * node.local_transform;
+		const auto& frame_parent_node = anim.frames[frame].entries[node.parent];
+		local_matrix = local_from_world(frame_parent_node.world_transform, frame_entry.world_transform);
 	}
 
-	for (auto& child : anim.nodes[bone].children)
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, child, frame);
+	glm::mat4 rotated_local_matrix = rotate_local_matrix(local_matrix, angles);
+
+	if (node.parent == -1)
+	{
+		frame_entry.world_transform = rotated_local_matrix;
+	}
+	else
+	{
+		// Set new worldspace bone matrix.
+		const auto& frame_parent_node = anim.frames[frame].entries[node.parent];
+		frame_entry.world_transform = world_from_local(frame_parent_node.world_transform, rotated_local_matrix);
+	}
+
+	SMDHelper::UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, bone, frame);
 }
 
-void SMDHelper::UpdateBoneHierarchyWorldTransformFromLocalTransform(s_animation_t& anim, int bone)
+inline void rotate_bone_in_local_space_relative(s_animation_t& anim, int bone, int frame, const glm::vec3& angles)
 {
-	for (int t = 0; t < anim.frames.size(); ++t)
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, bone, t);
+	auto& frame_entry = anim.frames[frame].entries[bone];
+
+	frame_entry.local_transform = rotate_local_matrix(frame_entry.local_transform, angles);
 }
 
-void SMDHelper::RotateBoneInWorldSpaceRelative(s_animation_t& anim, int bone, const glm::vec3& angles)
+inline void translate_bone_in_world_space(s_animation_t& anim, int bone, int frame, const glm::vec3& translation)
 {
-	auto& node = anim.nodes[bone];
+	auto& frame_entry = anim.frames[frame].entries[bone];
 
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame_entry = anim.frames[t].entries[bone];
+	frame_entry.world_transform[3] += glm::vec4(translation, 0.0f);
 
-		glm::mat4 local_matrix;
+	SMDHelper::UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, bone, frame);
+}
 
-		if (node.parent == -1)
-		{
-			local_matrix = frame_entry.world_transform;
-		}
-		else
-		{
-			const auto& frame_parent_node = anim.frames[t].entries[node.parent];
-			local_matrix = glm::inverse(frame_parent_node.world_transform) * frame_entry.world_transform;
-		}
+inline void translate_bone_in_world_space_relative(s_animation_t& anim, int bone, int frame, const glm::vec3& translation)
+{
+	auto& frame_entry = anim.frames[frame].entries[bone];
 
-		glm::mat4 r_x = glm::rotate(glm::identity<glm::mat4>(), angles[0], glm::normalize(glm::vec3(local_matrix[0])));
-		glm::mat4 r_y = glm::rotate(glm::identity<glm::mat4>(), angles[1], glm::normalize(glm::vec3(local_matrix[1])));
-		glm::mat4 r_z = glm::rotate(glm::identity<glm::mat4>(), angles[2], glm::normalize(glm::vec3(local_matrix[2])));
-		glm::mat4 rotated_local_matrix = r_z * r_y * r_x * local_matrix;
-		rotated_local_matrix[3] = glm::vec4(glm::vec3(local_matrix[3]), 1.0f);
+	for (int v = 0; v < 3; ++v)
+		frame_entry.world_transform[3] += frame_entry.world_transform[v] * translation[v];
 
-		if (node.parent == -1)
-		{
-			frame_entry.world_transform = rotated_local_matrix;
-		}
-		else
-		{
-			// Set new worldspace bone matrix.
-			const auto& frame_parent_node = anim.frames[t].entries[node.parent];
-			frame_entry.world_transform = frame_parent_node.world_transform * rotated_local_matrix;
-		}
+	SMDHelper::UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, bone, frame);
+}
 
-		UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, bone, t);
-	}
+inline void translate_bone_in_local_space(s_animation_t& anim, int bone, int frame, const glm::vec3& translation)
+{
+	auto& frame_entry = anim.frames[frame].entries[bone];
+
+	frame_entry.local_transform[3] += glm::vec4(translation, 0.0f);
 }
 
-void SMDHelper::RotateBoneInLocalSpaceRelative(s_animation_t& anim, int bone, const glm::vec3& angles)
+inline void translate_bone_in_local_space_relative(s_animation_t& anim, int bone, int frame, const glm::vec3& translation)
 {
-	auto& node = anim.nodes[bone];
+	auto& frame_entry = anim.frames[frame].entries[bone];
 
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame_entry = anim.frames[t].entries[bone];
+	for (int v = 0; v < 3; ++v)
+		frame_entry.local_transform[3] += frame_entry.local_transform[v] * translation[v];
+}
 
-		const glm::mat4& local_matrix = frame_entry.local_transform;
+void SMDHelper::RotateBoneInWorldSpaceRelative(s_animation_t& anim, int bone, const glm::vec3& angles)
+{
+	UpdateWorldTransforms(anim);
 
-		glm::mat4 r_x = glm::rotate(glm::identity<glm::mat4>(), angles[0], glm::normalize(glm::vec3(local_matrix[0])));
-		glm::mat4 r_y = glm::rotate(glm::identity<glm::mat4>(), angles[1], glm::normalize(glm::vec3(local_matrix[1])));
-		glm::mat4 r_z = glm::rotate(glm::identity<glm::mat4>(), angles[2], glm::normalize(glm::vec3(local_matrix[2])));
-		glm::mat4 rotated_local_matrix = r_z * r_y * r_x * local_matrix;
-		rotated_local_matrix[3] = glm::vec4(glm::vec3(local_matrix[3]), 1.0f);
+	const int subtree_size = GetSkeleton(anim).GetSubtreeSize(bone);
 
-		frame_entry.local_transform = rotated_local_matrix;
+	ForEachFrameRange(anim, subtree_size, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+			rotate_bone_in_world_space_relative(anim, bone, t, angles);
+	});
+}
 
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, bone, t);
-	}
+void SMDHelper::RotateBoneInLocalSpaceRelative(s_animation_t& anim, int bone, const glm::vec3& angles)
+{
+	ForEachFrameRange(anim, 4, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+			rotate_bone_in_local_space_relative(anim, bone, t, angles);
+	});
+
+	MarkBoneDirty(anim, bone);
 }
 
 void SMDHelper::TranslateBoneInWorldSpace(s_animation_t& anim, int bone, const glm::vec3& translation)
 {
-	auto& node = anim.nodes[bone];
-
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame_entry = anim.frames[t].entries[bone];
+	UpdateWorldTransforms(anim);
 
-		frame_entry.world_transform[3] += glm::vec4(translation, 0.0f);
+	const int subtree_size = GetSkeleton(anim).GetSubtreeSize(bone);
 
-		UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, bone, t);
-	}
+	ForEachFrameRange(anim, subtree_size, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+			translate_bone_in_world_space(anim, bone, t, translation);
+	});
 }
 
 void SMDHelper::TranslateBoneInWorldSpaceRelative(s_animation_t& anim, int bone, const glm::vec3& translation)
 {
-	auto& node = anim.nodes[bone];
-
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame_entry = anim.frames[t].entries[bone];
+	UpdateWorldTransforms(anim);
 
-		for (int v = 0; v < 3; ++v)
-			frame_entry.world_transform[3] += frame_entry.world_transform[v] * translation[v];
+	const int subtree_size = GetSkeleton(anim).GetSubtreeSize(bone);
 
-		UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, bone, t);
-	}
+	ForEachFrameRange(anim, subtree_size, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+			translate_bone_in_world_space_relative(anim, bone, t, translation);
+	});
 }
 
 void SMDHelper::TranslateBoneInLocalSpace(s_animation_t& anim, int bone, const glm::vec3& translation)
 {
-	auto& node = anim.nodes[bone];
-
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame_entry = anim.frames[t].entries[bone];
-
-		frame_entry.local_transform[3] += glm::vec4(translation, 0.0f);
+	ForEachFrameRange(anim, 1, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+			translate_bone_in_local_space(anim, bone, t, translation);
+	});
 
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, bone, t);
-	}
+	MarkBoneDirty(anim, bone);
 }
 
 void SMDHelper::TranslateBoneInLocalSpaceRelative(s_animation_t& anim, int bone, const glm::vec3& translation)
 {
-	auto& node = anim.nodes[bone];
-
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame_entry = anim.frames[t].entries[bone];
+	ForEachFrameRange(anim, 1, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+			translate_bone_in_local_space_relative(anim, bone, t, translation);
+	});
 
-		for (int v = 0; v < 3; ++v)
-			frame_entry.local_transform[3] += frame_entry.local_transform[v] * translation[v];
-
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, bone, t);
-	}
+	MarkBoneDirty(anim, bone);
 }
 
 glm::vec3 SMDHelper::GetBonePositionInLocalSpace(const s_animation_t& anim, const int bone, const int frame)
@@ -594,6 +1684,7 @@ glm::vec3 SMDHelper::GetBonePositionInLocalSpace(const s_animation_t& anim, cons
 
 glm::vec3 SMDHelper::GetBonePositionInWorldSpace(const s_animation_t& anim, const int bone, const int frame)
 {
+	EnsureWorldTransforms(anim);
 	return anim.frames[frame].entries[bone].world_transform[3];
 }
 
@@ -606,6 +1697,8 @@ glm::vec3 SMDHelper::GetBoneAnglesInLocalSpace(const s_animation_t& anim, const
 
 glm::vec3 SMDHelper::GetBoneAnglesInWorldSpace(const s_animation_t& anim, const int bone, const int frame)
 {
+	EnsureWorldTransforms(anim);
+
 	glm::vec3 angles;
 	extract_euler_angles_from_matrix(anim.frames[frame].entries[bone].world_transform, angles);
 	return angles;
@@ -613,20 +1706,11 @@ glm::vec3 SMDHelper::GetBoneAnglesInWorldSpace(const s_animation_t& anim, const
 
 void SMDHelper::RenameBone(s_animation_t& anim, int bone, const char* new_name)
 {
-	for (const auto& node : anim.nodes)
-	{
-		if (!_stricmp(node.name.c_str(), new_name))
-			throw;
-	}
+	if (FindNodeByName(anim, new_name) != -1)
+		throw;
 
 	anim.nodes[bone].name = new_name;
-}
-
-static void get_node_children_full_hierarchy(const std::vector<s_node_t>& nodes, int bone, std::list<int>& children)
-{
-	children.push_back(bone);
-	for (const auto& child : nodes[bone].children)
-		get_node_children_full_hierarchy(nodes, child, children);
+	anim.skeleton.UpdateNames(anim.nodes);
 }
 
 /*
@@ -637,68 +1721,64 @@ Because some bones may have multiple children that need to be remapped, the easi
 is to rebuild the entire hierarchy and ensure all new bones parent and children are mapped
 to the correct index.
 
-1. Build a list of all bones names, in the order that will be the new hierarchy.
+1. Build a list of all bones, in the order that will be the new hierarchy.
 2. Create a new node list and map each original parent or *new_parent* with
    respect to the new index
 3. Build a list that maps each new bone index to the original bone index
 4. For each frame, update the transform with respect to to the new index
 5. Recalculate all bone transformations from root.
 
+Steps 1 to 3 only need the nodes, they are shared with ApplySkeletonEdit.
+
 */
 
-void SMDHelper::ReplaceBoneParent(s_animation_t& anim, int bone, int new_parent)
+static void replace_node_parent(std::vector<s_node_t>& nodes, const s_skeleton_t& skeleton, int bone, int new_parent,
+	std::vector<int>& new_to_old_hierarchy)
 {
-	std::list<int> replacee_with_children;
-	get_node_children_full_hierarchy(anim.nodes, bone, replacee_with_children);
+	const auto replacee_with_children = skeleton.GetSubtree(bone);
 
-	std::list<std::string> new_hierarchy;
-	for (int i = anim.nodes.size() - 1; i >= 0; --i)
+	std::list<int> new_hierarchy;
+	for (int i = nodes.size() - 1; i >= 0; --i)
 	{
-		if (std::find(replacee_with_children.begin(), replacee_with_children.end(), i) != replacee_with_children.end())
+		if (skeleton.IsInSubtree(i, bone))
 			continue; // Do not add bones that will be moved.
 
-		new_hierarchy.push_front(anim.nodes[i].name);
+		new_hierarchy.push_front(i);
 	}
 
 	// Find the new bone parent position in the new hierarchy.
-	auto insert_pos = std::find(new_hierarchy.begin(), new_hierarchy.end(), anim.nodes[new_parent].name);
+	auto insert_pos = std::find(new_hierarchy.begin(), new_hierarchy.end(), new_parent);
 
 	// Advance, so we can append after the parent.
 	insert_pos++;
 
 	// Append the replacee bone and children.
 	for (const auto& child : replacee_with_children)
-		new_hierarchy.emplace(insert_pos, anim.nodes[child].name);
+		new_hierarchy.emplace(insert_pos, child);
 
 	// Rebuild the entire hierarchy.
-	std::vector<s_node_t> new_nodes(anim.nodes.size());
-
-	int new_index = 0;
-	for (const auto& name : new_hierarchy)
-	{
-		new_nodes[new_index].index = new_index;
-		new_nodes[new_index].name = name;
-		new_nodes[new_index].parent = -1;
-		++new_index;
-	}
+	std::vector<s_node_t> new_nodes(nodes.size());
 
 	// Build a map of old -> new bones and new -> old bones.
 
-	std::vector<int> new_to_old_hierarchy, old_to_new_hierarchy;
+	new_to_old_hierarchy.assign(new_hierarchy.begin(), new_hierarchy.end());
+	std::vector<int> old_to_new_hierarchy(nodes.size());
 
-	old_to_new_hierarchy.reserve(anim.nodes.size());
-	for (int i = 0; i < anim.nodes.size(); ++i)
-		old_to_new_hierarchy.push_back(FindNodeByName(new_nodes, anim.nodes[i].name.c_str()));
+	for (int new_index = 0; new_index < new_nodes.size(); ++new_index)
+	{
+		const int old_index = new_to_old_hierarchy[new_index];
+		old_to_new_hierarchy[old_index] = new_index;
 
-	new_to_old_hierarchy.reserve(new_nodes.size());
-	for (const auto& name : new_hierarchy)
-		new_to_old_hierarchy.push_back(FindNodeByName(anim.nodes, name.c_str()));
+		new_nodes[new_index].index = new_index;
+		new_nodes[new_index].name = nodes[old_index].name;
+		new_nodes[new_index].parent = -1;
+	}
 
 	// Update parents and children.
 	for (int i = 0; i < new_nodes.size(); ++i)
 	{
 		auto& new_node = new_nodes[i];
-		const auto& anim_node = anim.nodes[new_to_old_hierarchy[i]];
+		const auto& anim_node = nodes[new_to_old_hierarchy[i]];
 
 		// Check if this is the bone we want to replace the parent.
 		if (anim_node.index == bone)
@@ -712,182 +1792,562 @@ void SMDHelper::ReplaceBoneParent(s_animation_t& anim, int bone, int new_parent)
 			new_node.parent = old_to_new_hierarchy[anim_node.parent];
 		}
 
-		if (new_node.parent != -1)
+		if (new_node.parent != -1)
+		{
+			// Add node to parent children list.
+			new_nodes[new_node.parent].children.push_back(new_node.index);
+		}
+	}
+
+	nodes = std::move(new_nodes);
+}
+
+static void remove_node(std::vector<s_node_t>& nodes, int bone, std::vector<int>& new_to_old)
+{
+	// Set no parent for this bones' children.
+	for (auto& child : nodes[bone].children)
+		nodes[child].parent = -1;
+
+	// Remove this bone from all children list.
+	for (int i = 0; i < nodes.size(); ++i)
+	{
+		if (i == bone)
+			continue; // Skip the input bone since it will be deleted.
+
+		auto& node = nodes[i];
+
+		// Find and remove the bone from children list if it exists.
+		auto it = std::find(node.children.begin(), node.children.end(), bone);
+		if (it != node.children.end())
+			node.children.erase(it);
+	}
+
+	std::vector<s_node_t> new_nodes;
+	new_nodes.reserve(nodes.size() - 1);
+
+	// Bones after the removed one move one index down.
+	auto old_to_new = [bone](int i) { return i < bone ? i : i - 1; };
+
+	// Make a copy of all actual nodes, with their children and parents resolved.
+	for (int i = 0; i < nodes.size(); ++i)
+	{
+		if (i == bone)
+			continue; // Skip the input bone since it will be deleted.
+
+		const auto& real_node = nodes[i];
+
+		new_nodes.push_back({});
+
+		auto& new_node = new_nodes.back();
+		new_node.index = old_to_new(i);
+		new_node.name = real_node.name;
+		new_node.parent = real_node.parent == -1 ? -1 : old_to_new(real_node.parent);
+
+		new_node.children.reserve(real_node.children.size());
+
+		// Bone was removed from all children list previously. It is safe to append.
+		for (const auto& real_child : real_node.children)
+			new_node.children.push_back(old_to_new(real_child));
+	}
+
+	// Remove the frame entry where input bone was.
+	new_to_old.clear();
+	new_to_old.reserve(new_nodes.size());
+	for (int i = 0; i < nodes.size(); ++i)
+	{
+		if (i != bone)
+			new_to_old.push_back(i);
+	}
+
+	nodes = std::move(new_nodes);
+}
+
+// Returns the index of the new bone.
+static int insert_node(std::vector<s_node_t>& nodes, const char* name, int parent, std::vector<int>& new_to_old)
+{
+	int new_bone_index;
+	if (parent == -1)
+	{
+		new_bone_index = 1; // Insert after first root
+	}
+	else
+	{
+		new_bone_index = parent + 1;
+	}
+
+	// Update higher nodes index and children.
+	for (int i = 0; i < nodes.size(); ++i)
+	{
+		auto& node = nodes[i];
+
+		// If this bone index is higher than the insertion position, increase it's index
+		// since we shift 1 index higher.
+		if (node.index >= new_bone_index)
+			++node.index;
+
+		for (auto& child : node.children)
+		{
+			// If the child bone index is higher than the insertion position, increase it's index
+			// since we shift 1 index higher.
+			if (child >= new_bone_index)
+				++child;
+		}
+
+		// If the parent index is higher than the insertion position, increase it's index
+		// since we shift 1 index higher.
+		if (node.parent >= new_bone_index)
+			++node.parent;
+	}
+
+	// Insert the new node at the position.
+	s_node_t& new_bone = *nodes.emplace(nodes.begin() + new_bone_index);
+	new_bone.index = new_bone_index;
+	new_bone.name = name;
+	new_bone.parent = parent;
+
+	if (new_bone.parent != -1)
+	{
+		// Add bone to parent children list.
+		nodes[new_bone.parent].children.push_back(new_bone.index);
+	}
+
+	// Insert a new frame entry at the new index position.
+	new_to_old.resize(nodes.size());
+	for (int i = 0; i < nodes.size(); ++i)
+		new_to_old[i] = i < new_bone_index ? i : (i == new_bone_index ? -1 : i - 1);
+
+	return new_bone_index;
+}
+
+inline glm::mat4 create_bone_local_transform(const glm::vec3& local_space_position, const glm::vec3& local_space_angles)
+{
+	glm::mat4 local_transform = create_rotation_matrix(local_space_angles);
+	local_transform[3] = glm::vec4(local_space_position, 1.0f);
+	return local_transform;
+}
+
+void SMDHelper::ReplaceBoneParent(s_animation_t& anim, int bone, int new_parent)
+{
+	UpdateWorldTransforms(anim);
+
+	std::vector<int> new_to_old_hierarchy;
+	replace_node_parent(anim.nodes, GetSkeleton(anim), bone, new_parent, new_to_old_hierarchy);
+	UpdateSkeleton(anim);
+
+	// Copy transform of each frame with respect to the new hierarchy.
+	anim.frames.RemapBones(new_to_old_hierarchy);
+
+	// Update all frames transform from the root.
+	UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, 0);
+}
+
+void SMDHelper::RemoveBone(s_animation_t& anim, int bone)
+{
+	UpdateWorldTransforms(anim);
+
+	std::vector<int> new_to_old;
+	remove_node(anim.nodes, bone, new_to_old);
+	UpdateSkeleton(anim);
+
+	anim.frames.RemapBones(new_to_old);
+}
+
+void SMDHelper::AddBone(s_animation_t& anim,
+	const char* name,
+	const glm::vec3& local_space_position,
+	const glm::vec3& local_space_angles,
+	const int parent /*= -1*/
+)
+{
+	UpdateWorldTransforms(anim);
+
+	std::vector<int> new_to_old;
+	const int new_bone_index = insert_node(anim.nodes, name, parent, new_to_old);
+	UpdateSkeleton(anim);
+
+	anim.frames.RemapBones(new_to_old);
+
+	// Add new bone local transform for each frame.
+	const glm::mat4 local_transform = create_bone_local_transform(local_space_position, local_space_angles);
+	for (int t = 0; t < anim.frames.size(); ++t)
+		anim.frames[t].entries[new_bone_index].local_transform = local_transform;
+
+	MarkBoneDirty(anim, new_bone_index);
+}
+
+/*
+
+ApplySkeletonEdit
+
+The edits are first done on a copy of the nodes, one after the other, like the
+single bone functions above. Their transform work is recorded on bone slots
+instead of being done right away: the bones of the animation before the edit,
+followed by one slot per added bone. A slot keeps its entry whatever the bone
+index changes, and removed bones keep theirs, a later step may still read it.
+
+Then each frame is loaded in the slots, the recorded steps are run on it and it
+is stored with the new bone order, in a single pass over the frames.
+
+*/
+
+struct skeleton_edit_step_t
+{
+	enum class Type
+	{
+		// Update the world transform of the bones, from their parent.
+		WORLD_FROM_LOCAL,
+		// Update the local transform of the bones, from their parent.
+		LOCAL_FROM_WORLD,
+		// Set the local transform of the bones.
+		SET_LOCAL,
+	};
+
+	Type type;
+	// Slot and parent slot of each bone, parents first. Parent slot is -1 for roots.
+	std::vector<std::pair<int, int>> bones = {};
+	glm::mat4 local_transform = glm::mat4(1.0f);
+};
+
+static void run_skeleton_edit_step(const skeleton_edit_step_t& step, s_animation_frame_entry_t* slots)
+{
+	for (const auto& [slot, parent_slot] : step.bones)
+	{
+		auto& node = slots[slot];
+
+		switch (step.type)
 		{
-			// Add node to parent children list.
-			new_nodes[new_node.parent].children.push_back(new_node.index);
+		case skeleton_edit_step_t::Type::WORLD_FROM_LOCAL:
+			if (parent_slot == -1)
+				node.world_transform = node.local_transform;
+			else
+				node.world_transform = world_from_local(slots[parent_slot].world_transform, node.local_transform);
+			break;
+		case skeleton_edit_step_t::Type::LOCAL_FROM_WORLD:
+			if (parent_slot == -1)
+				node.local_transform = node.world_transform;
+			else
+				node.local_transform = local_from_world(slots[parent_slot].world_transform, node.world_transform);
+			break;
+		case skeleton_edit_step_t::Type::SET_LOCAL:
+			node.local_transform = step.local_transform;
+			break;
 		}
 	}
+}
 
-	// Copy transform of each frame with respect to the new hierarchy.
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame = anim.frames[t];
+void SMDHelper::ApplySkeletonEdit(s_animation_t& anim, const s_skeleton_edit_t& edit)
+{
+	if (edit.IsEmpty())
+		return;
 
-		s_animation_frame_t new_frame{};
-		new_frame.entries.resize(frame.entries.size());
+	UpdateWorldTransforms(anim);
 
-		for (int i = 0; i < frame.entries.size(); ++i)
-		{
-			new_frame.entries[old_to_new_hierarchy[i]] = frame.entries[i];
-		}
+	const int num_old_bones = anim.nodes.size();
 
-		frame.entries = new_frame.entries;
-	}
+	std::vector<s_node_t> nodes = anim.nodes;
+	s_skeleton_t skeleton = GetSkeleton(anim);
 
-	// Set new node hierarchy.
-	anim.nodes = new_nodes;
+	// Slot of each bone of the edited nodes.
+	std::vector<int> slots(num_old_bones);
+	for (int i = 0; i < num_old_bones; ++i)
+		slots[i] = i;
 
-	// Update all frames transform from the root.
-	UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, 0);
-}
+	int num_slots = num_old_bones;
+	std::vector<bool> dirty_slots(num_slots, false);
+	bool has_dirty_slots = false;
 
-void SMDHelper::RemoveBone(s_animation_t& anim, int bone)
-{
-	// Set no parent for this bones' children.
-	for (auto& child : anim.nodes[bone].children)
-		anim.nodes[child].parent = -1;
+	std::vector<skeleton_edit_step_t> steps;
+	std::vector<int> new_to_old;
 
-	// Remove this bone from all children list.
-	for (int i = 0; i < anim.nodes.size(); ++i)
-	{
-		if (i == bone)
-			continue; // Skip the input bone since it will be deleted.
+	auto find_bone = [&skeleton](const std::string& name) {
+		const int bone = skeleton.FindBone(name);
+		if (bone == -1)
+			throw std::invalid_argument("no bone named " + name);
+		return bone;
+	};
 
-		auto& node = anim.nodes[i];
+	auto remap_slots = [&slots, &new_to_old](int added_slot) {
+		std::vector<int> new_slots(new_to_old.size());
+		for (int i = 0; i < new_to_old.size(); ++i)
+			new_slots[i] = new_to_old[i] == -1 ? added_slot : slots[new_to_old[i]];
+		slots = std::move(new_slots);
+	};
 
-		// Find and remove the bone from children list if it exists.
-		auto it = std::find(node.children.begin(), node.children.end(), bone);
-		if (it != node.children.end())
-			node.children.erase(it);
-	}
+	// Same as UpdateWorldTransforms, done by every edit but renames.
+	auto update_world_transforms = [&]() {
+		if (!has_dirty_slots)
+			return;
 
-	std::vector<s_node_t> new_nodes;
-	new_nodes.reserve(anim.nodes.size() - 1);
+		const auto order = skeleton.GetOrder();
+		const auto& order_parents = skeleton.GetOrderParents();
 
-	int new_node_index = 0;
+		skeleton_edit_step_t step{ skeleton_edit_step_t::Type::WORLD_FROM_LOCAL };
 
-	// Make a copy of all actual nodes.
-	for (int i = 0; i < anim.nodes.size(); ++i)
-	{
-		if (i == bone)
-			continue; // Skip the input bone since it will be deleted.
+		std::vector<bool> stale(order.size());
+		for (int k = 0; k < order.size(); ++k)
+		{
+			stale[k] = dirty_slots[slots[order[k]]] || (order_parents[k] != -1 && stale[order_parents[k]]);
+			if (stale[k])
+			{
+				const int parent = nodes[order[k]].parent;
+				step.bones.emplace_back(slots[order[k]], parent == -1 ? -1 : slots[parent]);
+			}
+		}
 
-		const auto& real_node = anim.nodes[i];
+		steps.push_back(std::move(step));
+		dirty_slots.assign(num_slots, false);
+		has_dirty_slots = false;
+	};
 
-		new_nodes.push_back({});
+	for (const auto& e : edit._edits)
+	{
+		switch (e.type)
+		{
+		case s_skeleton_edit_t::EditType::REMOVE_BONE:
+		{
+			update_world_transforms();
 
-		auto& new_node = new_nodes.back();
-		new_node.index = new_node_index++;
-		new_node.name = real_node.name;
-		new_node.parent = -1;
+			remove_node(nodes, find_bone(e.bone), new_to_old);
+			remap_slots(-1);
+			skeleton.Build(nodes);
+			break;
+		}
+		case s_skeleton_edit_t::EditType::ADD_BONE:
+		{
+			update_world_transforms();
+
+			const int parent = e.other.empty() ? -1 : find_bone(e.other);
+			insert_node(nodes, e.bone.c_str(), parent, new_to_old);
+			const int new_slot = num_slots++;
+			remap_slots(new_slot);
+			skeleton.Build(nodes);
+
+			skeleton_edit_step_t step{ skeleton_edit_step_t::Type::SET_LOCAL };
+			step.bones.emplace_back(new_slot, -1);
+			step.local_transform = create_bone_local_transform(e.local_space_position, e.local_space_angles);
+			steps.push_back(std::move(step));
+
+			dirty_slots.push_back(true);
+			has_dirty_slots = true;
+			break;
+		}
+		case s_skeleton_edit_t::EditType::REPLACE_BONE_PARENT:
+		{
+			update_world_transforms();
+
+			replace_node_parent(nodes, skeleton, find_bone(e.bone), find_bone(e.other), new_to_old);
+			remap_slots(-1);
+			skeleton.Build(nodes);
+
+			// Same as UpdateBoneHierarchyLocalTransformFromWorldTransform(anim, 0).
+			skeleton_edit_step_t step{ skeleton_edit_step_t::Type::LOCAL_FROM_WORLD };
+			for (int i : skeleton.GetSubtree(0))
+				step.bones.emplace_back(slots[i], nodes[i].parent == -1 ? -1 : slots[nodes[i].parent]);
+			steps.push_back(std::move(step));
+			break;
+		}
+		case s_skeleton_edit_t::EditType::RENAME_BONE:
+		{
+			const int bone = find_bone(e.bone);
+			if (skeleton.FindBone(e.other) != -1)
+				throw std::invalid_argument("bone " + e.other + " already exists");
+
+			nodes[bone].name = e.other;
+			skeleton.UpdateNames(nodes);
+			break;
+		}
+		}
 	}
 
-	new_node_index = 0;
+	// Rewrite the frames.
+	const int num_new_bones = nodes.size();
 
-	// Resolve bone children and parents.
-	for (int i = 0; i < anim.nodes.size(); ++i)
-	{
-		if (i == bone)
-			continue; // Ignore current bone since it will be deleted.
+	bool same_bones = num_new_bones == num_old_bones;
+	for (int i = 0; same_bones && i < num_new_bones; ++i)
+		same_bones = slots[i] == i;
 
-		const auto& real_node = anim.nodes[i];
+	if (steps.empty())
+	{
+		// Bones were only removed or renamed, there is no added slot.
+		if (!same_bones)
+			anim.frames.RemapBones(slots);
+	}
+	else
+	{
+		s_animation_frames_t new_frames;
+		new_frames.Resize(anim.frames.size(), num_new_bones);
 
-		auto& new_node = new_nodes[new_node_index++];
+		size_t work_per_frame = 0;
+		for (const auto& step : steps)
+			work_per_frame += step.bones.size();
 
-		if (real_node.parent == -1)
-			new_node.parent = -1;
-		else
-			new_node.parent = FindNodeByName(new_nodes, anim.nodes[real_node.parent].name.c_str());
+		ForEachFrameRange(anim, work_per_frame, [&](int begin, int end) {
+			std::vector<s_animation_frame_entry_t> frame_slots(num_slots);
 
-		new_node.children.reserve(real_node.children.size());
+			for (int t = begin; t < end; ++t)
+			{
+				auto&& old_frame = anim.frames[t];
+				for (int i = 0; i < num_old_bones; ++i)
+					frame_slots[i] = old_frame.entries[i];
+				for (int i = num_old_bones; i < num_slots; ++i)
+					frame_slots[i] = {};
+
+				for (const auto& step : steps)
+					run_skeleton_edit_step(step, frame_slots.data());
+
+				auto&& new_frame = new_frames[t];
+				for (int i = 0; i < num_new_bones; ++i)
+					new_frame.entries[i] = frame_slots[slots[i]];
+			}
+		});
 
-		// Bone was removed from all children list previously. It is safe to append.
-		// Append each children by name.
-		for (const auto& real_child : real_node.children)
-			new_node.children.push_back(FindNodeByName(new_nodes, anim.nodes[real_child].name.c_str()));
+		anim.frames = std::move(new_frames);
 	}
 
-	// Update the current hierarchy with the new nodes.
-	anim.nodes = new_nodes;
+	anim.nodes = std::move(nodes);
+	anim.skeleton = std::move(skeleton);
 
-	for (auto& frame : anim.frames)
+	for (int i = 0; i < num_new_bones; ++i)
 	{
-		// Remove the frame entry where input bone was.
-		frame.entries.erase(frame.entries.begin() + bone);
+		if (dirty_slots[slots[i]])
+			MarkBoneDirty(anim, i);
 	}
 }
 
-void SMDHelper::AddBone(s_animation_t& anim,
-	const char* name,
-	const glm::vec3& local_space_position,
-	const glm::vec3& local_space_angles,
-	const int parent /*= -1*/
-)
+void SMDHelper::ApplyBoneTransformEdit(s_animation_t& anim, const s_bone_transform_edit_t& edit)
 {
-	int new_bone_index;
-	if (parent == -1)
-	{
-		new_bone_index = 1; // Insert after first root
-	}
-	else
+	using EditType = s_bone_transform_edit_t::EditType;
+
+	if (edit.IsEmpty())
+		return;
+
+	const auto& skeleton = GetSkeleton(anim);
+	const auto order = skeleton.GetOrder();
+	const auto& order_parents = skeleton.GetOrderParents();
+
+	struct step_t
 	{
-		new_bone_index = parent + 1;
-	}
+		const s_bone_transform_edit_t::edit_t* edit;
+		int bone;
+		// World transforms rebuilt before a world space move, parents first.
+		std::vector<int> stale_bones = {};
+	};
 
-	// Update higher nodes index and children.
-	for (int i = 0; i < anim.nodes.size(); ++i)
+	std::vector<step_t> steps;
+	steps.reserve(edit._edits.size());
+
+	// Bones moved in local space since the last world space move.
+	std::vector<bool> dirty(anim.nodes.size(), false);
+	bool has_dirty = false;
+	bool has_world_moves = false;
+	size_t work_per_frame = 0;
+
+	for (const auto& e : edit._edits)
 	{
-		auto& node = anim.nodes[i];
+		const int bone = e.bone.empty() ? e.bone_index : skeleton.FindBone(e.bone);
+		if (e.bone.empty() && (bone < 0 || bone >= skeleton.GetBoneCount()))
+			throw std::invalid_argument("no bone " + std::to_string(bone));
+		if (bone == -1)
+			throw std::invalid_argument("no bone named " + e.bone);
 
-		// If this bone index is higher than the insertion position, increase it's index
-		// since we shift 1 index higher.
-		if (node.index >= new_bone_index)
-			++node.index;
+		step_t step{ &e, bone };
 
-		for (auto& child : node.children)
+		switch (e.type)
 		{
-			// If the child bone index is higher than the insertion position, increase it's index
-			// since we shift 1 index higher.
-			if (child >= new_bone_index)
-				++child;
+		case EditType::TRANSLATE_LOCAL:
+		case EditType::TRANSLATE_LOCAL_RELATIVE:
+			dirty[bone] = true;
+			has_dirty = true;
+			work_per_frame += 1;
+			break;
+		case EditType::ROTATE_LOCAL_RELATIVE:
+			dirty[bone] = true;
+			has_dirty = true;
+			work_per_frame += 4;
+			break;
+		case EditType::TRANSLATE_WORLD:
+		case EditType::TRANSLATE_WORLD_RELATIVE:
+		case EditType::ROTATE_WORLD_RELATIVE:
+			has_world_moves = true;
+
+			if (has_dirty)
+			{
+				// Same as UpdateWorldTransforms.
+				std::vector<bool> stale(order.size());
+				for (int k = 0; k < order.size(); ++k)
+				{
+					stale[k] = dirty[order[k]] || (order_parents[k] != -1 && stale[order_parents[k]]);
+					if (stale[k])
+						step.stale_bones.push_back(order[k]);
+				}
+
+				dirty.assign(anim.nodes.size(), false);
+				has_dirty = false;
+			}
+
+			work_per_frame += step.stale_bones.size() + skeleton.GetSubtreeSize(bone);
+			break;
 		}
 
-		// If the parent index is higher than the insertion position, increase it's index
-		// since we shift 1 index higher.
-		if (node.parent >= new_bone_index)
-			++node.parent;
+		steps.push_back(std::move(step));
 	}
 
-	// Insert the new node at the position.
-	s_node_t& new_bone = *anim.nodes.emplace(anim.nodes.begin() + new_bone_index);
-	new_bone.index = new_bone_index;
-	new_bone.name = name;
-	new_bone.parent = parent;
+	// The world space moves start from up to date world transforms.
+	if (has_world_moves)
+		UpdateWorldTransforms(anim);
 
-	if (new_bone.parent != -1)
-	{
-		// Add bone to parent children list.
-		anim.nodes[new_bone.parent].children.push_back(new_bone.index);
-	}
+	ForEachFrameRange(anim, work_per_frame, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			for (const auto& step : steps)
+			{
+				if (!step.stale_bones.empty())
+				{
+					auto&& frame = anim.frames[t];
+					const s_bone_range_t bones(step.stale_bones.data(), static_cast<int>(step.stale_bones.size()));
+					update_world_transforms(anim.nodes, frame.entries, bones);
+				}
+
+				const auto& value = step.edit->value;
+
+				switch (step.edit->type)
+				{
+				case EditType::TRANSLATE_LOCAL:
+					translate_bone_in_local_space(anim, step.bone, t, value);
+					break;
+				case EditType::TRANSLATE_LOCAL_RELATIVE:
+					translate_bone_in_local_space_relative(anim, step.bone, t, value);
+					break;
+				case EditType::ROTATE_LOCAL_RELATIVE:
+					rotate_bone_in_local_space_relative(anim, step.bone, t, value);
+					break;
+				case EditType::TRANSLATE_WORLD:
+					translate_bone_in_world_space(anim, step.bone, t, value);
+					break;
+				case EditType::TRANSLATE_WORLD_RELATIVE:
+					translate_bone_in_world_space_relative(anim, step.bone, t, value);
+					break;
+				case EditType::ROTATE_WORLD_RELATIVE:
+					rotate_bone_in_world_space_relative(anim, step.bone, t, value);
+					break;
+				}
+			}
+		}
+	});
 
-	// Add new bone local transform for each frame.
-	for (int t = 0; t < anim.frames.size(); ++t)
+	// Moves after the last world space move leave their bones out of date, like the
+	// local space functions do.
+	for (int i = 0; i < dirty.size(); ++i)
 	{
-		auto& frame_entries = anim.frames[t].entries;
-		// Insert a new frame entry at the new index position.
-		auto& new_frame_entry = *frame_entries.emplace(frame_entries.begin() + new_bone_index);
-
-		new_frame_entry.local_transform = create_rotation_matrix(local_space_angles);
-		new_frame_entry.local_transform[3] = glm::vec4(local_space_position, 1.0f);
-
-		// Update new bone world transform.
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, new_bone.index, t);
+		if (dirty[i])
+			MarkBoneDirty(anim, i);
 	}
 }
 
 void SMDHelper::FixupBonesLengths(s_animation_t& anim, const s_animation_t& input_reference)
 {
+	EnsureWorldTransforms(input_reference);
+
 	std::vector<int> reference_to_anim_bones;
 	GetReferenceBonesMappedToTargetBones(input_reference, anim, {}, reference_to_anim_bones);
 
@@ -909,32 +2369,38 @@ void SMDHelper::FixupBonesLengths(s_animation_t& anim, const s_animation_t& inpu
 		}
 	}
 
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		for (int i = 0; i < input_reference.nodes.size(); ++i)
+	ForEachFrameRange(anim, input_reference.nodes.size(), [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
 		{
-			if (reference_to_anim_bones[i] == -1)
-			{
-				// No bone mapping exists
-			}
-			else if (anim.nodes[reference_to_anim_bones[i]].parent == -1)
+			for (int i = 0; i < input_reference.nodes.size(); ++i)
 			{
-				// Ignore root
-			}
-			else
-			{
-				auto& anim_node = anim.frames[t].entries[reference_to_anim_bones[i]];
-				glm::vec3 pos = anim_node.local_transform[3];
-
-				// Check that the bone position is non null before normalizing.
-				// If length is 0, it means the bone has the same position as the parent bone in worldspace.
-				if (glm::length(pos) > 0.0f)
-					pos = glm::normalize(pos) * ref_bone_lengths[i];
-				anim_node.local_transform[3] = glm::vec4(pos, 1.0f);
-
-				UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, reference_to_anim_bones[i], t);
+				if (reference_to_anim_bones[i] == -1)
+				{
+					// No bone mapping exists
+				}
+				else if (anim.nodes[reference_to_anim_bones[i]].parent == -1)
+				{
+					// Ignore root
+				}
+				else
+				{
+					auto& anim_node = anim.frames[t].entries[reference_to_anim_bones[i]];
+					glm::vec3 pos = anim_node.local_transform[3];
+
+					// Check that the bone position is non null before normalizing.
+					// If length is 0, it means the bone has the same position as the parent bone in worldspace.
+					if (glm::length(pos) > 0.0f)
+						pos = glm::normalize(pos) * ref_bone_lengths[i];
+					anim_node.local_transform[3] = glm::vec4(pos, 1.0f);
+				}
 			}
 		}
+	});
+
+	for (int i = 0; i < input_reference.nodes.size(); ++i)
+	{
+		if (reference_to_anim_bones[i] != -1 && anim.nodes[reference_to_anim_bones[i]].parent != -1)
+			MarkBoneDirty(anim, reference_to_anim_bones[i]);
 	}
 }
 
@@ -950,55 +2416,75 @@ void SMDHelper::SolveFoots(
 	const char* original_anim_left_foot_name,
 	const char* original_anim_right_foot_name)
 {
-	int anim_left_foot_index = FindNodeByName(anim.nodes, anim_left_foot_name);
-	int anim_right_foot_index = FindNodeByName(anim.nodes, anim_right_foot_name);
-	int anim_pelvis_index = FindNodeByName(anim.nodes, anim_pelvis_name);
+	SolveFoots(
+		anim,
+		FindNodeByName(anim, anim_left_foot_name),
+		FindNodeByName(anim, anim_right_foot_name),
+		FindNodeByName(anim, anim_pelvis_name),
+		original_animation,
+		FindNodeByName(original_animation, original_anim_left_foot_name),
+		FindNodeByName(original_animation, original_anim_right_foot_name)
+	);
+}
 
-	int original_anim_left_foot_index = FindNodeByName(original_animation.nodes, original_anim_left_foot_name);
-	int original_anim_right_foot_index = FindNodeByName(original_animation.nodes, original_anim_right_foot_name);
+void SMDHelper::SolveFoots(
+	s_animation_t& anim,
+	int anim_left_foot_index,
+	int anim_right_foot_index,
+	int anim_pelvis_index,
+	const s_animation_t& original_animation,
+	int original_anim_left_foot_index,
+	int original_anim_right_foot_index)
+{
+	UpdateWorldTransforms(anim);
+	EnsureWorldTransforms(original_animation);
 
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		const auto& original_anim_left_foot = original_animation.frames[t].entries[original_anim_left_foot_index];
-		const auto& original_anim_right_foot = original_animation.frames[t].entries[original_anim_right_foot_index];
+	const int subtree_size = GetSkeleton(anim).GetSubtreeSize(anim_pelvis_index);
 
-		const auto& anim_left_foot = anim.frames[t].entries[anim_left_foot_index];
-		const auto& anim_right_foot = anim.frames[t].entries[anim_right_foot_index];
-		auto& anim_pelvis = anim.frames[t].entries[anim_pelvis_index];
+	ForEachFrameRange(anim, 2 * subtree_size, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			const auto& original_anim_left_foot = original_animation.frames[t].entries[original_anim_left_foot_index];
+			const auto& original_anim_right_foot = original_animation.frames[t].entries[original_anim_right_foot_index];
 
-		// All in worldspace.
-		const glm::vec3& orig_anim_left_foot_pos = original_anim_left_foot.world_transform[3];
-		const glm::vec3& orig_anim_right_foot_pos = original_anim_right_foot.world_transform[3];
+			const auto& anim_left_foot = anim.frames[t].entries[anim_left_foot_index];
+			const auto& anim_right_foot = anim.frames[t].entries[anim_right_foot_index];
+			auto& anim_pelvis = anim.frames[t].entries[anim_pelvis_index];
 
-		const glm::vec3& anim_left_foot_pos = anim_left_foot.world_transform[3];
-		const glm::vec3& anim_right_foot_pos = anim_right_foot.world_transform[3];
-		glm::vec3 anim_pelvis_pos = anim_pelvis.world_transform[3];
+			// All in worldspace.
+			const glm::vec3& orig_anim_left_foot_pos = original_anim_left_foot.world_transform[3];
+			const glm::vec3& orig_anim_right_foot_pos = original_anim_right_foot.world_transform[3];
 
-		anim_pelvis_pos += orig_anim_left_foot_pos - anim_left_foot_pos;
+			const glm::vec3& anim_left_foot_pos = anim_left_foot.world_transform[3];
+			const glm::vec3& anim_right_foot_pos = anim_right_foot.world_transform[3];
+			glm::vec3 anim_pelvis_pos = anim_pelvis.world_transform[3];
 
-		auto set_pelvis_world_position = [&](const glm::vec3& new_pos) {
-			anim_pelvis.world_transform[3] = glm::vec4(new_pos, 1.0f);
+			anim_pelvis_pos += orig_anim_left_foot_pos - anim_left_foot_pos;
 
-			if (anim.nodes[anim_pelvis_index].parent == -1)
-			{
-				anim_pelvis.local_transform = anim_pelvis.world_transform;
-			}
-			else
-			{
-				auto& anim_pelvis_parent = anim.frames[t].entries[anim.nodes[anim_pelvis_index].parent];
-				anim_pelvis.local_transform = glm::inverse(anim_pelvis_parent.world_transform) * anim_pelvis.world_transform;
-			}
+			auto set_pelvis_world_position = [&](const glm::vec3& new_pos) {
+				anim_pelvis.world_transform[3] = glm::vec4(new_pos, 1.0f);
 
-			UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, anim_pelvis_index, t);
-		};
+				if (anim.nodes[anim_pelvis_index].parent == -1)
+				{
+					anim_pelvis.local_transform = anim_pelvis.world_transform;
+				}
+				else
+				{
+					auto& anim_pelvis_parent = anim.frames[t].entries[anim.nodes[anim_pelvis_index].parent];
+					anim_pelvis.local_transform = local_from_world(anim_pelvis_parent.world_transform, anim_pelvis.world_transform);
+				}
 
-		set_pelvis_world_position(anim_pelvis_pos);
+				UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, anim_pelvis_index, t);
+			};
 
-		glm::vec3 right_delta = (original_anim_right_foot.world_transform[3] - anim_right_foot.world_transform[3]) * 0.5f;
-		anim_pelvis_pos = glm::vec3(anim_pelvis.world_transform[3]) + right_delta;
+			set_pelvis_world_position(anim_pelvis_pos);
 
-		set_pelvis_world_position(anim_pelvis_pos);
-	}
+			glm::vec3 right_delta = (original_anim_right_foot.world_transform[3] - anim_right_foot.world_transform[3]) * 0.5f;
+			anim_pelvis_pos = glm::vec3(anim_pelvis.world_transform[3]) + right_delta;
+
+			set_pelvis_world_position(anim_pelvis_pos);
+		}
+	});
 
 	int a = 2;
 	a++;
@@ -1015,45 +2501,63 @@ void SMDHelper::SolveFoot(
 	const s_animation_t& original_animation,
 	const char* original_anim_foot_name)
 {
-	int anim_foot_index = FindNodeByName(anim.nodes, anim_foot_name);
-	int anim_pelvis_index = FindNodeByName(anim.nodes, anim_pelvis_name);
+	SolveFoot(
+		anim,
+		FindNodeByName(anim, anim_foot_name),
+		FindNodeByName(anim, anim_pelvis_name),
+		original_animation,
+		FindNodeByName(original_animation, original_anim_foot_name)
+	);
+}
 
-	int original_anim_foot_index = FindNodeByName(original_animation.nodes, original_anim_foot_name);
+void SMDHelper::SolveFoot(
+	s_animation_t& anim,
+	int anim_foot_index,
+	int anim_pelvis_index,
+	const s_animation_t& original_animation,
+	int original_anim_foot_index)
+{
+	UpdateWorldTransforms(anim);
+	EnsureWorldTransforms(original_animation);
 
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		const auto& original_anim_foot = original_animation.frames[t].entries[original_anim_foot_index];
+	const int subtree_size = GetSkeleton(anim).GetSubtreeSize(anim_pelvis_index);
 
-		const auto& anim_left_foot = anim.frames[t].entries[anim_foot_index];
-		auto& anim_pelvis = anim.frames[t].entries[anim_pelvis_index];
+	ForEachFrameRange(anim, subtree_size, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			const auto& original_anim_foot = original_animation.frames[t].entries[original_anim_foot_index];
 
-		// All in worldspace.
-		const glm::vec3& orig_anim_foot_pos = original_anim_foot.world_transform[3];
+			const auto& anim_left_foot = anim.frames[t].entries[anim_foot_index];
+			auto& anim_pelvis = anim.frames[t].entries[anim_pelvis_index];
 
-		const glm::vec3& anim_foot_pos = anim_left_foot.world_transform[3];
+			// All in worldspace.
+			const glm::vec3& orig_anim_foot_pos = original_anim_foot.world_transform[3];
 
-		glm::vec3 anim_pelvis_pos = anim_pelvis.world_transform[3];
+			const glm::vec3& anim_foot_pos = anim_left_foot.world_transform[3];
 
-		anim_pelvis_pos += orig_anim_foot_pos - anim_foot_pos;
+			glm::vec3 anim_pelvis_pos = anim_pelvis.world_transform[3];
 
-		auto set_pelvis_world_position = [&](const glm::vec3& new_pos) {
-			anim_pelvis.world_transform[3] = glm::vec4(new_pos, 1.0f);
+			anim_pelvis_pos += orig_anim_foot_pos - anim_foot_pos;
 
-			if (anim.nodes[anim_pelvis_index].parent == -1)
-			{
-				anim_pelvis.local_transform = anim_pelvis.world_transform;
-			}
-			else
-			{
-				auto& anim_pelvis_parent = anim.frames[t].entries[anim.nodes[anim_pelvis_index].parent];
-				anim_pelvis.local_transform = glm::inverse(anim_pelvis_parent.world_transform) * anim_pelvis.world_transform;
-			}
+			auto set_pelvis_world_position = [&](const glm::vec3& new_pos) {
+				anim_pelvis.world_transform[3] = glm::vec4(new_pos, 1.0f);
 
-			UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, anim_pelvis_index, t);
-		};
+				if (anim.nodes[anim_pelvis_index].parent == -1)
+				{
+					anim_pelvis.local_transform = anim_pelvis.world_transform;
+				}
+				else
+				{
+					auto& anim_pelvis_parent = anim.frames[t].entries[anim.nodes[anim_pelvis_index].parent];
+					anim_pelvis.local_transform = local_from_world(anim_pelvis_parent.world_transform, anim_pelvis.world_transform);
+				}
 
-		set_pelvis_world_position(anim_pelvis_pos);
-	}
+				UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, anim_pelvis_index, t);
+			};
+
+			set_pelvis_world_position(anim_pelvis_pos);
+		}
+	});
 
 	int a = 2;
 	a++;
@@ -1068,26 +2572,31 @@ void SMDHelper::TranslateToBoneInWorldSpace(
 	int target_bone
 )
 {
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame_node = anim.frames[t].entries[bone];
+	UpdateWorldTransforms(anim);
+	EnsureWorldTransforms(target_animation);
 
-		glm::vec3 target_bone_pos = glm::vec3(target_animation.frames[t].entries[target_bone].world_transform[3]);
+	ForEachFrameRange(anim, 1, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			auto& frame_node = anim.frames[t].entries[bone];
 
-		frame_node.world_transform[3] = glm::vec4(target_bone_pos, 1.0f);
+			glm::vec3 target_bone_pos = glm::vec3(target_animation.frames[t].entries[target_bone].world_transform[3]);
 
-		if (anim.nodes[bone].parent == -1)
-		{
-			frame_node.local_transform = frame_node.world_transform;
-		}
-		else
-		{
-			const auto& frame_node_parent = anim.frames[t].entries[anim.nodes[bone].parent];
-			frame_node.local_transform = glm::inverse(frame_node_parent.world_transform) * frame_node.world_transform;
+			frame_node.world_transform[3] = glm::vec4(target_bone_pos, 1.0f);
+
+			if (anim.nodes[bone].parent == -1)
+			{
+				frame_node.local_transform = frame_node.world_transform;
+			}
+			else
+			{
+				const auto& frame_node_parent = anim.frames[t].entries[anim.nodes[bone].parent];
+				frame_node.local_transform = local_from_world(frame_node_parent.world_transform, frame_node.world_transform);
+			}
 		}
+	});
 
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, bone, t);
-	}
+	MarkBoneDirty(anim, bone);
 }
 
 #if 1
@@ -1106,26 +2615,17 @@ void SMDHelper::CopyBoneTransformation(
 		a++;
 	}
 
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame_node = anim.frames[t].entries[bone];
-		auto& target_node_frame = target_animation.frames[target_bone_frame].entries[target_bone];
-
-		frame_node.local_transform = target_node_frame.local_transform;
-
-		if (anim.nodes[bone].parent == -1)
-		{
-			frame_node.world_transform = frame_node.local_transform;
-		}
-		else
+	ForEachFrameRange(anim, 1, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
 		{
-			// Set new worldspace bone matrix.
-			const auto& frame_parent_node = anim.frames[t].entries[anim.nodes[bone].parent];
-			frame_node.world_transform = frame_parent_node.world_transform * frame_node.local_transform;
+			auto& frame_node = anim.frames[t].entries[bone];
+			auto& target_node_frame = target_animation.frames[target_bone_frame].entries[target_bone];
+
+			frame_node.local_transform = target_node_frame.local_transform;
 		}
+	});
 
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, bone, t);
-	}
+	MarkBoneDirty(anim, bone);
 }
 #endif
 
@@ -1143,9 +2643,9 @@ void SMDHelper::CopyBoneLocalSpaceTransformToBone(
 		const auto& src_frame_node = src_anim.frames[t].entries[src_bone];
 		auto& dest_frame_node = dest_anim.frames[t].entries[dest_bone];
 		dest_frame_node.local_transform = src_frame_node.local_transform;
-
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(dest_anim, dest_bone, t);
 	}
+
+	MarkBoneDirty(dest_anim, dest_bone);
 }
 #endif
 
@@ -1157,13 +2657,15 @@ void SMDHelper::CopyReferenceBoneLocalSpaceToAnimationBone(
 {
 	const auto& reference_node = reference.frames[0].entries[reference_bone];
 
-	for (int t = 0; t < anim.frames.size(); ++t)
-	{
-		auto& frame_node = anim.frames[t].entries[anim_bone];
-		frame_node.local_transform = reference_node.local_transform;
+	ForEachFrameRange(anim, 1, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			auto& frame_node = anim.frames[t].entries[anim_bone];
+			frame_node.local_transform = reference_node.local_transform;
+		}
+	});
 
-		UpdateBoneHierarchyWorldTransformFromLocalTransform(anim, anim_bone, t);
-	}
+	MarkBoneDirty(anim, anim_bone);
 }
 
 void SMDHelper::GetReferenceBonesMappedToTargetBones(
@@ -1177,17 +2679,17 @@ void SMDHelper::GetReferenceBonesMappedToTargetBones(
 	// Find bones in target that have the same name as reference ones.
 	for (auto& reference_node : reference.nodes)
 	{
-		int target_index = FindNodeByName(target.nodes, reference_node.name.c_str());
+		int target_index = FindNodeByName(target, reference_node.name.c_str());
 		if (target_index == -1)
 		{
 #if DEBUG_MESSAGES
-			printf("Target has no bone %s. The reference pose will be used.\n", reference_node.name.c_str());
+			LogPrintf("Target has no bone %s. The reference pose will be used.\n", reference_node.name.c_str());
 #endif
 		}
 		else
 		{
 #if DEBUG_MESSAGES
-			printf("Found bone %s in target. The target pose will be used.\n", reference_node.name.c_str());
+			LogPrintf("Found bone %s in target. The target pose will be used.\n", reference_node.name.c_str());
 #endif
 			bones_mapped[reference_node.index] = target_index;
 		}
@@ -1199,20 +2701,20 @@ void SMDHelper::GetReferenceBonesMappedToTargetBones(
 		// first = input
 		// second = target
 
-		int reference_index = FindNodeByName(reference.nodes, bm_entry.first.c_str());
+		int reference_index = FindNodeByName(reference, bm_entry.first.c_str());
 		if (reference_index == -1)
 		{
 #if DEBUG_MESSAGES
-			printf("Reference has no bone %s. The reference pose will be used.\n", bm_entry.first.c_str());
+			LogPrintf("Reference has no bone %s. The reference pose will be used.\n", bm_entry.first.c_str());
 #endif
 			continue;
 		}
 
-		int target_index = FindNodeByName(target.nodes, bm_entry.second.c_str());
+		int target_index = FindNodeByName(target, bm_entry.second.c_str());
 		if (target_index != -1)
 		{
 #if DEBUG_MESSAGES
-			printf("Found bone mapping %s => %s\n",
+			LogPrintf("Found bone mapping %s => %s\n",
 				reference.nodes[reference_index].name.c_str(),
 				target.nodes[target_index].name.c_str()
 			);
@@ -1222,8 +2724,95 @@ void SMDHelper::GetReferenceBonesMappedToTargetBones(
 		else
 		{
 #if DEBUG_MESSAGES
-			printf("Target has no bone %s. The reference pose will be used.\n", bm_entry.second.c_str());
+			LogPrintf("Target has no bone %s. The reference pose will be used.\n", bm_entry.second.c_str());
 #endif
 		}
 	}
 }
+
+void SMDHelper::CompactAnimation(const s_animation_t& anim, s_compact_animation_t& compact)
+{
+	compact.name = anim.name;
+	compact.nodes = anim.nodes;
+	compact.num_frames = anim.frames.size();
+	compact.local_poses.resize(compact.num_frames * compact.nodes.size());
+
+	for (int t = 0; t < anim.frames.size(); ++t)
+	{
+		for (int i = 0; i < anim.nodes.size(); ++i)
+			compact.GetLocalPose(i, t) = s_bonepose_t::FromMatrix(anim.frames[t].entries[i].local_transform);
+	}
+}
+
+void SMDHelper::ExpandAnimation(const s_compact_animation_t& compact, s_animation_t& anim)
+{
+	anim.name = compact.name;
+	anim.nodes = compact.nodes;
+	anim.frames.Resize(compact.num_frames, compact.nodes.size());
+	UpdateSkeleton(anim);
+
+	for (int t = 0; t < compact.num_frames; ++t)
+	{
+		for (int i = 0; i < compact.nodes.size(); ++i)
+			anim.frames[t].entries[i].local_transform = compact.GetLocalPose(i, t).ToMatrix();
+	}
+
+	BuildAnimationWorldTransform(anim);
+}
+
+s_bonepose_t SMDHelper::GetBonePoseInWorldSpace(const s_compact_animation_t& anim, const int bone, const int frame)
+{
+	s_bonepose_t pose = anim.GetLocalPose(bone, frame);
+
+	for (int parent = anim.nodes[bone].parent; parent != -1; parent = anim.nodes[parent].parent)
+		pose = anim.GetLocalPose(parent, frame) * pose;
+
+	return pose;
+}
+
+glm::vec3 SMDHelper::GetBonePositionInLocalSpace(const s_compact_animation_t& anim, const int bone, const int frame)
+{
+	return anim.GetLocalPose(bone, frame).translation;
+}
+
+glm::vec3 SMDHelper::GetBonePositionInWorldSpace(const s_compact_animation_t& anim, const int bone, const int frame)
+{
+	return GetBonePoseInWorldSpace(anim, bone, frame).translation;
+}
+
+glm::vec3 SMDHelper::GetBoneAnglesInLocalSpace(const s_compact_animation_t& anim, const int bone, const int frame)
+{
+	return anim.GetLocalPose(bone, frame).GetEulerAngles();
+}
+
+glm::vec3 SMDHelper::GetBoneAnglesInWorldSpace(const s_compact_animation_t& anim, const int bone, const int frame)
+{
+	return GetBonePoseInWorldSpace(anim, bone, frame).GetEulerAngles();
+}
+
+void SMDHelper::RotateBoneInLocalSpaceRelative(s_compact_animation_t& anim, int bone, const glm::vec3& angles)
+{
+	// Rotating about the bone axes, like the matrix version, is a right multiply.
+	const glm::quat rotation(angles);
+
+	for (int t = 0; t < anim.num_frames; ++t)
+	{
+		auto& pose = anim.GetLocalPose(bone, t);
+		pose.rotation = glm::normalize(pose.rotation * rotation);
+	}
+}
+
+void SMDHelper::TranslateBoneInLocalSpace(s_compact_animation_t& anim, int bone, const glm::vec3& translation)
+{
+	for (int t = 0; t < anim.num_frames; ++t)
+		anim.GetLocalPose(bone, t).translation += translation;
+}
+
+void SMDHelper::TranslateBoneInLocalSpaceRelative(s_compact_animation_t& anim, int bone, const glm::vec3& translation)
+{
+	for (int t = 0; t < anim.num_frames; ++t)
+	{
+		auto& pose = anim.GetLocalPose(bone, t);
+		pose.translation += pose.rotation * (translation * pose.scale);
+	}
+}
@@ -1,15 +1,26 @@
 #pragma once
 
 #include "studio.h"
+#include <cstdint>
+#include <string>
 #include <vector>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <functional>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtx/euler_angles.hpp"
+#include "glm/gtc/quaternion.hpp"
 
 #define SMD_VERSION 1
 
+class ThreadPool;
+class SMDAnimationArchive;
+
 typedef struct
 {
 	std::string name;
@@ -18,6 +29,105 @@ typedef struct
 	std::vector<int> children;
 } s_node_t;
 
+// Contiguous list of bone indices.
+class s_bone_range_t
+{
+public:
+	s_bone_range_t(const int* data, int size) : _data(data), _size(size)
+	{
+	}
+
+	inline int operator[](int i) const { return _data[i]; }
+	inline int size() const { return _size; }
+	inline const int* begin() const { return _data; }
+	inline const int* end() const { return _data + _size; }
+
+private:
+	const int* _data;
+	int _size;
+};
+
+// Case insensitive hash and comparison of bone names, like _stricmp.
+struct s_bone_name_hash_t
+{
+	using is_transparent = void;
+
+	size_t operator()(std::string_view name) const;
+};
+
+struct s_bone_name_equal_t
+{
+	using is_transparent = void;
+
+	bool operator()(std::string_view a, std::string_view b) const;
+};
+
+//
+// Linearized bone hierarchy.
+//
+// Bones are listed in depth first order, so every bone comes after its parent
+// and the bones of a subtree are contiguous. Updating a subtree is a single
+// forward loop over GetSubtree(bone), without recursion. Children are stored
+// in one array indexed by offsets, in bone index order.
+//
+// Bone names are indexed for case insensitive lookups.
+//
+// The skeleton is built from the node parents and names and does not follow
+// changes made to the nodes afterwards, see SMDHelper::UpdateSkeleton.
+//
+// The signature is a hash of the bone names and parents in order. Skeletons
+// with the same signature give the same bone for each name, see SMDBoneBinding.
+//
+class s_skeleton_t
+{
+public:
+	void Build(const std::vector<s_node_t>& nodes);
+	// Rebuild the name index only, after renaming nodes.
+	void UpdateNames(const std::vector<s_node_t>& nodes);
+
+	// First bone with this name, -1 if none.
+	inline int FindBone(std::string_view name) const {
+		auto it = _names.find(name);
+		return it != _names.end() ? it->second : -1;
+	}
+
+	inline int GetBoneCount() const { return static_cast<int>(_parents.size()); }
+	inline int GetParent(int bone) const { return _parents[bone]; }
+	inline uint64_t GetSignature() const { return _signature; }
+
+	// All the bones, parents before their children.
+	inline s_bone_range_t GetOrder() const { return { _order.data(), GetBoneCount() }; }
+	// Position in GetOrder() of the parent of the bone at each position, -1 for roots.
+	inline const std::vector<int>& GetOrderParents() const { return _order_parents; }
+	// Position of the bone in GetOrder(). Its subtree follows it.
+	inline int GetOrderIndex(int bone) const { return _order_index[bone]; }
+	inline int GetSubtreeSize(int bone) const { return _subtree_sizes[bone]; }
+
+	// The bone followed by all its descendants, parents before their children.
+	inline s_bone_range_t GetSubtree(int bone) const {
+		return { &_order[_order_index[bone]], _subtree_sizes[bone] };
+	}
+
+	inline bool IsInSubtree(int bone, int root) const {
+		return static_cast<unsigned int>(_order_index[bone] - _order_index[root]) < static_cast<unsigned int>(_subtree_sizes[root]);
+	}
+
+	inline s_bone_range_t GetChildren(int bone) const {
+		return { _children.data() + _child_offsets[bone], _child_offsets[bone + 1] - _child_offsets[bone] };
+	}
+
+private:
+	std::vector<int> _parents;
+	std::vector<int> _child_offsets;
+	std::vector<int> _children;
+	std::vector<int> _order;
+	std::vector<int> _order_parents;
+	std::vector<int> _order_index;
+	std::vector<int> _subtree_sizes;
+	std::unordered_map<std::string, int, s_bone_name_hash_t, s_bone_name_equal_t> _names;
+	uint64_t _signature = 0;
+};
+
 class s_nodetransform_t
 {
 	glm::mat4 m;
@@ -67,6 +177,129 @@ public:
 	inline glm::mat4 GetInverse() const { return glm::inverse(m); }
 };
 
+//
+// Affine transform kernels for bone matrices.
+//
+// The transform is kept in a glm::mat4 whose last row is always 0 0 0 1, so
+// converting from and to the frame entries is free. Products skip the
+// projective terms and give the same result as the glm::mat4 product. Bone
+// matrices read from SMD files are a rotation and a translation, so they are
+// inverted with a transpose instead of a general 4x4 inverse, which is cheaper
+// and does not accumulate error over long chains of edits. Matrices with a
+// scale, like the poses of compact animations can carry, take the general
+// inverse of the 3x3 part instead.
+//
+class s_affinetransform_t
+{
+public:
+	glm::mat4 m;
+
+	s_affinetransform_t() : m(glm::identity<glm::mat4>())
+	{
+	}
+
+	explicit s_affinetransform_t(const glm::mat4& p_m) : m(p_m)
+	{
+	}
+
+	inline const glm::mat4& ToMatrix() const { return m; }
+
+	inline s_affinetransform_t operator*(const s_affinetransform_t& other) const { return s_affinetransform_t(Multiply(m, other.m)); }
+	inline s_affinetransform_t GetInverse() const { return s_affinetransform_t(Inverse(m)); }
+
+	// Kernels working on the frame entry matrices in place.
+
+	static inline glm::mat4 Multiply(const glm::mat4& a, const glm::mat4& b) {
+		return glm::mat4(
+			a[0] * b[0][0] + a[1] * b[0][1] + a[2] * b[0][2],
+			a[0] * b[1][0] + a[1] * b[1][1] + a[2] * b[1][2],
+			a[0] * b[2][0] + a[1] * b[2][1] + a[2] * b[2][2],
+			a[0] * b[3][0] + a[1] * b[3][1] + a[2] * b[3][2] + a[3]
+		);
+	}
+
+	// True if the basis vectors have a length of 1, within float noise.
+	static inline bool HasUnitScale(const glm::mat4& a) {
+		const float tolerance = 1e-4f;
+		return std::abs(glm::dot(glm::vec3(a[0]), glm::vec3(a[0])) - 1.0f) < tolerance
+			&& std::abs(glm::dot(glm::vec3(a[1]), glm::vec3(a[1])) - 1.0f) < tolerance
+			&& std::abs(glm::dot(glm::vec3(a[2]), glm::vec3(a[2])) - 1.0f) < tolerance;
+	}
+
+	// Only valid when the basis is orthonormal.
+	static inline glm::mat4 RigidInverse(const glm::mat4& a) {
+		const glm::mat3 inv_basis = glm::transpose(glm::mat3(a));
+		glm::mat4 result(inv_basis);
+		result[3] = glm::vec4(-(inv_basis * glm::vec3(a[3])), 1.0f);
+		return result;
+	}
+
+	// Rigid inverse when the basis has no scale, general affine inverse otherwise.
+	static inline glm::mat4 Inverse(const glm::mat4& a) {
+		if (HasUnitScale(a))
+			return RigidInverse(a);
+
+		const glm::mat3 inv_basis = glm::inverse(glm::mat3(a));
+		glm::mat4 result(inv_basis);
+		result[3] = glm::vec4(-(inv_basis * glm::vec3(a[3])), 1.0f);
+		return result;
+	}
+
+	// inverse(a) * b.
+	static inline glm::mat4 InverseMultiply(const glm::mat4& a, const glm::mat4& b) {
+		return Multiply(Inverse(a), b);
+	}
+
+	inline glm::vec3 TransformPoint(const glm::vec3& p) const { return m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3]; }
+	inline glm::vec3 TransformVector(const glm::vec3& v) const { return m[0] * v.x + m[1] * v.y + m[2] * v.z; }
+};
+
+//
+// Bone transform stored as a rotation, a translation and a uniform scale.
+// It takes 32 bytes where a matrix takes 64, and composing two poses or
+// rotating one is cheaper than the matrix equivalent. Convert to a matrix
+// only where one is needed.
+//
+class s_bonepose_t
+{
+public:
+	glm::quat rotation;
+	glm::vec3 translation;
+	float scale;
+
+	s_bonepose_t() : rotation(glm::identity<glm::quat>()), translation(0.0f), scale(1.0f)
+	{
+	}
+
+	s_bonepose_t(const glm::quat& p_rotation, const glm::vec3& p_translation, float p_scale = 1.0f) :
+		rotation(p_rotation), translation(p_translation), scale(p_scale)
+	{
+	}
+
+	// Same rotation order as the SMD files, Z * Y * X.
+	static s_bonepose_t FromEulerAngles(const glm::vec3& angles, const glm::vec3& translation);
+	// The matrix must be a rotation with uniform scale and a translation.
+	static s_bonepose_t FromMatrix(const glm::mat4& m);
+
+	glm::mat4 ToMatrix() const;
+	glm::vec3 GetEulerAngles() const;
+
+	// Pose of other expressed in the space this pose is expressed in, like parent * child.
+	inline s_bonepose_t operator*(const s_bonepose_t& other) const {
+		return s_bonepose_t(rotation * other.rotation, TransformPoint(other.translation), scale * other.scale);
+	}
+
+	inline s_bonepose_t GetInverse() const {
+		const float inv_scale = 1.0f / scale;
+		const glm::quat inv_rotation = glm::conjugate(rotation);
+		return s_bonepose_t(inv_rotation, inv_rotation * (-translation * inv_scale), inv_scale);
+	}
+
+	inline glm::vec3 TransformPoint(const glm::vec3& p) const { return translation + rotation * (p * scale); }
+};
+
+static_assert(sizeof(s_bonepose_t) == 32, "s_bonepose_t should stay compact");
+
 struct s_animation_frame_entry_t
 {
 	glm::mat4 local_transform;
@@ -78,25 +311,519 @@ struct s_animation_frame_t
 	std::vector<s_animation_frame_entry_t> entries;
 };
 
+//
+// Frame storage.
+//
+// With SMD_FLAT_FRAME_STORAGE, all the frames of an animation share one contiguous
+// frame major buffer, and frames[t] returns a view over the bones of frame t.
+// Otherwise, each frame owns its own vector of entries.
+//
+// Both layouts have the same interface, so code that indexes frames[t].entries[i]
+// works with either. Code that changes the bone count must go through
+// Resize, AddFrame and RemapBones.
+//
+#ifndef SMD_FLAT_FRAME_STORAGE
+#define SMD_FLAT_FRAME_STORAGE 1
+#endif
+
+// Bones of a single frame in the flat layout.
+template<typename Entry>
+class s_animation_frame_entries_view_t
+{
+public:
+	s_animation_frame_entries_view_t(Entry* data, size_t size) : _data(data), _size(size)
+	{
+	}
+
+	inline Entry& operator[](size_t i) const { return _data[i]; }
+	inline size_t size() const { return _size; }
+	inline Entry* data() const { return _data; }
+	inline Entry* begin() const { return _data; }
+	inline Entry* end() const { return _data + _size; }
+
+private:
+	Entry* _data;
+	size_t _size;
+};
+
+template<typename Entry>
+struct s_animation_frame_view_t
+{
+	s_animation_frame_entries_view_t<Entry> entries;
+};
+
+class s_animation_frames_t
+{
+public:
+#if SMD_FLAT_FRAME_STORAGE
+	using frame_reference = s_animation_frame_view_t<s_animation_frame_entry_t>;
+	using const_frame_reference = s_animation_frame_view_t<const s_animation_frame_entry_t>;
+
+	inline frame_reference operator[](size_t t) { return { { &_entries[t * _num_bones], _num_bones } }; }
+	inline const_frame_reference operator[](size_t t) const { return { { &_entries[t * _num_bones], _num_bones } }; }
+
+	inline size_t size() const { return _num_frames; }
+	inline bool empty() const { return _num_frames == 0; }
+	inline int GetBoneCount() const { return static_cast<int>(_num_bones); }
+
+	// All entries, frame after frame, GetBoneCount() entries per frame.
+	inline s_animation_frame_entry_t* GetEntries() { return _entries.data(); }
+	inline const s_animation_frame_entry_t* GetEntries() const { return _entries.data(); }
+#else
+	using frame_reference = s_animation_frame_t&;
+	using const_frame_reference = const s_animation_frame_t&;
+
+	inline frame_reference operator[](size_t t) { return _frames[t]; }
+	inline const_frame_reference operator[](size_t t) const { return _frames[t]; }
+
+	inline size_t size() const { return _frames.size(); }
+	inline bool empty() const { return _frames.empty(); }
+	inline int GetBoneCount() const { return static_cast<int>(_num_bones); }
+#endif
+
+	inline frame_reference back() { return (*this)[size() - 1]; }
+	inline const_frame_reference back() const { return (*this)[size() - 1]; }
+
+	// Discard all frames and allocate num_frames frames of num_bones default entries.
+	void Resize(size_t num_frames, size_t num_bones);
+	// Append a frame of default entries. All frames must have the same bone count.
+	void AddFrame(size_t num_bones);
+	// Rearrange the bones of every frame. New bone i takes the entry of old bone
+	// new_to_old[i], or a default entry if new_to_old[i] is -1.
+	void RemapBones(const std::vector<int>& new_to_old);
+
+private:
+	size_t _num_bones = 0;
+#if SMD_FLAT_FRAME_STORAGE
+	size_t _num_frames = 0;
+	std::vector<s_animation_frame_entry_t> _entries;
+#else
+	std::vector<s_animation_frame_t> _frames;
+#endif
+};
+
 struct s_animation_t
 {
 	std::string name;
 	std::vector<s_node_t> nodes;
-	std::vector<s_animation_frame_t> frames;
+	s_animation_frames_t frames;
+	// Linearized hierarchy of the nodes, see SMDHelper::UpdateSkeleton.
+	s_skeleton_t skeleton;
+	// Bones whose local transform changed since the world transforms were last
+	// updated. Their world transform, and the ones of their children, are out of
+	// date in every frame. Empty when all world transforms are up to date.
+	// See SMDHelper::MarkBoneDirty and SMDHelper::UpdateWorldTransforms.
+	std::vector<bool> dirty_bones;
+};
+
+//
+// Animation holding only the local pose of each bone, frame after frame.
+// World space poses are computed on demand from the parents, so a bone takes
+// 32 bytes per frame instead of the 128 of s_animation_frame_entry_t.
+// Use SMDHelper::ExpandAnimation to get an s_animation_t for the operations
+// that work on matrices.
+//
+struct s_compact_animation_t
+{
+	std::string name;
+	std::vector<s_node_t> nodes;
+	size_t num_frames = 0;
+	// num_frames * nodes.size() poses.
+	std::vector<s_bonepose_t> local_poses;
+
+	inline size_t GetFrameCount() const { return num_frames; }
+	inline int GetBoneCount() const { return static_cast<int>(nodes.size()); }
+
+	inline s_bonepose_t& GetLocalPose(int bone, int frame) { return local_poses[frame * nodes.size() + bone]; }
+	inline const s_bonepose_t& GetLocalPose(int bone, int frame) const { return local_poses[frame * nodes.size() + bone]; }
+};
+
+//
+// List of hierarchy edits, applied together by SMDHelper::ApplySkeletonEdit.
+//
+// Edits apply in the order they were added, with the same result as calling
+// RemoveBone, AddBone, ReplaceBoneParent and RenameBone one after the other,
+// but the frames are rewritten once for the whole list. Bones are given by
+// name, each name is looked up once the edits before it are done.
+//
+class s_skeleton_edit_t
+{
+public:
+	inline void RemoveBone(const char* bone) {
+		_edits.push_back({ EditType::REMOVE_BONE, bone });
+	}
+
+	// Without a parent, the bone is added as a root.
+	inline void AddBone(const char* name, const glm::vec3& local_space_position, const glm::vec3& local_space_angles,
+		const char* parent = nullptr) {
+		_edits.push_back({ EditType::ADD_BONE, name, parent ? parent : "", local_space_position, local_space_angles });
+	}
+
+	inline void ReplaceBoneParent(const char* bone, const char* new_parent) {
+		_edits.push_back({ EditType::REPLACE_BONE_PARENT, bone, new_parent });
+	}
+
+	inline void RenameBone(const char* bone, const char* new_name) {
+		_edits.push_back({ EditType::RENAME_BONE, bone, new_name });
+	}
+
+	inline bool IsEmpty() const { return _edits.empty(); }
+
+private:
+	friend class SMDHelper;
+
+	enum class EditType
+	{
+		REMOVE_BONE,
+		ADD_BONE,
+		REPLACE_BONE_PARENT,
+		RENAME_BONE,
+	};
+
+	struct edit_t
+	{
+		EditType type;
+		std::string bone;
+		// Parent, new parent or new name.
+		std::string other = {};
+		glm::vec3 local_space_position = glm::vec3(0.0f);
+		glm::vec3 local_space_angles = glm::vec3(0.0f);
+	};
+
+	std::vector<edit_t> _edits;
 };
 
+//
+// List of bone moves, applied together by SMDHelper::ApplyBoneTransformEdit.
+//
+// Moves apply in the order they were added, with the same result as calling
+// the matching SMDHelper functions one after the other, but in a single pass
+// over the frames: each frame gets all the moves before the next one. Bones
+// are given by index or by name, names are looked up once for the whole list.
+// The world transforms moved out of date by local space moves are rebuilt once
+// before the next world space move instead of before each of them.
+//
+class s_bone_transform_edit_t
+{
+public:
+	inline void TranslateBoneInLocalSpace(const char* bone, const glm::vec3& translation) {
+		_edits.push_back({ EditType::TRANSLATE_LOCAL, bone, translation });
+	}
+
+	inline void TranslateBoneInLocalSpace(int bone, const glm::vec3& translation) {
+		_edits.push_back({ EditType::TRANSLATE_LOCAL, "", translation, bone });
+	}
+
+	inline void TranslateBoneInLocalSpaceRelative(const char* bone, const glm::vec3& translation) {
+		_edits.push_back({ EditType::TRANSLATE_LOCAL_RELATIVE, bone, translation });
+	}
+
+	inline void TranslateBoneInLocalSpaceRelative(int bone, const glm::vec3& translation) {
+		_edits.push_back({ EditType::TRANSLATE_LOCAL_RELATIVE, "", translation, bone });
+	}
+
+	inline void RotateBoneInLocalSpaceRelative(const char* bone, const glm::vec3& angles) {
+		_edits.push_back({ EditType::ROTATE_LOCAL_RELATIVE, bone, angles });
+	}
+
+	inline void RotateBoneInLocalSpaceRelative(int bone, const glm::vec3& angles) {
+		_edits.push_back({ EditType::ROTATE_LOCAL_RELATIVE, "", angles, bone });
+	}
+
+	inline void TranslateBoneInWorldSpace(const char* bone, const glm::vec3& translation) {
+		_edits.push_back({ EditType::TRANSLATE_WORLD, bone, translation });
+	}
+
+	inline void TranslateBoneInWorldSpace(int bone, const glm::vec3& translation) {
+		_edits.push_back({ EditType::TRANSLATE_WORLD, "", translation, bone });
+	}
+
+	inline void TranslateBoneInWorldSpaceRelative(const char* bone, const glm::vec3& translation) {
+		_edits.push_back({ EditType::TRANSLATE_WORLD_RELATIVE, bone, translation });
+	}
+
+	inline void TranslateBoneInWorldSpaceRelative(int bone, const glm::vec3& translation) {
+		_edits.push_back({ EditType::TRANSLATE_WORLD_RELATIVE, "", translation, bone });
+	}
+
+	inline void RotateBoneInWorldSpaceRelative(const char* bone, const glm::vec3& angles) {
+		_edits.push_back({ EditType::ROTATE_WORLD_RELATIVE, bone, angles });
+	}
+
+	inline void RotateBoneInWorldSpaceRelative(int bone, const glm::vec3& angles) {
+		_edits.push_back({ EditType::ROTATE_WORLD_RELATIVE, "", angles, bone });
+	}
+
+	inline bool IsEmpty() const { return _edits.empty(); }
+
+private:
+	friend class SMDHelper;
+
+	enum class EditType
+	{
+		TRANSLATE_LOCAL,
+		TRANSLATE_LOCAL_RELATIVE,
+		ROTATE_LOCAL_RELATIVE,
+		TRANSLATE_WORLD,
+		TRANSLATE_WORLD_RELATIVE,
+		ROTATE_WORLD_RELATIVE,
+	};
+
+	struct edit_t
+	{
+		EditType type;
+		// Empty when the bone is given by index.
+		std::string bone;
+		// Translation or angles.
+		glm::vec3 value;
+		int bone_index = -1;
+	};
+
+	std::vector<edit_t> _edits;
+};
+
+//
+// Bone names bound to bone indices, once per skeleton signature.
+//
+// Operations are shared by all the files of a pipeline, and most of these files
+// have the same skeleton. An operation adds the names it uses once, and Bind
+// looks them up the first time a skeleton signature is seen only. Can be used
+// from several threads.
+//
+class SMDBoneBinding
+{
+public:
+	// Position of the name in the bound indices.
+	int AddName(const char* name);
+	inline bool IsEmpty() const { return _names.empty(); }
+
+	// Bone of each name in the skeleton of the animation, in the order added.
+	// Throws std::invalid_argument listing the names not found.
+	const std::vector<int>& Bind(const s_animation_t& anim) const;
+
+private:
+	std::vector<std::string> _names;
+
+	mutable std::mutex _mutex;
+	// Indices are -1 for the names not found. Elements are not moved by rehashing.
+	mutable std::unordered_map<uint64_t, std::vector<int>> _bindings;
+};
+
+enum class SMDLoadMode
+{
+	// Read the file line by line with fgets and sscanf.
+	STREAM = 0,
+	// Map the whole file in memory and tokenize it in place.
+	MEMORY_MAPPED = 1,
+};
+
+struct SMDLoadError
+{
+	std::string file_path;
+	// Line where the error was found, 0 if it is not tied to a line.
+	int line = 0;
+	std::string message;
+
+	std::string ToString() const;
+};
+
+class SMDLoadException : public std::runtime_error
+{
+public:
+	SMDLoadException(const SMDLoadError& error) : std::runtime_error(error.ToString()), _error(error)
+	{
+	}
+
+	const SMDLoadError& GetError() const { return _error; }
+
+private:
+	SMDLoadError _error;
+};
+
+//
+// Binary cache of parsed animations, see SMDFileLoader::SetCacheDirectory.
+//
+// Each source file gets an entry in the cache directory holding its nodes and
+// frames as they are in memory, keyed by the absolute source path, its
+// modification time and size, and the cache format. Entries are memory mapped
+// and copied into the animation without parsing any text. An entry that does
+// not match its source anymore is ignored, and replaced after the next parse.
+//
+class SMDAnimationCache
+{
+public:
+	SMDAnimationCache() = default;
+	SMDAnimationCache(const char* directory, bool world_transforms) :
+		_directory(directory ? directory : ""), _world_transforms(world_transforms)
+	{
+	}
+
+	// Version of a source file, taken before it is parsed so that an edit made
+	// while parsing does not end up in the cache under the new version.
+	struct SourceVersion
+	{
+		std::string path;
+		int64_t time = 0;
+		uint64_t size = 0;
+	};
+
+	inline bool IsEnabled() const { return !_directory.empty(); }
+
+	// Returns false if there is no up to date entry for the source file, version
+	// is then set to pass to Store once the file is parsed. It is left empty if the
+	// source file cannot be read.
+	bool TryLoad(const char* source_path, s_animation_t& anim, SourceVersion& version) const;
+	// Writes the entry of a freshly parsed file. Failures are ignored, the file is
+	// parsed again next time. Builds the world transforms first if they are cached.
+	void Store(const SourceVersion& version, s_animation_t& anim) const;
+
+private:
+	std::string _directory;
+	bool _world_transforms = false;
+};
 
+// Loaders hold no parsing state, a single instance can be used from any number of threads.
 class SMDFileLoader
 {
 public:
+	SMDFileLoader(SMDLoadMode mode = SMDLoadMode::MEMORY_MAPPED) : _mode(mode)
+	{
+	}
+
+	// Keep the parsed animations in a binary cache in directory, and load them from
+	// it as long as their source file does not change. Off when directory is empty.
+	// With world_transforms, the world transforms are built before the entry is
+	// written and loaded from it too. Only s_animation_t loads use the cache.
+	inline void SetCacheDirectory(const char* directory, bool world_transforms = false) {
+		_cache = SMDAnimationCache(directory, world_transforms);
+	}
+
+	// Load the files packed in the archive from it, see SMDAnimationArchive. The
+	// archive must stay open while the loader is used. Only s_animation_t loads
+	// use the archive, the other files are loaded as usual.
+	inline void SetArchive(const SMDAnimationArchive* archive) { _archive = archive; }
+
+	// Throws SMDLoadException if the file cannot be loaded.
 	void LoadAnimation( const char* file_path, s_animation_t& anim ) const;
+	// Returns false and fills error if the file cannot be loaded.
+	bool TryLoadAnimation( const char* file_path, s_animation_t& anim, SMDLoadError& error ) const;
+
+	// Same for compact animations, the bone poses are built without going through matrices.
+	void LoadAnimation( const char* file_path, s_compact_animation_t& anim ) const;
+	bool TryLoadAnimation( const char* file_path, s_compact_animation_t& anim, SMDLoadError& error ) const;
+
+private:
+	SMDLoadMode _mode;
+	SMDAnimationCache _cache;
+	const SMDAnimationArchive* _archive = nullptr;
+};
+
+//
+// Process wide cache of loaded animations, shared read only.
+//
+// Animations are keyed by absolute path, and by the modification time and size
+// of the file so that a file written since is loaded again. An animation stays
+// in the cache for as long as it is in use: load it through the cache again
+// while holding it to share it. Callers that edit the animation work on a copy.
+//
+class SMDSharedAnimationCache
+{
+public:
+	// Animation of the file, loaded with loader unless it is already in use.
+	// Threads loading the same file at the same time share a single load.
+	// Throws SMDLoadException if the file cannot be loaded.
+	static std::shared_ptr<const s_animation_t> Load(const SMDFileLoader& loader, const char* file_path);
+
+	// The animations loaded from the path, a file or a directory, are kept even
+	// when nobody uses them, for callers that load the same files one after
+	// another. They are released once the path is released as many times as it
+	// was retained.
+	static void Retain(const char* path);
+	static void Release(const char* path);
+};
+
+enum class SMDOutputMode
+{
+	// Animation files are written to disk.
+	DISK = 0,
+	// Animation files are only kept in memory.
+	MEMORY = 1,
+	// Animation files are kept in memory and written to disk.
+	MEMORY_AND_DISK = 2,
+};
+
+//
+// Animation files kept in memory, to chain conversions without going through disk.
+//
+// Outside of the DISK output mode, SMDSerializer::WriteAnimation keeps the
+// animation in memory under its file path, and SMDFileLoader and
+// SMDSharedAnimationCache read it from there instead of parsing the file.
+// The animations are not rounded to the precision of the text format. Files
+// are keyed by absolute path, and stay in memory until they are cleared or
+// until the same path is written to disk.
+//
+class SMDMemoryFiles
+{
+public:
+	// Output mode of the serializers created afterwards by the calling thread,
+	// DISK by default. Each serializer keeps the mode it was created with, so
+	// conversions running on other threads are not affected.
+	static void SetOutputMode(SMDOutputMode mode);
+	static SMDOutputMode GetOutputMode();
+
+	// Animation last written in memory to the path, null if none.
+	static std::shared_ptr<const s_animation_t> Find(const char* file_path);
+	static void Store(const char* file_path, const s_animation_t& anim);
+	static void Remove(const char* file_path);
+	// Forget the files below directory.
+	static void ClearDirectory(const char* directory);
+	static void Clear();
+};
+
+enum class SMDFloatFormat
+{
+	// Six decimals, like printf("%f").
+	FIXED = 0,
+	// Shortest decimals that read back to the same float, without exponent.
+	SHORTEST = 1,
+};
+
+enum class SMDWriteResult
+{
+	WRITTEN = 0,
+	// The file already had the same content and was not touched.
+	UNCHANGED = 1,
 };
 
 class SMDSerializer
 {
 public:
-	void WriteAnimation(const s_animation_t& anim, const char* output_path) const;
+	SMDSerializer(SMDFloatFormat float_format = SMDFloatFormat::FIXED) : _float_format(float_format)
+	{
+	}
+
+	// Animations are formatted in memory and compared with the existing file first,
+	// files with the same content keep their modification time. On by default.
+	void SetSkipUnchangedFiles(bool skip_unchanged_files) { _skip_unchanged_files = skip_unchanged_files; }
+
+	SMDFloatFormat GetFloatFormat() const { return _float_format; }
+
+	// Where the animations go, see SMDMemoryFiles. Defaults to the output mode
+	// of the thread that creates the serializer.
+	void SetOutputMode(SMDOutputMode output_mode) { _output_mode = output_mode; }
+	SMDOutputMode GetOutputMode() const { return _output_mode; }
+
+	// Throws std::runtime_error if the file cannot be opened for writing.
+	SMDWriteResult WriteAnimation(const s_animation_t& anim, const char* output_path) const;
+	SMDWriteResult WriteAnimation(const s_compact_animation_t& anim, const char* output_path) const;
 	void WriteOBJ(const s_animation_t& anim, const char* output_path) const;
+
+private:
+	SMDWriteResult WriteFile(const char* output_path, std::string_view data) const;
+
+	SMDFloatFormat _float_format;
+	bool _skip_unchanged_files = true;
+	SMDOutputMode _output_mode = SMDMemoryFiles::GetOutputMode();
 };
 
 using BoneMappingEntry = std::pair<std::string, std::string>;
@@ -124,6 +851,12 @@ public:
 	static void TranslateBoneInWorldSpaceRelative(s_animation_t& anim, int bone, const glm::vec3& translation);
 	static void TranslateBoneInLocalSpaceRelative(s_animation_t& anim, int bone, const glm::vec3& translation);
 	static void RenameBone(s_animation_t& anim, int bone, const char* new_name);
+	// Apply all the edits of the list, rewriting the frames once.
+	// Throws std::invalid_argument if a bone is not found or a new name is already used.
+	static void ApplySkeletonEdit(s_animation_t& anim, const s_skeleton_edit_t& edit);
+	// Apply all the moves of the list in one pass over the frames.
+	// Throws std::invalid_argument before moving anything if a bone is not found or out of range.
+	static void ApplyBoneTransformEdit(s_animation_t& anim, const s_bone_transform_edit_t& edit);
 	// Make all bones in the animation match the length of the input reference.
 	static void FixupBonesLengths(s_animation_t& anim, const s_animation_t& input_reference);
 	// Move pelvis position so that animation foots are between the ones in the original animation.
@@ -136,6 +869,15 @@ public:
 		const char* original_anim_left_foot_name,
 		const char* original_anim_right_foot_name
 	);
+	static void SolveFoots(
+		s_animation_t& anim,
+		int anim_left_foot,
+		int anim_right_foot,
+		int anim_pelvis,
+		const s_animation_t& original_animation,
+		int original_anim_left_foot,
+		int original_anim_right_foot
+	);
 	// Move pelvis position so that animation foot is at the same as the one in the original animation.
 	static void SolveFoot(
 		s_animation_t& anim,
@@ -144,6 +886,13 @@ public:
 		const s_animation_t& original_animation,
 		const char* original_anim_foot_name
 	);
+	static void SolveFoot(
+		s_animation_t& anim,
+		int anim_foot,
+		int anim_pelvis,
+		const s_animation_t& original_animation,
+		int original_anim_foot
+	);
 	static void TranslateToBoneInWorldSpace(
 		s_animation_t& anim,
 		int bone,
@@ -180,10 +929,89 @@ public:
 	);
 
 	static int FindNodeByName(const std::vector<s_node_t>& nodes, const char* name);
+	// Same as above, using the name index of the animation skeleton.
+	static int FindNodeByName(const s_animation_t& anim, const char* name);
+
+	// Compact animations.
+
+	static void CompactAnimation(const s_animation_t& anim, s_compact_animation_t& compact);
+	static void ExpandAnimation(const s_compact_animation_t& compact, s_animation_t& anim);
+	static s_bonepose_t GetBonePoseInWorldSpace(const s_compact_animation_t& anim, const int bone, const int frame);
+	static glm::vec3 GetBonePositionInLocalSpace(const s_compact_animation_t& anim, const int bone, const int frame);
+	static glm::vec3 GetBonePositionInWorldSpace(const s_compact_animation_t& anim, const int bone, const int frame);
+	static glm::vec3 GetBoneAnglesInLocalSpace(const s_compact_animation_t& anim, const int bone, const int frame);
+	static glm::vec3 GetBoneAnglesInWorldSpace(const s_compact_animation_t& anim, const int bone, const int frame);
+	// Rotating a bone about its own axes gives the same result in local and world space,
+	// and only the local poses are stored, so children need no update.
+	static void RotateBoneInLocalSpaceRelative(s_compact_animation_t& anim, int bone, const glm::vec3& angles);
+	static void TranslateBoneInLocalSpace(s_compact_animation_t& anim, int bone, const glm::vec3& translation);
+	static void TranslateBoneInLocalSpaceRelative(s_compact_animation_t& anim, int bone, const glm::vec3& translation);
+
+
+	// Lazy world transforms.
+	//
+	// Local space edits only mark the edited bone dirty. The world transforms of the
+	// dirty bones and their children are rebuilt in a single pass the first time world
+	// space is read, so a chain of edits does not update the same bones again and again.
+	// An animation read from several threads must be updated before it is shared.
+
+	static void MarkBoneDirty(s_animation_t& anim, int bone);
+	static void MarkAllBonesDirty(s_animation_t& anim);
+	static bool HasDirtyBones(const s_animation_t& anim);
+	static void UpdateWorldTransforms(s_animation_t& anim);
+
+	// Rebuild anim.skeleton after changing the hierarchy of anim.nodes.
+	// The SMDHelper functions that change the hierarchy do it themselves.
+	static void UpdateSkeleton(s_animation_t& anim);
+
+
+	// Frame parallel execution.
+	//
+	// With a thread pool set, the functions going through every frame of an
+	// animation split the frames in ranges run by the pool. Frames do not depend
+	// on each other, results are identical to serial execution. Animations with
+	// too little work to share stay on the calling thread. nullptr turns it off.
+	// The pool is set per thread, so pipelines running at the same time each
+	// use their own.
+
+	static void SetThreadPool(ThreadPool* pool);
+	static ThreadPool* GetThreadPool();
+
+	// Set the thread pool of the calling thread for as long as the scope exists.
+	class ThreadPoolScope
+	{
+	public:
+		ThreadPoolScope(ThreadPool* pool) : _previous(GetThreadPool())
+		{
+			SetThreadPool(pool);
+		}
+
+		~ThreadPoolScope()
+		{
+			SetThreadPool(_previous);
+		}
+
+		ThreadPoolScope(const ThreadPoolScope&) = delete;
+		ThreadPoolScope& operator=(const ThreadPoolScope&) = delete;
+
+	private:
+		ThreadPool* _previous;
+	};
 
 
 	// Private
 
+	// World transforms are a cache of the local transforms, they are updated
+	// on animations received as const as well.
+	static void EnsureWorldTransforms(const s_animation_t& anim);
+	// anim.skeleton, rebuilt first if the bone count changed since it was built.
+	static const s_skeleton_t& GetSkeleton(const s_animation_t& anim);
+	// Call fn(begin, end) over ranges covering all the frames of the animation, on the
+	// thread pool if there is enough work. work_per_frame is about the number of bone
+	// transforms computed per frame. fn must only touch the frames of its range.
+	static void ForEachFrameRange(const s_animation_t& anim, size_t work_per_frame,
+		const std::function<void(int begin, int end)>& fn);
+
 	static void BuildAnimationWorldTransform(s_animation_t& anim);
 	static void UpdateBoneHierarchyLocalTransformFromWorldTransform(s_animation_t& anim, int bone, int frame);
 	static void UpdateBoneHierarchyLocalTransformFromWorldTransform(s_animation_t& anim, int bone);
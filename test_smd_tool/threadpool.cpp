@@ -0,0 +1,238 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+
+static thread_local const ThreadPool* t_worker_pool = nullptr;
+static thread_local int t_worker_index = -1;
+
+ThreadPool::ThreadPool(int num_workers)
+{
+	if (num_workers <= 0)
+		num_workers = std::max(1u, std::thread::hardware_concurrency());
+
+	_queues.reserve(num_workers);
+	for (int i = 0; i < num_workers; ++i)
+		_queues.push_back(std::make_unique<WorkerQueue>());
+
+	_threads.reserve(num_workers);
+	for (int i = 0; i < num_workers; ++i)
+		_threads.emplace_back(&ThreadPool::WorkerMain, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_wake_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+
+	for (auto& thread : _threads)
+		thread.join();
+}
+
+int ThreadPool::GetCurrentWorkerIndex()
+{
+	return t_worker_index;
+}
+
+void ThreadPool::Submit(TaskGroup& group, Task task)
+{
+	group._pending.fetch_add(1, std::memory_order_relaxed);
+
+	// Workers push on their own queue, other threads spread tasks over all queues.
+	int index = t_worker_pool == this ? t_worker_index : static_cast<int>(_next_queue++ % _queues.size());
+
+	{
+		std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+		_queues[index]->tasks.push_back({ &group, std::move(task) });
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_wake_mutex);
+		_queued.fetch_add(1, std::memory_order_relaxed);
+	}
+	_wake.notify_one();
+}
+
+void ThreadPool::Wait(TaskGroup& group)
+{
+	Wait(group, nullptr);
+}
+
+void ThreadPool::Wait(TaskGroup& group, const TaskGroup* only_group)
+{
+	while (group._pending.load(std::memory_order_acquire) > 0)
+	{
+		if (TryRunTask(only_group))
+			continue;
+
+		// Nothing to run, the remaining tasks are running on other threads.
+		// Wake up from time to time in case they queue more work.
+		std::unique_lock<std::mutex> lock(group._mutex);
+		group._done.wait_for(lock, std::chrono::milliseconds(1), [&group]() {
+			return group._pending.load(std::memory_order_acquire) == 0;
+		});
+	}
+
+	std::exception_ptr exception;
+	{
+		std::lock_guard<std::mutex> lock(group._mutex);
+		std::swap(exception, group._exception);
+	}
+
+	if (exception)
+		std::rethrow_exception(exception);
+}
+
+void ThreadPool::ParallelFor(int count, int grain, const std::function<void(int begin, int end)>& fn)
+{
+	if (count <= 0)
+		return;
+
+	grain = std::max(1, grain);
+
+	if (count <= grain)
+	{
+		fn(0, count);
+		return;
+	}
+
+	TaskGroup group;
+	for (int begin = grain; begin < count; begin += grain)
+	{
+		int end = std::min(begin + grain, count);
+		Submit(group, [&fn, begin, end]() { fn(begin, end); });
+	}
+
+	// The calling thread takes the first range.
+	std::exception_ptr exception;
+	try
+	{
+		fn(0, grain);
+	}
+	catch (...)
+	{
+		exception = std::current_exception();
+	}
+
+	// Running an unrelated task here would run it inside the caller's task.
+	Wait(group, &group);
+
+	if (exception)
+		std::rethrow_exception(exception);
+}
+
+void ThreadPool::WorkerMain(int index)
+{
+	t_worker_pool = this;
+	t_worker_index = index;
+
+	while (true)
+	{
+		if (TryRunTask())
+			continue;
+
+		std::unique_lock<std::mutex> lock(_wake_mutex);
+		_wake.wait(lock, [this]() { return _stop || _queued.load(std::memory_order_relaxed) > 0; });
+
+		if (_stop && _queued.load(std::memory_order_relaxed) == 0)
+			break;
+	}
+
+	t_worker_pool = nullptr;
+	t_worker_index = -1;
+}
+
+bool ThreadPool::TryRunTask(const TaskGroup* only_group)
+{
+	QueuedTask queued;
+
+	int index = t_worker_pool == this ? t_worker_index : -1;
+	if ((index != -1 && TryPop(index, only_group, queued)) || TrySteal(index, only_group, queued))
+	{
+		Run(queued);
+		return true;
+	}
+
+	return false;
+}
+
+bool ThreadPool::TryPop(int index, const TaskGroup* only_group, QueuedTask& out)
+{
+	auto& queue = *_queues[index];
+
+	std::lock_guard<std::mutex> lock(queue.mutex);
+
+	// Newest task first.
+	for (auto it = queue.tasks.rbegin(); it != queue.tasks.rend(); ++it)
+	{
+		if (only_group && it->group != only_group)
+			continue;
+
+		out = std::move(*it);
+		queue.tasks.erase(std::next(it).base());
+		_queued.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	return false;
+}
+
+bool ThreadPool::TrySteal(int thief, const TaskGroup* only_group, QueuedTask& out)
+{
+	const int num_queues = static_cast<int>(_queues.size());
+	const int start = thief == -1 ? 0 : thief + 1;
+
+	for (int i = 0; i < num_queues; ++i)
+	{
+		int index = (start + i) % num_queues;
+		if (index == thief)
+			continue;
+
+		auto& queue = *_queues[index];
+
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		// Oldest task first.
+		for (auto it = queue.tasks.begin(); it != queue.tasks.end(); ++it)
+		{
+			if (only_group && it->group != only_group)
+				continue;
+
+			out = std::move(*it);
+			queue.tasks.erase(it);
+			_queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::Run(QueuedTask& queued)
+{
+	TaskGroup& group = *queued.group;
+
+	try
+	{
+		queued.task();
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(group._mutex);
+		if (!group._exception)
+			group._exception = std::current_exception();
+	}
+
+	// Release the task before signaling, it may reference the waiter's stack.
+	queued.task = nullptr;
+
+	// The waiter takes the group mutex before returning, holding it here keeps
+	// the group alive until we are done with it.
+	std::lock_guard<std::mutex> lock(group._mutex);
+	if (group._pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		group._done.notify_all();
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Work stealing thread pool.
+//
+// Each worker owns a task queue. Workers run their own tasks newest first and
+// steal the oldest task of another worker when their queue is empty. Threads
+// waiting on a task group run queued tasks instead of blocking, so tasks can
+// safely submit and wait on tasks of their own.
+//
+class ThreadPool
+{
+public:
+	using Task = std::function<void()>;
+
+	// Set of tasks that can be waited on together.
+	class TaskGroup
+	{
+	public:
+		TaskGroup() = default;
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup& operator=(const TaskGroup&) = delete;
+
+	private:
+		friend class ThreadPool;
+
+		std::atomic<int> _pending{ 0 };
+		std::exception_ptr _exception;
+		std::mutex _mutex;
+		std::condition_variable _done;
+	};
+
+	// A worker count of 0 or less starts one worker per hardware thread.
+	explicit ThreadPool(int num_workers = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int GetWorkerCount() const { return static_cast<int>(_threads.size()); }
+
+	void Submit(TaskGroup& group, Task task);
+	// Wait for every task of the group, running queued tasks meanwhile.
+	// Rethrows the first exception thrown by a task of the group.
+	void Wait(TaskGroup& group);
+
+	// Call fn(begin, end) over [0, count) split in ranges of at most grain items.
+	// While waiting, the calling thread only runs ranges of this call, so it can
+	// be called from a task that has thread local state, like a log capture.
+	void ParallelFor(int count, int grain, const std::function<void(int begin, int end)>& fn);
+
+	// Returns the index of the calling worker, -1 if not called from a worker of any pool.
+	static int GetCurrentWorkerIndex();
+
+private:
+	struct QueuedTask
+	{
+		TaskGroup* group;
+		Task task;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<QueuedTask> tasks;
+	};
+
+	void WorkerMain(int index);
+	// With only_group set, only tasks of that group are considered.
+	void Wait(TaskGroup& group, const TaskGroup* only_group);
+	bool TryRunTask(const TaskGroup* only_group = nullptr);
+	bool TryPop(int index, const TaskGroup* only_group, QueuedTask& out);
+	bool TrySteal(int thief, const TaskGroup* only_group, QueuedTask& out);
+	void Run(QueuedTask& queued);
+
+	std::vector<std::unique_ptr<WorkerQueue>> _queues;
+	std::vector<std::thread> _threads;
+
+	std::mutex _wake_mutex;
+	std::condition_variable _wake;
+	std::atomic<int> _queued{ 0 };
+	std::atomic<unsigned int> _next_queue{ 0 };
+	bool _stop = false;
+};
+
+//
+// First in first out queue between two threads, holding at most capacity items.
+//
+// Push blocks while the queue is full and Pop while it is empty, so a fast
+// producer cannot get more than capacity items ahead of its consumer. Once the
+// producer calls Close, Pop returns the remaining items then false.
+//
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : _capacity(capacity > 0 ? capacity : 1)
+	{
+	}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	void Push(T item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_not_full.wait(lock, [this]() { return _items.size() < _capacity; });
+		_items.push_back(std::move(item));
+		_not_empty.notify_one();
+	}
+
+	bool Pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_not_empty.wait(lock, [this]() { return !_items.empty() || _closed; });
+		if (_items.empty())
+			return false;
+
+		item = std::move(_items.front());
+		_items.pop_front();
+		_not_full.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_closed = true;
+		_not_empty.notify_all();
+	}
+
+private:
+	const size_t _capacity;
+	std::mutex _mutex;
+	std::condition_variable _not_full;
+	std::condition_variable _not_empty;
+	std::deque<T> _items;
+	bool _closed = false;
+};
@@ -0,0 +1,455 @@
+#include "transformkernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+// SSE2 is always there on x64, 32 bit builds must enable it.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || (defined(__i386__) && defined(__SSE2__))
+#define TRANSFORM_KERNELS_X86 1
+#else
+#define TRANSFORM_KERNELS_X86 0
+#endif
+
+#if TRANSFORM_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles AVX intrinsics in any function.
+#define TARGET_AVX
+#else
+#include <cpuid.h>
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
+
+using transform_kernel_fn = void (*)(s_animation_frame_entry_t* entries, const s_node_t* nodes, const int* bones, int count);
+
+static void build_world_transforms_scalar(s_animation_frame_entry_t* entries, const s_node_t* nodes, const int* bones, int count)
+{
+	for (int k = 0; k < count; ++k)
+	{
+		const int i = bones[k];
+		auto& node = entries[i];
+
+		if (nodes[i].parent == -1)
+			node.world_transform = node.local_transform;
+		else
+			node.world_transform = s_affinetransform_t::Multiply(entries[nodes[i].parent].world_transform, node.local_transform);
+	}
+}
+
+#if TRANSFORM_KERNELS_X86
+
+// Matrices are 16 floats, column after column. Column j of a * b is
+// a[0] * b[j][0] + a[1] * b[j][1] + a[2] * b[j][2], plus a[3] for the translation.
+
+static inline void multiply_sse(const float* a, const float* b, float* out)
+{
+	const __m128 a0 = _mm_loadu_ps(a);
+	const __m128 a1 = _mm_loadu_ps(a + 4);
+	const __m128 a2 = _mm_loadu_ps(a + 8);
+	const __m128 a3 = _mm_loadu_ps(a + 12);
+
+	for (int j = 0; j < 4; ++j)
+	{
+		const __m128 column = _mm_loadu_ps(b + j * 4);
+
+		__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(column, column, 0x00));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(column, column, 0x55)));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(column, column, 0xAA)));
+		if (j == 3)
+			r = _mm_add_ps(r, a3);
+
+		_mm_storeu_ps(out + j * 4, r);
+	}
+}
+
+static void build_world_transforms_sse(s_animation_frame_entry_t* entries, const s_node_t* nodes, const int* bones, int count)
+{
+	for (int k = 0; k < count; ++k)
+	{
+		const int i = bones[k];
+		auto& node = entries[i];
+
+		if (nodes[i].parent == -1)
+			node.world_transform = node.local_transform;
+		else
+			multiply_sse(&entries[nodes[i].parent].world_transform[0][0], &node.local_transform[0][0], &node.world_transform[0][0]);
+	}
+}
+
+// The two halves of a register hold two columns. The parent columns are
+// repeated in both halves and the elements of the two local columns are
+// repeated within their half.
+TARGET_AVX static inline void multiply_avx(const float* a, const float* b, float* out)
+{
+	const __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a));
+	const __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 4));
+	const __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 8));
+	const __m128 a3 = _mm_loadu_ps(a + 12);
+
+	const __m256 b01 = _mm256_loadu_ps(b);
+	const __m256 b23 = _mm256_loadu_ps(b + 8);
+
+	__m256 r01 = _mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00));
+	r01 = _mm256_add_ps(r01, _mm256_mul_ps(a1, _mm256_permute_ps(b01, 0x55)));
+	r01 = _mm256_add_ps(r01, _mm256_mul_ps(a2, _mm256_permute_ps(b01, 0xAA)));
+
+	__m256 r23 = _mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00));
+	r23 = _mm256_add_ps(r23, _mm256_mul_ps(a1, _mm256_permute_ps(b23, 0x55)));
+	r23 = _mm256_add_ps(r23, _mm256_mul_ps(a2, _mm256_permute_ps(b23, 0xAA)));
+
+	_mm256_storeu_ps(out, r01);
+	_mm_storeu_ps(out + 8, _mm256_castps256_ps128(r23));
+	_mm_storeu_ps(out + 12, _mm_add_ps(_mm256_extractf128_ps(r23, 1), a3));
+}
+
+TARGET_AVX static void build_world_transforms_avx(s_animation_frame_entry_t* entries, const s_node_t* nodes, const int* bones, int count)
+{
+	for (int k = 0; k < count; ++k)
+	{
+		const int i = bones[k];
+		auto& node = entries[i];
+
+		if (nodes[i].parent == -1)
+			node.world_transform = node.local_transform;
+		else
+			multiply_avx(&entries[nodes[i].parent].world_transform[0][0], &node.local_transform[0][0], &node.world_transform[0][0]);
+	}
+}
+
+static bool cpu_supports_avx()
+{
+	unsigned int ecx;
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	ecx = static_cast<unsigned int>(info[2]);
+#else
+	unsigned int eax, ebx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+#endif
+
+	// The CPU must support AVX, and the OS must save the YMM registers.
+	const unsigned int OSXSAVE = 1u << 27;
+	const unsigned int AVX = 1u << 28;
+	if ((ecx & (OSXSAVE | AVX)) != (OSXSAVE | AVX))
+		return false;
+
+#ifdef _MSC_VER
+	const unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0_lo, xcr0_hi;
+	__asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	const unsigned long long xcr0 = xcr0_lo | (static_cast<unsigned long long>(xcr0_hi) << 32);
+#endif
+
+	return (xcr0 & 0x6) == 0x6;
+}
+
+#endif
+
+static transform_kernel_fn get_kernel_function(TransformKernel kernel)
+{
+	switch (kernel)
+	{
+#if TRANSFORM_KERNELS_X86
+	case TransformKernel::AVX:
+		return build_world_transforms_avx;
+	case TransformKernel::SSE:
+		return build_world_transforms_sse;
+#endif
+	default:
+		return build_world_transforms_scalar;
+	}
+}
+
+static bool is_kernel_available(TransformKernel kernel)
+{
+	switch (kernel)
+	{
+#if TRANSFORM_KERNELS_X86
+	case TransformKernel::AVX:
+	{
+		static const bool avx = cpu_supports_avx();
+		return avx;
+	}
+	case TransformKernel::SSE:
+		return true;
+#endif
+	case TransformKernel::SCALAR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+TransformKernel GetSupportedTransformKernel()
+{
+	// The SSE kernel is slower than the scalar one, only use it when selected.
+	return is_kernel_available(TransformKernel::AVX) ? TransformKernel::AVX : TransformKernel::SCALAR;
+}
+
+static std::atomic<TransformKernel> s_kernel{ GetSupportedTransformKernel() };
+static std::atomic<transform_kernel_fn> s_kernel_function{ get_kernel_function(GetSupportedTransformKernel()) };
+
+TransformKernel GetTransformKernel()
+{
+	return s_kernel.load(std::memory_order_relaxed);
+}
+
+void SetTransformKernel(TransformKernel kernel)
+{
+	if (!is_kernel_available(kernel))
+		kernel = GetSupportedTransformKernel();
+
+	s_kernel.store(kernel, std::memory_order_relaxed);
+	s_kernel_function.store(get_kernel_function(kernel), std::memory_order_relaxed);
+}
+
+const char* GetTransformKernelName(TransformKernel kernel)
+{
+	switch (kernel)
+	{
+	case TransformKernel::AVX:
+		return "AVX";
+	case TransformKernel::SSE:
+		return "SSE";
+	default:
+		return "scalar";
+	}
+}
+
+void BuildWorldTransforms(s_animation_frame_entry_t* entries, const s_node_t* nodes, const int* bones, int count)
+{
+	s_kernel_function.load(std::memory_order_relaxed)(entries, nodes, bones, count);
+}
+
+// Bones converted together, the block is kept on the stack as structure of arrays.
+static constexpr int EULER_BLOCK_SIZE = 64;
+
+#if TRANSFORM_KERNELS_X86
+
+// sin and cos of 4 angles with the Cephes single precision polynomials.
+// The angle is reduced to [-pi/4, pi/4] around a multiple of pi/2 with an
+// extended precision pi/2, and the octant picks the polynomial and the signs.
+static inline void sincos_ps(__m128 x, __m128& s, __m128& c)
+{
+	const __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+	__m128 sign_sin = _mm_and_ps(x, sign_mask);
+	x = _mm_andnot_ps(sign_mask, x);
+
+	// Octant, rounded up to even.
+	__m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+	j = _mm_add_epi32(j, _mm_set1_epi32(1));
+	j = _mm_and_si128(j, _mm_set1_epi32(~1));
+	const __m128 y = _mm_cvtepi32_ps(j);
+
+	sign_sin = _mm_xor_ps(sign_sin, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29)));
+	const __m128 sign_cos = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+	const __m128 use_sin_poly = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+
+	const __m128 z = _mm_mul_ps(x, x);
+
+	__m128 poly_cos = _mm_set1_ps(2.443315711809948e-5f);
+	poly_cos = _mm_add_ps(_mm_mul_ps(poly_cos, z), _mm_set1_ps(-1.388731625493765e-3f));
+	poly_cos = _mm_add_ps(_mm_mul_ps(poly_cos, z), _mm_set1_ps(4.166664568298827e-2f));
+	poly_cos = _mm_mul_ps(_mm_mul_ps(poly_cos, z), z);
+	poly_cos = _mm_sub_ps(poly_cos, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+	poly_cos = _mm_add_ps(poly_cos, _mm_set1_ps(1.0f));
+
+	__m128 poly_sin = _mm_set1_ps(-1.9515295891e-4f);
+	poly_sin = _mm_add_ps(_mm_mul_ps(poly_sin, z), _mm_set1_ps(8.3321608736e-3f));
+	poly_sin = _mm_add_ps(_mm_mul_ps(poly_sin, z), _mm_set1_ps(-1.6666654611e-1f));
+	poly_sin = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(poly_sin, z), x), x);
+
+	s = _mm_or_ps(_mm_and_ps(use_sin_poly, poly_sin), _mm_andnot_ps(use_sin_poly, poly_cos));
+	c = _mm_or_ps(_mm_and_ps(use_sin_poly, poly_cos), _mm_andnot_ps(use_sin_poly, poly_sin));
+
+	s = _mm_xor_ps(s, sign_sin);
+	c = _mm_xor_ps(c, sign_cos);
+}
+
+// atan2 of 4 pairs, with the signed zero cases of the C library: the result
+// takes the sign of y, and a negative x, -0 included, gives +-pi.
+static inline __m128 atan2_ps(__m128 y, __m128 x)
+{
+	const __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+	const __m128 abs_y = _mm_andnot_ps(sign_mask, y);
+	const __m128 abs_x = _mm_andnot_ps(sign_mask, x);
+	const __m128 num = _mm_min_ps(abs_x, abs_y);
+	const __m128 den = _mm_max_ps(abs_x, abs_y);
+
+	// atan of t in [0, 1], Cephes single precision polynomial.
+	__m128 t = _mm_and_ps(_mm_div_ps(num, den), _mm_cmpgt_ps(den, _mm_setzero_ps()));
+
+	const __m128 reduce = _mm_cmpgt_ps(t, _mm_set1_ps(0.4142135623730950f));
+	t = _mm_or_ps(
+		_mm_and_ps(reduce, _mm_div_ps(_mm_sub_ps(t, _mm_set1_ps(1.0f)), _mm_add_ps(t, _mm_set1_ps(1.0f)))),
+		_mm_andnot_ps(reduce, t));
+
+	const __m128 z = _mm_mul_ps(t, t);
+
+	__m128 a = _mm_set1_ps(8.05374449538e-2f);
+	a = _mm_add_ps(_mm_mul_ps(a, z), _mm_set1_ps(-1.38776856032e-1f));
+	a = _mm_add_ps(_mm_mul_ps(a, z), _mm_set1_ps(1.99777106478e-1f));
+	a = _mm_add_ps(_mm_mul_ps(a, z), _mm_set1_ps(-3.33329491539e-1f));
+	a = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(a, z), t), t);
+	a = _mm_add_ps(a, _mm_and_ps(reduce, _mm_set1_ps(0.78539816339744830962f)));
+
+	const __m128 steep = _mm_cmpgt_ps(abs_y, abs_x);
+	a = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(_mm_set1_ps(1.57079632679489661923f), a)), _mm_andnot_ps(steep, a));
+
+	const __m128 negative_x = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(x), 31));
+	a = _mm_or_ps(_mm_and_ps(negative_x, _mm_sub_ps(_mm_set1_ps(3.14159265358979323846f), a)), _mm_andnot_ps(negative_x, a));
+
+	return _mm_or_ps(a, _mm_and_ps(y, sign_mask));
+}
+
+void EulerAnglesToLocalTransforms(s_animation_frame_entry_t* entries, const int* bones,
+	const glm::vec3* angles, const glm::vec3* positions, int count)
+{
+	alignas(16) float angle_x[EULER_BLOCK_SIZE];
+	alignas(16) float angle_y[EULER_BLOCK_SIZE];
+	alignas(16) float angle_z[EULER_BLOCK_SIZE];
+
+	for (int block = 0; block < count; block += EULER_BLOCK_SIZE)
+	{
+		const int block_size = std::min(EULER_BLOCK_SIZE, count - block);
+
+		for (int k = 0; k < block_size; ++k)
+		{
+			angle_x[k] = angles[block + k].x;
+			angle_y[k] = angles[block + k].y;
+			angle_z[k] = angles[block + k].z;
+		}
+		for (int k = block_size; k < (block_size + 3) / 4 * 4; ++k)
+			angle_x[k] = angle_y[k] = angle_z[k] = 0.0f;
+
+		for (int k = 0; k < block_size; k += 4)
+		{
+			__m128 s1, c1, s2, c2, s3, c3;
+			sincos_ps(_mm_load_ps(angle_z + k), s1, c1);
+			sincos_ps(_mm_load_ps(angle_y + k), s2, c2);
+			sincos_ps(_mm_load_ps(angle_x + k), s3, c3);
+
+			// Columns of glm::eulerAngleZYX(z, y, x), one bone per lane.
+			__m128 c0x = _mm_mul_ps(c1, c2);
+			__m128 c0y = _mm_mul_ps(c2, s1);
+			__m128 c0z = _mm_xor_ps(s2, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+			__m128 c0w = _mm_setzero_ps();
+			__m128 c1x = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(c1, s2), s3), _mm_mul_ps(c3, s1));
+			__m128 c1y = _mm_add_ps(_mm_mul_ps(c1, c3), _mm_mul_ps(_mm_mul_ps(s1, s2), s3));
+			__m128 c1z = _mm_mul_ps(c2, s3);
+			__m128 c1w = _mm_setzero_ps();
+			__m128 c2x = _mm_add_ps(_mm_mul_ps(s1, s3), _mm_mul_ps(_mm_mul_ps(c1, c3), s2));
+			__m128 c2y = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(c3, s1), s2), _mm_mul_ps(c1, s3));
+			__m128 c2z = _mm_mul_ps(c2, c3);
+			__m128 c2w = _mm_setzero_ps();
+
+			_MM_TRANSPOSE4_PS(c0x, c0y, c0z, c0w);
+			_MM_TRANSPOSE4_PS(c1x, c1y, c1z, c1w);
+			_MM_TRANSPOSE4_PS(c2x, c2y, c2z, c2w);
+
+			const __m128 columns[3][4] = {
+				{ c0x, c0y, c0z, c0w },
+				{ c1x, c1y, c1z, c1w },
+				{ c2x, c2y, c2z, c2w },
+			};
+
+			const int lanes = std::min(4, block_size - k);
+			for (int lane = 0; lane < lanes; ++lane)
+			{
+				glm::mat4& m = entries[bones[block + k + lane]].local_transform;
+				_mm_storeu_ps(&m[0][0], columns[0][lane]);
+				_mm_storeu_ps(&m[1][0], columns[1][lane]);
+				_mm_storeu_ps(&m[2][0], columns[2][lane]);
+				m[3] = glm::vec4(positions[block + k + lane], 1.0f);
+			}
+		}
+	}
+}
+
+void LocalTransformsToEulerAngles(const s_animation_frame_entry_t* entries, int count,
+	glm::vec3* angles, glm::vec3* positions)
+{
+	// Elements of the rotations used by glm::extractEulerAngleZYX, m[column][row].
+	alignas(16) float m00[EULER_BLOCK_SIZE], m01[EULER_BLOCK_SIZE], m02[EULER_BLOCK_SIZE];
+	alignas(16) float m10[EULER_BLOCK_SIZE], m11[EULER_BLOCK_SIZE], m12[EULER_BLOCK_SIZE];
+	alignas(16) float m20[EULER_BLOCK_SIZE], m21[EULER_BLOCK_SIZE], m22[EULER_BLOCK_SIZE];
+
+	for (int block = 0; block < count; block += EULER_BLOCK_SIZE)
+	{
+		const int block_size = std::min(EULER_BLOCK_SIZE, count - block);
+
+		for (int k = 0; k < block_size; ++k)
+		{
+			const glm::mat4& m = entries[block + k].local_transform;
+			m00[k] = m[0][0]; m01[k] = m[0][1]; m02[k] = m[0][2];
+			m10[k] = m[1][0]; m11[k] = m[1][1]; m12[k] = m[1][2];
+			m20[k] = m[2][0]; m21[k] = m[2][1]; m22[k] = m[2][2];
+			positions[block + k] = m[3];
+		}
+		for (int k = block_size; k < (block_size + 3) / 4 * 4; ++k)
+			m00[k] = m01[k] = m02[k] = m10[k] = m11[k] = m12[k] = m20[k] = m21[k] = m22[k] = 0.0f;
+
+		for (int k = 0; k < block_size; k += 4)
+		{
+			const __m128 v00 = _mm_load_ps(m00 + k), v01 = _mm_load_ps(m01 + k), v02 = _mm_load_ps(m02 + k);
+			const __m128 v10 = _mm_load_ps(m10 + k), v11 = _mm_load_ps(m11 + k), v12 = _mm_load_ps(m12 + k);
+			const __m128 v20 = _mm_load_ps(m20 + k), v21 = _mm_load_ps(m21 + k), v22 = _mm_load_ps(m22 + k);
+
+			const __m128 t1 = atan2_ps(v01, v00);
+			const __m128 c2 = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(v12, v12), _mm_mul_ps(v22, v22)));
+			const __m128 t2 = atan2_ps(_mm_xor_ps(v02, _mm_castsi128_ps(_mm_set1_epi32(0x80000000))), c2);
+
+			__m128 s1, c1;
+			sincos_ps(t1, s1, c1);
+			const __m128 t3 = atan2_ps(
+				_mm_sub_ps(_mm_mul_ps(s1, v20), _mm_mul_ps(c1, v21)),
+				_mm_sub_ps(_mm_mul_ps(c1, v11), _mm_mul_ps(s1, v10)));
+
+			// t3 is x, t2 is y and t1 is z.
+			_mm_store_ps(m00 + k, t3);
+			_mm_store_ps(m01 + k, t2);
+			_mm_store_ps(m02 + k, t1);
+		}
+
+		for (int k = 0; k < block_size; ++k)
+			angles[block + k] = glm::vec3(m00[k], m01[k], m02[k]);
+	}
+}
+
+#else
+
+void EulerAnglesToLocalTransforms(s_animation_frame_entry_t* entries, const int* bones,
+	const glm::vec3* angles, const glm::vec3* positions, int count)
+{
+	for (int k = 0; k < count; ++k)
+	{
+		glm::mat4& m = entries[bones[k]].local_transform;
+		m = glm::eulerAngleZYX(angles[k].z, angles[k].y, angles[k].x);
+		m[3] = glm::vec4(positions[k], 1.0f);
+	}
+}
+
+void LocalTransformsToEulerAngles(const s_animation_frame_entry_t* entries, int count,
+	glm::vec3* angles, glm::vec3* positions)
+{
+	for (int k = 0; k < count; ++k)
+	{
+		const glm::mat4& m = entries[k].local_transform;
+		glm::extractEulerAngleZYX(m, angles[k].z, angles[k].y, angles[k].x);
+		positions[k] = m[3];
+	}
+}
+
+#endif
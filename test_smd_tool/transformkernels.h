@@ -0,0 +1,49 @@
+#pragma once
+
+#include "smdfile.h"
+
+//
+// SIMD kernels for the world transform builds and the Euler angle conversions.
+//
+// The world transform kernel is picked once from the CPU features: AVX
+// computes two columns of the product per instruction, SSE one, and the
+// scalar kernel uses the glm product of s_affinetransform_t::Multiply. SSE is
+// slower than the scalar kernel, so without AVX the scalar one is used. All of
+// them do the same multiplies and adds in the same order, without fused
+// multiply-add, so they give bit-identical results.
+//
+enum class TransformKernel
+{
+	SCALAR = 0,
+	SSE = 1,
+	AVX = 2,
+};
+
+// Compute the world transform of each bone of bones, in order, from its local
+// transform and the world transform of its parent. entries are the bones of a
+// single frame. Parents must come before their children in bones, or be up to date.
+void BuildWorldTransforms(s_animation_frame_entry_t* entries, const s_node_t* nodes, const int* bones, int count);
+
+// Kernel used by default, AVX if the CPU supports it, scalar otherwise.
+TransformKernel GetSupportedTransformKernel();
+TransformKernel GetTransformKernel();
+// Select the kernel used by BuildWorldTransforms, to compare them. Kernels the
+// CPU does not support fall back to the default one. Do not call while
+// transforms are being built.
+void SetTransformKernel(TransformKernel kernel);
+const char* GetTransformKernelName(TransformKernel kernel);
+
+// Euler angle conversions over blocks of bones, for loading and saving SMD files.
+//
+// Angles are in the SMD order: x, y, z, applied as Z * Y * X. The sines,
+// cosines and arc tangents of a block are computed 4 at a time with SSE2
+// polynomials. For angles in [-pi, pi], transforms are within 3e-7 of
+// glm::eulerAngleZYX and angles within 5e-7 of glm::extractEulerAngleZYX,
+// except that an angle of +-pi may come out with the other sign.
+
+// Set the local transform of bones[k] from angles[k] and positions[k], for k in [0, count).
+void EulerAnglesToLocalTransforms(s_animation_frame_entry_t* entries, const int* bones,
+	const glm::vec3* angles, const glm::vec3* positions, int count);
+// Euler angles and position of the local transform of the first count entries.
+void LocalTransformsToEulerAngles(const s_animation_frame_entry_t* entries, int count,
+	glm::vec3* angles, glm::vec3* positions);